@@ -2,8 +2,11 @@
 app.py - Flask Backend for Movie Recommender System
 
 Provides REST API endpoints for:
-- /search: Autocomplete search for movies by name
+- /search: Autocomplete search for movies by name (the C engine's title
+  index when available, otherwise a scan of the loaded movies)
 - /recommend: Generate weighted recommendations using C engine
+  (the in-process recommender_ext module when it is built, otherwise a
+  persistent `recommender --serve` process shared by all requests)
 
 Usage: python app.py
 Server runs on http://127.0.0.1:5000
@@ -11,8 +14,16 @@ Server runs on http://127.0.0.1:5000
 
 from flask import Flask, request, jsonify, send_from_directory
 import subprocess
+import threading
 import os
 import csv
+import functools
+import json
+
+try:
+    import recommender_ext
+except ImportError:
+    recommender_ext = None
 
 app = Flask(__name__, static_folder='static')
 
@@ -51,6 +62,247 @@ def load_movies():
     except Exception as e:
         print(f"Error loading movies: {e}")
 
+# =====================================================
+# RECOMMENDER DAEMON
+# =====================================================
+
+class RecommenderError(Exception):
+    """Raised when the C engine reports an error or stops responding"""
+
+
+class RecommenderDaemon:
+    """
+    Long-running `recommender --serve` process
+
+    The C engine loads movies.txt and builds the knowledge graph once, then
+    answers one query per line on stdin. With --format ndjson each reply is
+    one JSON object per recommendation (or a single {"error": ...} object)
+    terminated by an empty line. extra_args are passed before those flags,
+    e.g. ['--snapshot', path] to serve one shard.
+    """
+
+    def __init__(self, path, cwd, timeout=10, extra_args=()):
+        self.path = path
+        self.cwd = cwd
+        self.extra_args = list(extra_args)
+        self.timeout = timeout
+        self.process = None
+        self.lock = threading.Lock()
+
+    def _start(self):
+        self.process = subprocess.Popen(
+            [self.path] + self.extra_args + ['--serve', '--format', 'ndjson'],
+            stdin=subprocess.PIPE,
+            stdout=subprocess.PIPE,
+            text=True,
+            bufsize=1,
+            cwd=self.cwd
+        )
+
+    def _stop(self):
+        if self.process is not None:
+            self.process.kill()
+            self.process.wait()
+            self.process = None
+
+    def _exchange(self, request_line):
+        """Send one request and read lines up to the empty terminator line"""
+        self.process.stdin.write(request_line + '\n')
+        self.process.stdin.flush()
+
+        # Kill the engine if it does not answer in time; readline then hits EOF
+        timer = threading.Timer(self.timeout, self.process.kill)
+        timer.start()
+        try:
+            lines = []
+            while True:
+                line = self.process.stdout.readline()
+                if not line:
+                    if not timer.is_alive():
+                        raise RecommenderError('Recommendation engine timed out')
+                    raise RecommenderError('Recommendation engine exited unexpectedly')
+                line = line.rstrip('\n')
+                if not line:
+                    return lines
+                lines.append(line)
+        finally:
+            timer.cancel()
+
+    def query(self, request_line):
+        """Return the reply objects for one request, starting the engine if needed"""
+        with self.lock:
+            if self.process is None or self.process.poll() is not None:
+                self._start()
+            try:
+                lines = self._exchange(request_line)
+            except (OSError, RecommenderError):
+                # Drop the broken process; the next request starts a fresh one
+                self._stop()
+                raise
+        rows = [json.loads(line) for line in lines]
+        if rows and 'error' in rows[0]:
+            raise RecommenderError(rows[0]['error'])
+        return rows
+
+# =====================================================
+# IN-PROCESS ENGINE
+# =====================================================
+
+# One engine per worker process, loaded on first use; queries release the
+# GIL, so request threads score in parallel
+recommender_engine = None
+recommender_engine_lock = threading.Lock()
+
+def get_recommender_engine():
+    """Load the catalog into recommender_ext once, or return None if not built"""
+    global recommender_engine
+    if recommender_ext is None:
+        return None
+    with recommender_engine_lock:
+        if recommender_engine is None:
+            movies_file = os.path.join(os.path.dirname(__file__), 'movies.txt')
+            recommender_engine = recommender_ext.Engine(movies_file)
+    return recommender_engine
+
+def movie_from_row(row):
+    """Movie dict from an engine (id, title, genre, rating, director) tuple"""
+    movie_id, title, genre, rating, director = row
+    return {'id': movie_id, 'title': title, 'genre': genre, 'rating': rating, 'director': director}
+
+def recommend_in_process(engine, movie_id, genre_weight, rating_weight, director_weight):
+    """Recommendation dicts straight from the engine's result tuples"""
+    return [
+        movie_from_row(row)
+        for row in engine.recommend(movie_id, genre_weight, rating_weight, director_weight)
+    ]
+
+def get_recommender_path():
+    """Path of the compiled C recommender program (Windows or Linux)"""
+    program = 'recommender.exe' if os.name == 'nt' else 'recommender'
+    return os.path.join(os.path.dirname(__file__), program)
+
+recommender_daemon = None
+
+def get_recommender_daemon(recommender_path):
+    """Create the shared daemon client on first use"""
+    global recommender_daemon
+    if recommender_daemon is None:
+        recommender_daemon = RecommenderDaemon(recommender_path, os.path.dirname(__file__) or '.')
+    return recommender_daemon
+
+# =====================================================
+# SHARDED RECOMMENDATIONS
+# =====================================================
+
+# Comma-separated shard snapshots, each written with
+# `recommender --build-snapshot --shards <n> --shard <i>` from movies.txt
+RECOMMENDER_SHARDS = [path for path in os.environ.get('RECOMMENDER_SHARDS', '').split(',') if path]
+SHARD_RESULT_COUNT = 20
+
+shard_daemons = None
+
+def get_shard_daemons(recommender_path):
+    """One daemon per configured shard snapshot, or None when unsharded"""
+    global shard_daemons
+    if not RECOMMENDER_SHARDS:
+        return None
+    if shard_daemons is None:
+        cwd = os.path.dirname(__file__) or '.'
+        shard_daemons = [
+            RecommenderDaemon(recommender_path, cwd, extra_args=['--snapshot', path])
+            for path in RECOMMENDER_SHARDS
+        ]
+    return shard_daemons
+
+def compare_scored(a, b):
+    """
+    Order PARTIAL rows as compareCandidates does: score, then rating,
+    then id, all descending
+
+    A rating that is not finite arrives as null; the engine's comparisons
+    with it are all false, so it ties on rating and the id decides.
+    """
+    if a['score'] != b['score']:
+        return b['score'] - a['score']
+    if a['rating'] is not None and b['rating'] is not None and a['rating'] != b['rating']:
+        return 1 if b['rating'] > a['rating'] else -1
+    return (b['id'] > a['id']) - (b['id'] < a['id'])
+
+def recommend_from_shards(daemons, movie_id, genre_weight, rating_weight, director_weight):
+    """
+    Ask every shard for its best scored candidates and merge them
+
+    Each shard holds only the edges to the movies it owns, so its PARTIAL
+    reply is the top of its slice; the top SHARD_RESULT_COUNT of all the
+    slices, in the engine's order (score, then rating, then id, all
+    descending), is the unsharded answer.
+    """
+    request_line = (f'PARTIAL {movie_id} {genre_weight} {rating_weight} '
+                    f'{director_weight} {SHARD_RESULT_COUNT}')
+    replies = [None] * len(daemons)
+    errors = []
+
+    def ask(index):
+        try:
+            replies[index] = daemons[index].query(request_line)
+        except (OSError, RecommenderError) as e:
+            errors.append(e)
+
+    threads = [threading.Thread(target=ask, args=(i,)) for i in range(len(daemons))]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+    if errors:
+        raise RecommenderError(str(errors[0]))
+
+    candidates = [row for reply in replies for row in reply]
+    candidates.sort(key=functools.cmp_to_key(compare_scored))
+    recommendations = []
+    for row in candidates[:SHARD_RESULT_COUNT]:
+        movie = movie_by_id.get(row['id'])
+        if movie is None:
+            raise RecommenderError(f'Shard returned unknown movie {row["id"]}')
+        recommendations.append(dict(movie))
+    return recommendations
+
+# Longest /search text; longer text matches no title and would not fit
+# the daemon's request line
+SEARCH_QUERY_MAX_BYTES = 256
+
+def find_titles(query, limit=10):
+    """
+    Movies whose title contains query, ignoring case, in catalog order
+
+    Uses the C engine's title index - in-process, or through the daemon's
+    SEARCH request - and scans the loaded movies only when neither is built
+    """
+    # A title never spans lines, and a newline would end the daemon request
+    if '\n' in query or '\r' in query:
+        return []
+    if len(query.encode('utf-8')) > SEARCH_QUERY_MAX_BYTES:
+        return []
+
+    engine = get_recommender_engine()
+    if engine is not None:
+        return [movie_from_row(row) for row in engine.search(query, limit)]
+
+    recommender_path = get_recommender_path()
+    if os.path.exists(recommender_path) and limit <= 10:
+        try:
+            return get_recommender_daemon(recommender_path).query(f'SEARCH {query}')[:limit]
+        except RecommenderError:
+            pass  # Answer from the loaded movies instead
+
+    query = query.lower()
+    results = []
+    for movie in movies:
+        if query in movie['title'].lower():
+            results.append(dict(movie))
+            if len(results) >= limit:
+                break
+    return results
+
 # =====================================================
 # STATIC FILE SERVING
 # =====================================================
@@ -80,26 +332,12 @@ def search():
     Returns:
         JSON array of matching movies (max 10)
     """
-    query = request.args.get('name', '').lower().strip()
+    query = request.args.get('name', '').strip()
     
     if not query:
         return jsonify([])
     
-    # Find movies that contain the search query
-    results = []
-    for movie in movies:
-        if query in movie['title'].lower():
-            results.append({
-                'id': movie['id'],
-                'title': movie['title'],
-                'genre': movie['genre'],
-                'rating': movie['rating'],
-                'director': movie['director']
-            })
-            if len(results) >= 10:
-                break
-    
-    return jsonify(results)
+    return jsonify(find_titles(query))
 
 @app.route('/recommend', methods=['POST'])
 def recommend():
@@ -134,73 +372,74 @@ def recommend():
         # Find movie by name (case-insensitive)
         movie = movie_by_name.get(movie_name.lower())
         
-        if not movie:
+        if not movie and movie_name:
             # Try partial match
-            for m in movies:
-                if movie_name.lower() in m['title'].lower():
-                    movie = m
-                    break
+            matches = find_titles(movie_name, limit=1)
+            if matches:
+                movie = matches[0]
         
         if not movie:
             return jsonify({'error': f'Movie "{movie_name}" not found'}), 404
         
         movie_id = movie['id']
-        
+        base_movie = {
+            'id': movie['id'],
+            'title': movie['title'],
+            'genre': movie['genre'],
+            'rating': movie['rating'],
+            'director': movie['director']
+        }
+        weights = {
+            'genre': genre_weight,
+            'rating': rating_weight,
+            'director': director_weight
+        }
+
         # Call C recommender program (works on both Windows and Linux)
-        if os.name == 'nt':  # Windows
-            recommender_path = os.path.join(os.path.dirname(__file__), 'recommender.exe')
-        else:  # Linux (Render)
-            recommender_path = os.path.join(os.path.dirname(__file__), 'recommender')
-        
+        recommender_path = get_recommender_path()
+
+        shards = get_shard_daemons(recommender_path)
+        if shards is not None:
+            try:
+                recommendations = recommend_from_shards(shards, movie_id, genre_weight,
+                                                        rating_weight, director_weight)
+            except RecommenderError as e:
+                return jsonify({'error': f'Recommender error: {str(e)}'}), 500
+            return jsonify({
+                'base_movie': base_movie,
+                'recommendations': recommendations,
+                'weights': weights
+            })
+
+        engine = get_recommender_engine()
+        if engine is not None:
+            try:
+                recommendations = recommend_in_process(engine, movie_id, genre_weight,
+                                                       rating_weight, director_weight)
+            except (KeyError, ValueError) as e:
+                return jsonify({'error': f'Recommender error: {e}'}), 500
+            return jsonify({
+                'base_movie': base_movie,
+                'recommendations': recommendations,
+                'weights': weights
+            })
+
         if not os.path.exists(recommender_path):
             return jsonify({'error': 'Recommender engine not compiled. Please compile recommender.c first.'}), 500
         
         try:
-            result = subprocess.run(
-                [recommender_path, str(movie_id), str(genre_weight), str(rating_weight), str(director_weight)],
-                capture_output=True,
-                text=True,
-                timeout=10,
-                cwd=os.path.dirname(__file__)
-            )
-            
-            if result.returncode != 0:
-                return jsonify({'error': f'Recommender error: {result.stderr}'}), 500
-            
-            # Parse CSV output from C program
-            recommendations = []
-            for line in result.stdout.strip().split('\n'):
-                if not line:
-                    continue
-                parts = line.split(',')
-                if len(parts) >= 5:
-                    rec = {
-                        'id': int(parts[0]),
-                        'title': parts[1],
-                        'genre': parts[2],
-                        'rating': float(parts[3]),
-                        'director': parts[4]
-                    }
-                    recommendations.append(rec)
+            daemon = get_recommender_daemon(recommender_path)
+            # Rows arrive as JSON objects with the fields the API returns
+            recommendations = daemon.query(f'{movie_id} {genre_weight} {rating_weight} {director_weight}')
             
             return jsonify({
-                'base_movie': {
-                    'id': movie['id'],
-                    'title': movie['title'],
-                    'genre': movie['genre'],
-                    'rating': movie['rating'],
-                    'director': movie['director']
-                },
+                'base_movie': base_movie,
                 'recommendations': recommendations,
-                'weights': {
-                    'genre': genre_weight,
-                    'rating': rating_weight,
-                    'director': director_weight
-                }
+                'weights': weights
             })
             
-        except subprocess.TimeoutExpired:
-            return jsonify({'error': 'Recommendation engine timed out'}), 500
+        except RecommenderError as e:
+            return jsonify({'error': f'Recommender error: {str(e)}'}), 500
         except Exception as e:
             return jsonify({'error': f'Error running recommender: {str(e)}'}), 500
             
@@ -0,0 +1,802 @@
+/*
+ * benchmark.c - Benchmarks for the recommender engine
+ *
+ * With no arguments, measures per-query latency of
+ * recommendMoviesWeighted against the degree of the base movie, on
+ * synthetic star graphs built directly with addEdge.
+ *
+ * With --catalog, generates a seeded synthetic catalog with skewed
+ * genres, directors and ratings, then times each phase of the engine
+ * on it: loadMovies, buildKnowledgeGraph, single queries (p50/p99),
+ * batch throughput, title search (p50/p99, against a linear scan),
+ * approximate candidate lists (p50/p99 and recall@K against the exact
+ * path, stored edges only) and peak RSS.
+ *
+ * With --check, runs edge cases the timed runs miss, such as tiny and
+ * sparse catalogs built on many threads, IDs past the int32_t bounds,
+ * ratings that are not finite and queries for zero results, and reports
+ * ok or FAILED.
+ *
+ * Build: gcc -O2 -DRECOMMENDER_NO_MAIN -o benchmark benchmark.c recommender.c -lm -pthread
+ * Usage: ./benchmark
+ *        ./benchmark --catalog <movies> [--seed <n>] [--queries <n>]
+ *                    [--threads <n>] [--implicit] [--file <path>]
+ *        ./benchmark --generate <movies> <file> [--seed <n>]
+ *        ./benchmark --check [--file <path>]
+ * Output: CSV rows of degree,edges,queries,ns_per_query, or for
+ *         --catalog rows of movies,mode,phase,metric,value
+ */
+
+#include <math.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "movie.h"
+
+/* =====================================================
+ * TIMING HELPERS
+ * ===================================================== */
+
+static double nowSeconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* =====================================================
+ * SYNTHETIC GRAPHS
+ * ===================================================== */
+
+/*
+ * Build a star: movie 1 connected to movies 2..degree+1
+ * Every neighbor gets a rating edge; every 2nd a genre edge and every
+ * 7th a director edge, so scores and ratings both vary
+ * Returns the number of directed edges leaving the base movie
+ */
+static int buildStarGraph(KnowledgeGraph *kg, HashTable *ht, int degree) {
+  int edgeCount = 0;
+
+  static const char *directors[7] = {"Director 0", "Director 1",
+                                      "Director 2", "Director 3",
+                                      "Director 4", "Director 5",
+                                      "Director 6"};
+
+  for (int id = 1; id <= degree + 1; id++) {
+    Movie movie;
+    movie.id = id;
+    movie.title = makeStringView("Movie");
+    movie.genre = makeStringView("Genre");
+    movie.director = makeStringView(directors[id % 7]);
+    movie.rating = 6.5f + (float)(id % 26) * 0.1f;
+    insertMovie(ht, movie);
+  }
+
+  for (int id = 2; id <= degree + 1; id++) {
+    addEdge(kg, 1, id, RATING_SIMILAR);
+    edgeCount++;
+    if (id % 2 == 0) {
+      addEdge(kg, 1, id, GENRE_SIMILAR);
+      edgeCount++;
+    }
+    if (id % 7 == 0) {
+      addEdge(kg, 1, id, DIRECTOR_SIMILAR);
+      edgeCount++;
+    }
+  }
+
+  return edgeCount;
+}
+
+/* =====================================================
+ * SYNTHETIC CATALOGS
+ * ===================================================== */
+
+#define GENRE_COUNT 20
+#define DEFAULT_SEED 42
+#define DEFAULT_QUERIES 10000
+
+/* Seeded generator (splitmix64) so catalogs are the same everywhere */
+static uint64_t nextRandom(uint64_t *state) {
+  uint64_t z = (*state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+/* Uniform in [0, 1) */
+static double nextUniform(uint64_t *state) {
+  return (double)(nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*
+ * Zipf-like popularity: cdf[k] is the chance of drawing a rank <= k
+ * when rank k has weight 1 / (k + 1)^exponent
+ */
+static double *buildZipfCdf(int count, double exponent) {
+  double *cdf = (double *)malloc(count * sizeof(double));
+  if (cdf == NULL)
+    return NULL;
+
+  double total = 0.0;
+  for (int k = 0; k < count; k++) {
+    total += 1.0 / pow(k + 1, exponent);
+    cdf[k] = total;
+  }
+  for (int k = 0; k < count; k++) {
+    cdf[k] /= total;
+  }
+  return cdf;
+}
+
+static int drawZipf(const double *cdf, int count, uint64_t *state) {
+  double u = nextUniform(state);
+  int lo = 0, hi = count - 1;
+  while (lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    if (cdf[mid] < u)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+ * Write a catalog of movieCount movies to filename
+ *
+ * Genres follow a Zipf curve over GENRE_COUNT names and directors a
+ * steeper one over movieCount / 8 names, so a few of each dominate as
+ * in real catalogs. Ratings are normal around 6.4 (one decimal, 1.0 to
+ * 9.9). Returns 0 if the file could not be written
+ */
+static int generateCatalog(const char *filename, int movieCount,
+                           uint64_t seed) {
+  static const char *genres[GENRE_COUNT] = {
+      "Drama",   "Comedy",    "Action",  "Thriller",    "Romance",
+      "Horror",  "Crime",     "Sci-Fi",  "Adventure",   "Animation",
+      "Fantasy", "Mystery",   "Family",  "Documentary", "Biography",
+      "War",     "History",   "Music",   "Western",     "Sport"};
+
+  int directorCount = movieCount / 8 > 0 ? movieCount / 8 : 1;
+  double *genreCdf = buildZipfCdf(GENRE_COUNT, 1.0);
+  double *directorCdf = buildZipfCdf(directorCount, 1.1);
+  FILE *file = fopen(filename, "w");
+  if (genreCdf == NULL || directorCdf == NULL || file == NULL) {
+    fprintf(stderr, "Error: Cannot generate catalog %s\n", filename);
+    free(genreCdf);
+    free(directorCdf);
+    if (file != NULL)
+      fclose(file);
+    return 0;
+  }
+
+  uint64_t state = seed;
+  fprintf(file, "id,title,genre,rating,director\n");
+  for (int id = 1; id <= movieCount; id++) {
+    /* Box-Muller; the second value is discarded to keep one draw per row */
+    double u1 = nextUniform(&state), u2 = nextUniform(&state);
+    double normal = sqrt(-2.0 * log(1.0 - u1)) * cos(2.0 * 3.14159265358979323846 * u2);
+    int tenths = (int)lround((6.4 + 1.1 * normal) * 10.0);
+    if (tenths < 10)
+      tenths = 10;
+    if (tenths > 99)
+      tenths = 99;
+
+    int genre = drawZipf(genreCdf, GENRE_COUNT, &state);
+    int director = drawZipf(directorCdf, directorCount, &state);
+    fprintf(file, "%d,Movie %d,%s,%d.%d,Director %d\n", id, id,
+            genres[genre], tenths / 10, tenths % 10, director);
+  }
+
+  int ok = fclose(file) == 0;
+  free(genreCdf);
+  free(directorCdf);
+  if (!ok)
+    fprintf(stderr, "Error: Cannot generate catalog %s\n", filename);
+  return ok;
+}
+
+/* =====================================================
+ * BENCHMARKS
+ * ===================================================== */
+
+/*
+ * Per-query latency of recommendMoviesWeighted against base degree
+ */
+static void benchmarkQueryLatency(void) {
+  const int degrees[] = {16, 64, 256, 1024, 4096};
+  const int degreeCount = sizeof(degrees) / sizeof(degrees[0]);
+
+  printf("degree,edges,queries,ns_per_query\n");
+
+  for (int d = 0; d < degreeCount; d++) {
+    HashTable ht;
+    KnowledgeGraph kg;
+    initHashTable(&ht);
+    initKnowledgeGraph(&kg);
+
+    int edgeCount = buildStarGraph(&kg, &ht, degrees[d]);
+
+    /* Keep total work roughly constant across degrees */
+    int queries = 4000000 / edgeCount;
+    if (queries < 100)
+      queries = 100;
+
+    Candidate results[MAX_RECOMMENDATIONS];
+    int checksum = 0;
+
+    /* Warm-up query sizes the scratch buffers */
+    checksum += recommendMoviesWeighted(&kg, &ht, 1, 5, 5, 5, results,
+                                        MAX_RECOMMENDATIONS);
+
+    double start = nowSeconds();
+    for (int q = 0; q < queries; q++) {
+      checksum += recommendMoviesWeighted(&kg, &ht, 1, 1 + q % 10, 5, 3,
+                                          results, MAX_RECOMMENDATIONS);
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("%d,%d,%d,%.0f\n", degrees[d], edgeCount, queries,
+           elapsed * 1e9 / queries);
+    if (checksum == 0) {
+      fprintf(stderr, "Warning: benchmark produced no results\n");
+    }
+
+    freeKnowledgeGraph(&kg);
+    freeHashTable(&ht);
+  }
+}
+
+static int compareDoubles(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/* Peak resident set size in KiB (getrusage reports KiB on Linux) */
+static long peakRssKb(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return -1;
+  return usage.ru_maxrss;
+}
+
+/*
+ * Time searchTitles on random substrings of catalog titles, and the
+ * linear scan it replaces on the same substrings
+ */
+static int benchmarkTitleSearch(const HashTable *ht, int movieCount,
+                                const char *mode, uint64_t seed,
+                                int queryCount, double *latencies) {
+  TitleIndex index;
+  double start = nowSeconds();
+  if (!buildTitleIndex(&index, ht->ids, ht->strings, ht->count))
+    return 0;
+  printf("%d,%s,search,index_seconds,%.6f\n", movieCount, mode,
+         nowSeconds() - start);
+
+  uint64_t state = seed ^ 0x5A5A5A5Aull;
+  StringView *texts = (StringView *)malloc(queryCount * sizeof(StringView));
+  if (texts == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for queries\n");
+    freeTitleIndex(&index);
+    return 0;
+  }
+  for (int q = 0; q < queryCount; q++) {
+    StringView title = ht->strings[nextRandom(&state) % ht->count].title;
+    int length = 1 + (int)(nextRandom(&state) % 6);
+    if (length > title.length)
+      length = title.length;
+    int from = (int)(nextRandom(&state) % (title.length - length + 1));
+    texts[q].data = title.data + from;
+    texts[q].length = length;
+  }
+
+  int32_t ids[TITLE_SEARCH_MAX_RESULTS];
+  long found = 0;
+  for (int q = 0; q < queryCount; q++) {
+    start = nowSeconds();
+    found += searchTitles(&index, texts[q], ids, TITLE_SEARCH_MAX_RESULTS);
+    latencies[q] = nowSeconds() - start;
+  }
+  qsort(latencies, queryCount, sizeof(double), compareDoubles);
+  printf("%d,%s,search,p50_ns,%.0f\n", movieCount, mode,
+         latencies[queryCount / 2] * 1e9);
+  printf("%d,%s,search,p99_ns,%.0f\n", movieCount, mode,
+         latencies[(int)(queryCount * 0.99)] * 1e9);
+
+  /* What the app did before: test every title until the limit fills */
+  long scanned = 0;
+  start = nowSeconds();
+  for (int q = 0; q < queryCount; q++) {
+    int hits = 0;
+    for (int row = 0; row < ht->count && hits < TITLE_SEARCH_MAX_RESULTS;
+         row++)
+      hits += containsIgnoringCase(ht->strings[row].title, texts[q]);
+    scanned += hits;
+  }
+  printf("%d,%s,search,scan_mean_ns,%.0f\n", movieCount, mode,
+         (nowSeconds() - start) / queryCount * 1e9);
+  if (scanned != found) {
+    fprintf(stderr, "Warning: title index and scan disagree\n");
+  }
+
+  free(texts);
+  freeTitleIndex(&index);
+  return 1;
+}
+
+/* How many of the approximate IDs are among the exact ones */
+static int countShared(const Candidate *exact, int exactCount,
+                       const Candidate *approximate, int approximateCount) {
+  int shared = 0;
+  for (int i = 0; i < approximateCount; i++) {
+    for (int j = 0; j < exactCount; j++) {
+      if (approximate[i].movieId == exact[j].movieId) {
+        shared++;
+        break;
+      }
+    }
+  }
+  return shared;
+}
+
+/*
+ * Time approximate answers from candidate lists of a few sizes, and
+ * their recall@K against the exact path on the same queries
+ */
+static void benchmarkCandidates(KnowledgeGraph *kg, HashTable *ht,
+                                int movieCount, const char *mode,
+                                const BatchQuery *queries, int queryCount,
+                                int threadCount, double *latencies) {
+  static const int listSizes[] = {5, 10, 20};
+  Candidate exact[MAX_RECOMMENDATIONS];
+  Candidate approximate[MAX_RECOMMENDATIONS];
+
+  for (size_t s = 0; s < sizeof(listSizes) / sizeof(listSizes[0]); s++) {
+    double start = nowSeconds();
+    kg->candidates = buildCandidateLists(kg->csr, listSizes[s], threadCount);
+    if (kg->candidates == NULL)
+      return;
+    kg->approximateCandidates = 1;
+    printf("%d,%s,candidates_m%d,build_seconds,%.6f\n", movieCount, mode,
+           listSizes[s], nowSeconds() - start);
+    printf("%d,%s,candidates_m%d,hot_movies,%d\n", movieCount, mode,
+           listSizes[s], kg->candidates->hotCount);
+
+    long exactTotal = 0, shared = 0;
+    for (int q = 0; q < queryCount; q++) {
+      const BatchQuery *query = &queries[q];
+      start = nowSeconds();
+      int approximateCount = recommendMoviesWeighted(
+          kg, ht, query->baseMovieId, query->genreWeight, query->ratingWeight,
+          query->directorWeight, approximate, query->maxResults);
+      latencies[q] = nowSeconds() - start;
+
+      int exactCount = recommendFromGraph(
+          kg->csr, query->baseMovieId, query->genreWeight, query->ratingWeight,
+          query->directorWeight, exact, query->maxResults);
+      exactTotal += exactCount;
+      shared += countShared(exact, exactCount, approximate, approximateCount);
+    }
+    qsort(latencies, queryCount, sizeof(double), compareDoubles);
+    printf("%d,%s,candidates_m%d,p50_ns,%.0f\n", movieCount, mode,
+           listSizes[s], latencies[queryCount / 2] * 1e9);
+    printf("%d,%s,candidates_m%d,p99_ns,%.0f\n", movieCount, mode,
+           listSizes[s], latencies[(int)(queryCount * 0.99)] * 1e9);
+    printf("%d,%s,candidates_m%d,recall_at_%d,%.4f\n", movieCount, mode,
+           listSizes[s], MAX_RECOMMENDATIONS,
+           exactTotal > 0 ? (double)shared / exactTotal : 1.0);
+
+    freeCandidateLists(kg->candidates);
+    kg->candidates = NULL;
+    kg->approximateCandidates = 0;
+  }
+}
+
+static void batchChecksum(int queryIndex, const Candidate *results,
+                          int resultCount, void *context) {
+  (void)queryIndex;
+  (void)results;
+  *(long *)context += resultCount;
+}
+
+/*
+ * Time each engine phase on a generated catalog
+ * Stored edges grow about quadratically (the rating rule links roughly
+ * a third of all pairs), so catalogs past ~10^4 movies need --implicit
+ */
+static int benchmarkCatalog(int movieCount, uint64_t seed, int queryCount,
+                            int threadCount, int implicitEdges,
+                            const char *filename) {
+  const char *mode = implicitEdges ? "implicit" : "explicit";
+  printf("movies,mode,phase,metric,value\n");
+
+  double start = nowSeconds();
+  if (!generateCatalog(filename, movieCount, seed))
+    return 1;
+  printf("%d,%s,generate,seconds,%.6f\n", movieCount, mode,
+         nowSeconds() - start);
+
+  HashTable ht;
+  KnowledgeGraph kg;
+  initHashTable(&ht);
+  initKnowledgeGraph(&kg);
+  kg.implicitEdges = implicitEdges;
+  kg.buildThreads = threadCount;
+
+  start = nowSeconds();
+  int loaded = loadMovies(filename, &ht);
+  double elapsed = nowSeconds() - start;
+  remove(filename);
+  if (loaded == 0) {
+    fprintf(stderr, "Error: No movies loaded from file\n");
+    freeHashTable(&ht);
+    return 1;
+  }
+  printf("%d,%s,load,seconds,%.6f\n", movieCount, mode, elapsed);
+  printf("%d,%s,load,movies_per_second,%.0f\n", movieCount, mode,
+         loaded / elapsed);
+
+  start = nowSeconds();
+  buildKnowledgeGraph(&kg, &ht);
+  printf("%d,%s,build,seconds,%.6f\n", movieCount, mode,
+         nowSeconds() - start);
+  printf("%d,%s,build,neighbor_entries,%llu\n", movieCount, mode,
+         (unsigned long long)(kg.csr != NULL ? kg.csr->edgeCount : 0));
+
+  /* The same seeded queries feed both the single and the batch phase */
+  BatchQuery *queries = (BatchQuery *)malloc(queryCount * sizeof(BatchQuery));
+  double *latencies = (double *)malloc(queryCount * sizeof(double));
+  if (queries == NULL || latencies == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for queries\n");
+    free(queries);
+    free(latencies);
+    freeKnowledgeGraph(&kg);
+    freeHashTable(&ht);
+    return 1;
+  }
+  uint64_t state = seed ^ 0xA5A5A5A5ull;
+  for (int q = 0; q < queryCount; q++) {
+    queries[q].baseMovieId = ht.ids[nextRandom(&state) % ht.count];
+    queries[q].genreWeight = (int)(nextRandom(&state) % 11);
+    queries[q].ratingWeight = (int)(nextRandom(&state) % 11);
+    queries[q].directorWeight = (int)(nextRandom(&state) % 11);
+    queries[q].maxResults = MAX_RECOMMENDATIONS;
+  }
+
+  Candidate results[MAX_RECOMMENDATIONS];
+  long checksum = 0;
+  for (int q = 0; q < queryCount; q++) {
+    start = nowSeconds();
+    checksum += recommendMoviesWeighted(
+        &kg, &ht, queries[q].baseMovieId, queries[q].genreWeight,
+        queries[q].ratingWeight, queries[q].directorWeight, results,
+        queries[q].maxResults);
+    latencies[q] = nowSeconds() - start;
+  }
+  qsort(latencies, queryCount, sizeof(double), compareDoubles);
+  double total = 0.0;
+  for (int q = 0; q < queryCount; q++) {
+    total += latencies[q];
+  }
+  printf("%d,%s,query,p50_ns,%.0f\n", movieCount, mode,
+         latencies[queryCount / 2] * 1e9);
+  printf("%d,%s,query,p99_ns,%.0f\n", movieCount, mode,
+         latencies[(int)(queryCount * 0.99)] * 1e9);
+  printf("%d,%s,query,mean_ns,%.0f\n", movieCount, mode,
+         total / queryCount * 1e9);
+
+  long batchResults = 0;
+  start = nowSeconds();
+  recommendBatch(&kg, &ht, queries, queryCount, threadCount, batchChecksum,
+                 &batchResults);
+  elapsed = nowSeconds() - start;
+  printf("%d,%s,batch,queries_per_second,%.0f\n", movieCount, mode,
+         queryCount / elapsed);
+
+  benchmarkTitleSearch(&ht, movieCount, mode, seed, queryCount, latencies);
+  if (kg.csr != NULL)
+    benchmarkCandidates(&kg, &ht, movieCount, mode, queries, queryCount,
+                        threadCount, latencies);
+
+  printf("%d,%s,memory,peak_rss_kb,%ld\n", movieCount, mode, peakRssKb());
+  if (batchResults != checksum) {
+    fprintf(stderr, "Warning: batch and single queries disagree\n");
+  }
+
+  free(queries);
+  free(latencies);
+  freeKnowledgeGraph(&kg);
+  freeHashTable(&ht);
+  return 0;
+}
+
+/* =====================================================
+ * CHECKS
+ * ===================================================== */
+
+/*
+ * Write a catalog where every movie has its own genre and director and
+ * ratings 1.0 apart, so no two movies are linked, except the rows in
+ * [denseBegin, denseEnd), which share one genre
+ * Returns 0 if the file could not be written
+ */
+static int writeSparseCatalog(const char *filename, int movieCount,
+                              int denseBegin, int denseEnd) {
+  FILE *file = fopen(filename, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Cannot generate catalog %s\n", filename);
+    return 0;
+  }
+
+  fprintf(file, "id,title,genre,rating,director\n");
+  for (int row = 0; row < movieCount; row++) {
+    int dense = row >= denseBegin && row < denseEnd;
+    fprintf(file, "%d,Movie %d,Genre %d,%d.0,Director %d\n", row + 1, row + 1,
+            dense ? -1 : row, row, row);
+  }
+
+  int ok = fclose(file) == 0;
+  if (!ok)
+    fprintf(stderr, "Error: Cannot generate catalog %s\n", filename);
+  return ok;
+}
+
+/*
+ * Build filename's catalog on one thread and on threadCount threads
+ * Returns 1 if both builds produced the same neighbor lists
+ */
+static int checkBuildThreads(const char *filename, int threadCount) {
+  HashTable ht;
+  KnowledgeGraph serial, parallel;
+  initHashTable(&ht);
+  initKnowledgeGraph(&serial);
+  initKnowledgeGraph(&parallel);
+  serial.buildThreads = 1;
+  parallel.buildThreads = threadCount;
+
+  int ok = loadMovies(filename, &ht) > 0;
+  if (ok) {
+    buildKnowledgeGraph(&serial, &ht);
+    buildKnowledgeGraph(&parallel, &ht);
+    ok = serial.csr != NULL && parallel.csr != NULL;
+  }
+
+  if (ok) {
+    const CsrGraph *a = serial.csr, *b = parallel.csr;
+    size_t edges = (size_t)a->edgeCount;
+    ok = a->nodeCount == b->nodeCount && a->edgeCount == b->edgeCount &&
+         memcmp(a->offsets, b->offsets,
+                (a->nodeCount + 1) * sizeof(uint64_t)) == 0 &&
+         (edges == 0 ||
+          (memcmp(a->targets, b->targets, edges * sizeof(int32_t)) == 0 &&
+           memcmp(a->edgeMasks, b->edgeMasks, edges) == 0));
+  }
+
+  freeKnowledgeGraph(&serial);
+  freeKnowledgeGraph(&parallel);
+  freeHashTable(&ht);
+  return ok;
+}
+
+/*
+ * Load IDs at and past the int32_t bounds: the ones that fit load with
+ * their exact value, the ones that overflow are skipped as malformed
+ * Returns 1 if the catalog loaded as expected
+ */
+static int checkLoaderIdRange(const char *filename) {
+  static const char *const rows[] = {
+      "99999999999,Too Big,Drama,7.0,Director 1",
+      "-2147483649,Too Small,Drama,7.0,Director 1",
+      "2147483648,Just Too Big,Drama,7.0,Director 1",
+      "2147483647,Max,Drama,7.0,Director 1",
+      "-2147483648,Min,Drama,7.0,Director 1",
+      "7,Normal,Drama,7.0,Director 1",
+  };
+  static const int expected[] = {INT32_MAX, INT32_MIN, 7};
+
+  FILE *file = fopen(filename, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Cannot generate catalog %s\n", filename);
+    return 0;
+  }
+  fprintf(file, "id,title,genre,rating,director\n");
+  for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+    fprintf(file, "%s\n", rows[i]);
+  }
+  if (fclose(file) != 0)
+    return 0;
+
+  HashTable ht;
+  initHashTable(&ht);
+  int ok = loadMovies(filename, &ht) == 3;
+  for (int i = 0; ok && i < 3; i++) {
+    ok = findMovieIndex(&ht, expected[i]) >= 0;
+  }
+  freeHashTable(&ht);
+  return ok;
+}
+
+/*
+ * Load ratings that are not finite: those rows are skipped, since a NAN
+ * rating in the graph means a node with no catalog entry
+ * Returns 1 if the catalog loaded as expected
+ */
+static int checkLoaderRatings(const char *filename) {
+  static const char *const rows[] = {
+      "1,Not A Number,Drama,nan,Director 1",
+      "2,Infinite,Drama,inf,Director 1",
+      "3,Negative Infinite,Drama,-inf,Director 1",
+      "4,Normal,Drama,8.0,Director 2",
+  };
+
+  FILE *file = fopen(filename, "w");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Cannot generate catalog %s\n", filename);
+    return 0;
+  }
+  fprintf(file, "id,title,genre,rating,director\n");
+  for (size_t i = 0; i < sizeof(rows) / sizeof(rows[0]); i++) {
+    fprintf(file, "%s\n", rows[i]);
+  }
+  if (fclose(file) != 0)
+    return 0;
+
+  HashTable ht;
+  initHashTable(&ht);
+  int ok = loadMovies(filename, &ht) == 1 && findMovieIndex(&ht, 4) >= 0;
+  for (int id = 1; ok && id <= 3; id++) {
+    ok = findMovieIndex(&ht, id) < 0;
+  }
+  freeHashTable(&ht);
+  return ok;
+}
+
+/* Batch callback for checkZeroResults: counts results it was given */
+static void countBatchResults(int queryIndex, const Candidate *results,
+                              int resultCount, void *context) {
+  (void)queryIndex;
+  (void)results;
+  *(int *)context += resultCount;
+}
+
+/*
+ * Ask for zero results, singly with no buffer and in a batch: both
+ * return nothing rather than touch the empty heap
+ * Returns 1 if no results came back
+ */
+static int checkZeroResults(const char *filename) {
+  if (!writeSparseCatalog(filename, 3, 1, 3))
+    return 0;
+
+  HashTable ht;
+  KnowledgeGraph kg;
+  initHashTable(&ht);
+  initKnowledgeGraph(&kg);
+  int ok = loadMovies(filename, &ht) > 0;
+  if (ok) {
+    buildKnowledgeGraph(&kg, &ht);
+    ok = kg.csr != NULL &&
+         recommendMoviesWeighted(&kg, &ht, 2, 5, 5, 5, NULL, 0) == 0;
+  }
+  if (ok) {
+    BatchQuery queries[] = {{2, 5, 5, 5, 0}, {3, 5, 5, 5, 0}};
+    int resultCount = 0;
+    ok = recommendBatch(&kg, &ht, queries, 2, 2, countBatchResults,
+                        &resultCount) &&
+         resultCount == 0;
+  }
+
+  freeKnowledgeGraph(&kg);
+  freeHashTable(&ht);
+  return ok;
+}
+
+/*
+ * Edge cases that the timed runs do not reach; meant to be run under
+ * -fsanitize=address,undefined as well as plain -O2
+ * Prints one check,name,result row each and returns the failure count
+ */
+static int runChecks(const char *filename) {
+  static const int threadCounts[] = {1, 2, 7, 64};
+  static const struct {
+    const char *name;
+    int movieCount, denseBegin, denseEnd;
+  } catalogs[] = {
+      {"single_movie", 1, 0, 0},
+      {"unlinked", 40, 0, 0},
+      {"one_linked_pair", 3, 1, 3},
+      {"sparse_partitions", 5000, 2100, 2200},
+  };
+
+  int failures = 0;
+  printf("check,name,result\n");
+  for (size_t c = 0; c < sizeof(catalogs) / sizeof(catalogs[0]); c++) {
+    if (!writeSparseCatalog(filename, catalogs[c].movieCount,
+                            catalogs[c].denseBegin, catalogs[c].denseEnd))
+      return failures + 1;
+    for (size_t t = 0; t < sizeof(threadCounts) / sizeof(threadCounts[0]);
+         t++) {
+      int ok = checkBuildThreads(filename, threadCounts[t]);
+      printf("check,build_%s_threads_%d,%s\n", catalogs[c].name,
+             threadCounts[t], ok ? "ok" : "FAILED");
+      failures += !ok;
+    }
+  }
+
+  int ok = checkLoaderIdRange(filename);
+  printf("check,loader_id_range,%s\n", ok ? "ok" : "FAILED");
+  failures += !ok;
+
+  ok = checkLoaderRatings(filename);
+  printf("check,loader_ratings,%s\n", ok ? "ok" : "FAILED");
+  failures += !ok;
+
+  ok = checkZeroResults(filename);
+  printf("check,zero_results,%s\n", ok ? "ok" : "FAILED");
+  failures += !ok;
+
+  remove(filename);
+  return failures;
+}
+
+static void printUsage(const char *program) {
+  fprintf(stderr, "Usage: %s\n", program);
+  fprintf(stderr,
+          "       %s --catalog <movies> [--seed <n>] [--queries <n>] "
+          "[--threads <n>] [--implicit] [--file <path>]\n",
+          program);
+  fprintf(stderr, "       %s --generate <movies> <file> [--seed <n>]\n",
+          program);
+  fprintf(stderr, "       %s --check [--file <path>]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc == 1) {
+    benchmarkQueryLatency();
+    return 0;
+  }
+
+  int movieCount = 0, generate = 0, check = 0;
+  const char *filename = "benchmark_catalog.csv";
+  uint64_t seed = DEFAULT_SEED;
+  int queryCount = DEFAULT_QUERIES, threadCount = 0, implicitEdges = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--catalog") == 0 && i + 1 < argc) {
+      movieCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--generate") == 0 && i + 2 < argc) {
+      generate = 1;
+      movieCount = atoi(argv[++i]);
+      filename = argv[++i];
+    } else if (strcmp(argv[i], "--check") == 0) {
+      check = 1;
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 10);
+    } else if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+      queryCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threadCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--implicit") == 0) {
+      implicitEdges = 1;
+    } else if (strcmp(argv[i], "--file") == 0 && i + 1 < argc) {
+      filename = argv[++i];
+    } else {
+      printUsage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (check) {
+    return runChecks(filename) == 0 ? 0 : 1;
+  }
+  if (movieCount < 1 || queryCount < 1) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  if (generate) {
+    return generateCatalog(filename, movieCount, seed) ? 0 : 1;
+  }
+  return benchmarkCatalog(movieCount, seed, queryCount, threadCount,
+                          implicitEdges, filename);
+}
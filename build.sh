@@ -4,6 +4,10 @@ echo "Installing GCC..."
 apt-get update && apt-get install -y gcc
 
 echo "Compiling recommender.c..."
-gcc -o recommender recommender.c -lm
+gcc -O2 -pthread -o recommender recommender.c -lm
+
+echo "Building the recommender_ext Python module..."
+# Optional: without it app.py falls back to the recommender daemon
+python setup.py build_ext --inplace || echo "recommender_ext not built"
 
 echo "Build complete!"
@@ -10,17 +10,39 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Phase timings and counters; -DRECOMMENDER_NO_STATS compiles them out */
+#ifndef RECOMMENDER_NO_STATS
+#define RECOMMENDER_STATS 1
+#endif
+
+/* Batches, builds and live updates use pthreads where they exist */
+#if !defined(_WIN32) && !defined(RECOMMENDER_NO_THREADS)
+#define RECOMMENDER_THREADS 1
+#include <pthread.h>
+#endif
 
 /* =====================================================
  * CONSTANTS
  * ===================================================== */
 
-#define MAX_TITLE_LEN 256
-#define MAX_GENRE_LEN 64
-#define MAX_DIRECTOR_LEN 128
-#define HASH_TABLE_SIZE 211    /* Prime number for better distribution */
-#define MAX_MOVIES 500
+#define HASH_TABLE_SIZE 211    /* Initial bucket count (prime) */
+#define HASH_MAX_LOAD_NUM 3     /* Grow when count > buckets * 3 / 4 */
+#define HASH_MAX_LOAD_DEN 4
+#define ID_MAP_BUCKET_SLOTS 8   /* Keys per 64-byte ID map bucket */
+#define ID_MAP_DENSE_SLACK 64   /* Unused dense entries always allowed */
 #define MAX_RECOMMENDATIONS 20
+#define ARENA_BLOCK_SIZE (64 * 1024)  /* Bytes per arena block */
+#define BATCH_WINDOW_PER_THREAD 256   /* Batch queries in flight per thread */
+#define MULTI_HOP_MAX_HOPS 8          /* Deepest multi-hop traversal */
+#define MULTI_HOP_DEFAULT_DECAY 50    /* Percent kept per extra hop */
+#define RESULT_CACHE_DEFAULT_MB 16    /* Server mode result cache size */
+#define RESULT_CACHE_WARM_WEIGHT 5    /* app.py's default for every weight */
+#define OUTPUT_BUFFER_SIZE (256 * 1024) /* Bytes an OutputWriter holds */
+#define TITLE_SEARCH_MAX_RESULTS 10   /* Titles a SEARCH request returns */
+#define REQUEST_LINE_MAX 1024         /* Bytes per request line, with '\n' */
 
 /* =====================================================
  * EDGE TYPES FOR KNOWLEDGE GRAPH
@@ -32,34 +54,194 @@ typedef enum {
     DIRECTOR_SIMILAR    /* Movies share the same director */
 } EdgeType;
 
+/* Bit for an edge type in a per-neighbor edge mask (3 bits in total) */
+#define EDGE_MASK(type) (1u << (type))
+#define EDGE_MASK_COUNT 8
+
 /* =====================================================
  * MOVIE STRUCTURE
  * ===================================================== */
 
+/*
+ * Non-owning string: points into the mapped catalog file (or into the
+ * hash table's arena for unescaped quoted fields); not NUL-terminated
+ */
+typedef struct {
+    const char* data;
+    int length;
+} StringView;
+
+/*
+ * One movie as passed into and out of the catalog; the hash table
+ * stores it split into hot columns and cold display strings
+ * genreId and directorId index the HashTable's case-folded dictionaries,
+ * so equal IDs mean equal strings ignoring case; the views keep this
+ * movie's own spelling for output
+ */
 typedef struct {
     int id;
-    char title[MAX_TITLE_LEN];
-    char genre[MAX_GENRE_LEN];
+    int genreId;
+    int directorId;
     float rating;
-    char director[MAX_DIRECTOR_LEN];
+    StringView title;
+    StringView genre;
+    StringView director;
 } Movie;
 
 /* =====================================================
- * HASH TABLE STRUCTURES (Separate Chaining)
+ * ARENA ALLOCATOR (Bump allocation, freed all at once)
+ *
+ * Compile with -DRECOMMENDER_ARENA_MALLOC to give every object its own
+ * malloc instead, so tools like valgrind and ASan see each allocation
  * ===================================================== */
 
-/* Node for hash table linked list (collision handling) */
-typedef struct HashNode {
-    Movie movie;
-    struct HashNode* next;
-} HashNode;
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;                /* Bytes handed out from this block */
+    size_t size;                /* Usable bytes in this block */
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* blocks;         /* Newest block first */
+    size_t blockSize;
+    size_t allocationCount;     /* Objects handed out */
+    size_t bytesAllocated;      /* Bytes handed out (after alignment) */
+    size_t bytesReserved;       /* Bytes obtained from malloc */
+    size_t blockCount;          /* malloc calls made */
+} Arena;
+
+/* =====================================================
+ * STRING DICTIONARY (Case-folded interning)
+ * ===================================================== */
 
-/* Hash table structure */
 typedef struct {
-    HashNode* buckets[HASH_TABLE_SIZE];
+    StringView* spellings;      /* ID -> first spelling interned */
+    int* slots;                 /* Open addressing: ID + 1, 0 if empty */
     int count;
+    int capacity;               /* Allocated length of spellings */
+    int slotCount;              /* Power of two, at most half full */
+} StringDictionary;
+
+/* =====================================================
+ * ID MAP STRUCTURES (Open Addressing)
+ * ===================================================== */
+
+/*
+ * One cache line of keys and values; slots fill from the front and a
+ * value of -1 marks the first empty one
+ */
+typedef struct {
+    int32_t keys[ID_MAP_BUCKET_SLOTS];
+    int32_t values[ID_MAP_BUCKET_SLOTS];
+} IdMapBucket;
+
+/*
+ * Movie ID -> row map
+ * While the IDs span at most 2 * count + ID_MAP_DENSE_SLACK values,
+ * rows sit in an array indexed by ID - denseBase. Otherwise IDs are
+ * hashed multiplicatively into cache-line buckets probed linearly, so
+ * a lookup reads one line unless its bucket has overflowed.
+ */
+typedef struct {
+    int32_t* dense;             /* Dense mode: row or -1 per ID; else NULL */
+    int32_t denseBase;          /* ID stored at dense[0] */
+    uint32_t denseCapacity;
+    int32_t minKey;
+    int32_t maxKey;
+    IdMapBucket* buckets;       /* Hashed mode: 64-byte aligned */
+    void* bucketStorage;        /* Allocation buckets points into */
+    uint32_t bucketMask;        /* Bucket count - 1 (a power of two) */
+    int bucketShift;            /* 32 - log2(bucket count) */
+    int count;
+} IdMap;
+
+/* Display strings of one movie, read only when formatting output */
+typedef struct {
+    StringView title;
+    StringView genre;
+    StringView director;
+} MovieStrings;
+
+/* A loaded catalog file that Movie strings point into */
+typedef struct CatalogBuffer {
+    void* data;
+    size_t size;
+    int mapped;                 /* 1 = mmap'd, 0 = read into malloc */
+    struct CatalogBuffer* next;
+} CatalogBuffer;
+
+/* =====================================================
+ * TITLE SEARCH STRUCTURES
+ * ===================================================== */
+
+/*
+ * Case-folded substring index over movie titles
+ * Every distinct bigram and trigram of a title lists the rows holding
+ * it, in ascending order. A query walks the rows of its rarest grams and
+ * checks each folded title, so matches come back in catalog order.
+ */
+typedef struct {
+    int count;                  /* Titles indexed */
+    int32_t* movieIds;          /* Row -> movie ID */
+    char* folded;               /* Every title, lowercased, back to back */
+    uint64_t* titleOffsets;     /* Row -> start in folded; count + 1 */
+    IdMap grams;                /* Gram key -> gram number */
+    int gramCount;
+    uint64_t* postingOffsets;   /* Gram number -> start; gramCount + 1 */
+    int32_t* postings;          /* Rows holding each gram */
+} TitleIndex;
+
+/*
+ * Hash table structure - the ID map grows as movies are inserted
+ * It maps a movie ID to its row; movies are stored column-wise in
+ * insertion order so scans touch only the fields they read
+ */
+typedef struct {
+    IdMap rows;                 /* Movie ID -> row */
+    int count;                  /* Movies, and rows in use */
+    int capacity;               /* Rows allocated in every column */
+    int* ids;                   /* Hot: row -> movie ID */
+    float* ratings;             /* Hot: row -> rating */
+    int* genreIds;              /* Hot: row -> interned genre */
+    int* directorIds;           /* Hot: row -> interned director */
+    MovieStrings* strings;      /* Cold: row -> display strings */
+    Arena arena;                /* Owns catalog records and file list */
+    CatalogBuffer* files;       /* Catalog files backing Movie strings */
+    StringDictionary genres;    /* Movie.genreId -> genre */
+    StringDictionary directors; /* Movie.directorId -> director */
 } HashTable;
 
+/* =====================================================
+ * CANDIDATE STRUCTURE (For Weighted Scoring)
+ * ===================================================== */
+
+typedef struct {
+    int movieId;
+    int score;              /* Weighted score based on edge types */
+    float rating;           /* Movie rating for tie-breaking */
+} Candidate;
+
+/* One query of a batch */
+typedef struct {
+    int baseMovieId;
+    int genreWeight;
+    int ratingWeight;
+    int directorWeight;
+    int maxResults;
+} BatchQuery;
+
+/*
+ * Receives the results of queries[queryIndex], best first
+ * results is scratch reused by the next query; copy what must outlive
+ * the call
+ */
+typedef void (*BatchResultCallback)(
+    int queryIndex,
+    const Candidate* results,
+    int resultCount,
+    void* context
+);
+
 /* =====================================================
  * KNOWLEDGE GRAPH STRUCTURES (Adjacency List)
  * ===================================================== */
@@ -67,6 +249,7 @@ typedef struct {
 /* Edge in the knowledge graph */
 typedef struct GraphEdge {
     int targetMovieId;          /* ID of connected movie */
+    int targetIndex;            /* Dense index of connected movie's node */
     EdgeType edgeType;          /* Type of relationship */
     struct GraphEdge* next;     /* Next edge in adjacency list */
 } GraphEdge;
@@ -74,40 +257,482 @@ typedef struct GraphEdge {
 /* Node in the knowledge graph (represents a movie) */
 typedef struct GraphNode {
     int movieId;
+    int index;                  /* Dense index 0..nodeCount-1 */
     GraphEdge* edges;           /* Head of adjacency list */
     struct GraphNode* next;     /* For hash-based graph storage */
 } GraphNode;
 
+/* Open-addressing movie ID index; nodeIndex -1 marks an empty slot */
+typedef struct {
+    int32_t movieId;
+    int32_t nodeIndex;
+} NodeIdSlot;
+
+/*
+ * Frozen adjacency in compressed sparse row (CSR) form
+ * Neighbors of node i are targets/edgeMasks[offsets[i] .. offsets[i+1]),
+ * stored contiguously: one 5-byte entry per neighbor, with every edge
+ * type to that neighbor merged into one EDGE_MASK bitmask
+ * Read-only once built and independent of the builder, so any number of
+ * threads may query it without locks; arrays may point into a mapped
+ * snapshot file
+ */
+typedef struct {
+    const uint64_t* offsets;    /* nodeCount + 1 entries */
+    const int32_t* targets;     /* Target node index per neighbor */
+    const uint8_t* edgeMasks;   /* EDGE_MASK bits per neighbor */
+    const int32_t* movieIds;    /* Node index -> movie ID */
+    const float* ratings;       /* Node index -> rating, NAN if no movie */
+    const NodeIdSlot* idSlots;  /* Movie ID -> node index */
+    uint32_t idSlotMask;        /* Slot count - 1 (a power of two) */
+    int nodeCount;
+    uint64_t edgeCount;         /* Neighbor entries, not typed edges */
+} CsrGraph;
+
+/*
+ * Implicit edge index: the same three relationships, answered at query
+ * time from sorted arrays instead of stored GraphEdge lists
+ */
+typedef struct {
+    int* byGenre;               /* Catalog rows sorted by genreId */
+    int* byDirector;            /* Catalog rows sorted by directorId */
+    int* byRating;              /* Catalog rows sorted by rating */
+    int movieCount;
+} ImplicitIndex;
+
+/* How movies are assigned to shards */
+typedef enum {
+    SHARD_BY_MOVIE_ID,          /* Hash of the movie ID: even sizes */
+    SHARD_BY_GENRE              /* Genre ID: GENRE_SIMILAR edges stay local */
+} ShardScheme;
+
+/*
+ * One shard of a partitioned graph
+ * Shards split the movies that can be recommended, not the base movies:
+ * shard index keeps a node for every movie but only the edges to movies
+ * it owns. Any shard can then score any base movie against its slice,
+ * and the partial top-K lists merge into the global one. count 0 (or 1)
+ * is the whole graph
+ */
+typedef struct {
+    int count;
+    int index;
+    ShardScheme scheme;
+} ShardSpec;
+
+/* One precomputed neighbor, as a Candidate needs it */
+typedef struct {
+    int32_t movieId;
+    float rating;
+} RankedNeighbor;
+
+/*
+ * Precomputed candidates of hot nodes (rows too long to scan per query)
+ * For each edge mask, a hot node keeps its best listSize neighbors with
+ * that mask by rating, then ID - the order compareCandidates gives
+ * neighbors of equal score. Any weights score a whole mask alike, so the
+ * top K for K <= listSize is among the first K of every list.
+ */
+typedef struct {
+    int listSize;               /* M: neighbors kept per edge mask */
+    int nodeCount;              /* Nodes of the graph they were built for */
+    int hotCount;
+    int32_t* hotIndex;          /* Node -> hot node number, -1 if not hot */
+    uint64_t* listOffsets;      /* Hot node h, mask m -> list start at
+                                   h * EDGE_MASK_COUNT + m; one past the end */
+    RankedNeighbor* entries;    /* Every list, best first */
+    uint8_t* truncated;         /* Hot node -> bit m set if mask m was cut */
+} CandidateLists;
+
 /* Knowledge Graph structure */
 typedef struct {
-    GraphNode* nodes[HASH_TABLE_SIZE];
+    GraphNode** nodes;          /* Hash buckets, grown like HashTable */
+    int bucketCount;
+    GraphNode** nodeByIndex;    /* Dense index -> node */
+    Arena nodeArena;            /* Owns every GraphNode */
+    Arena edgeArena;            /* Owns GraphEdges until the graph freezes */
+    int nodeCapacity;           /* Allocated length of nodeByIndex */
     int nodeCount;
+    CsrGraph* csr;              /* Frozen graph; the builder part is dropped */
+    int implicitEdges;          /* Set before build to skip GraphEdge lists */
+    int buildThreads;           /* Set before build: 0 = one per CPU */
+    ImplicitIndex* implicit;    /* Built instead of edges when implicitEdges */
+    int candidateListSize;      /* Set before build: M for candidate lists,
+                                   0 = none */
+    int approximateCandidates;  /* Answer counts past M from the lists too */
+    CandidateLists* candidates; /* Built with the graph if candidateListSize */
+    ShardSpec shard;            /* Set before build: keep only this shard's
+                                   edges (count 0 = all) */
 } KnowledgeGraph;
 
 /* =====================================================
- * QUEUE STRUCTURES (For BFS Traversal)
+ * SNAPSHOT STRUCTURES (Binary Graph Image)
  * ===================================================== */
 
-typedef struct QueueNode {
-    int movieId;
-    struct QueueNode* next;
-} QueueNode;
+#define SNAPSHOT_MAGIC "MOVSNAP"        /* 8 bytes with the NUL */
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304u /* Reads differently if swapped */
+#define SNAPSHOT_ALIGNMENT 64           /* Every section starts on a line */
+
+/*
+ * On-disk header; all offsets are from the start of the file
+ * The file is used exactly as mapped, so every field has a fixed width
+ * and the writer's byte order must match the reader's.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t headerSize;
+    uint64_t fileSize;
+    uint64_t checksum;          /* Over every byte after the header */
+    int32_t nodeCount;
+    uint32_t idSlotCount;       /* Power of two */
+    uint64_t edgeCount;
+    uint64_t stringBytes;
+    uint64_t offsetsOffset;     /* uint64_t[nodeCount + 1] */
+    uint64_t targetsOffset;     /* int32_t[edgeCount] */
+    uint64_t edgeMasksOffset;   /* uint8_t[edgeCount] */
+    uint64_t movieIdsOffset;    /* int32_t[nodeCount] */
+    uint64_t ratingsOffset;     /* float[nodeCount] */
+    uint64_t stringsOffset;     /* SnapshotMovieStrings[nodeCount] */
+    uint64_t idSlotsOffset;     /* NodeIdSlot[idSlotCount] */
+    uint64_t stringDataOffset;  /* char[stringBytes] */
+    int32_t shardCount;         /* 0 = the whole graph */
+    int32_t shardIndex;         /* Shard whose edges the file holds */
+    uint32_t shardScheme;       /* ShardScheme */
+    uint32_t reserved;
+} SnapshotHeader;
 
+/* Location of one string in the string data section */
 typedef struct {
-    QueueNode* front;
-    QueueNode* rear;
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+} SnapshotString;
+
+typedef struct {
+    SnapshotString title;
+    SnapshotString genre;
+    SnapshotString director;
+} SnapshotMovieStrings;
+
+/* A loaded snapshot: read-only views into one mapping */
+typedef struct {
+    void* mapping;
+    size_t mappingSize;
+    int mapped;                 /* 0 when read into a malloc'd buffer */
+    const SnapshotHeader* header;
+    CsrGraph csr;               /* Its ID index is the file's */
+    const SnapshotMovieStrings* strings;
+    const char* stringData;
+} Snapshot;
+
+/* =====================================================
+ * LIVE GRAPH STRUCTURES (Epoch-Swapped Versions)
+ * ===================================================== */
+
+/*
+ * Adjacency of one node in a live version
+ * Points into the base CSR graph or into block, an allocation owned by
+ * the live graph and shared by every version that has not replaced it.
+ * A block may have room past degree: a later version appends there, and
+ * earlier ones sharing the block never read past their own degree
+ */
+typedef struct {
+    const int32_t* targets;
+    const uint8_t* edgeMasks;
+    uint32_t degree;
+    uint32_t capacity;          /* Entries block has room for */
+    void* block;                /* NULL when the row is in the base graph */
+} LiveRow;
+
+/* Attributes of one live node; strings.block is owned like LiveRow's */
+typedef struct {
+    int genreId;                /* Into LiveGraph.genres; -1 if removed */
+    int directorId;             /* Into LiveGraph.directors */
+    MovieStrings strings;
+    void* block;                /* NULL when strings belong to the base */
+} LiveMovieInfo;
+
+#define LIVE_CHUNK_SHIFT 8
+#define LIVE_CHUNK_NODES (1 << LIVE_CHUNK_SHIFT) /* Entries per chunk */
+
+/* Entry i of a table split into chunks of LIVE_CHUNK_NODES entries */
+#define LIVE_CHUNK_ENTRY(chunks, i)                                        \
+    (&(chunks)[(i) >> LIVE_CHUNK_SHIFT][(i) & (LIVE_CHUNK_NODES - 1)])
+
+/*
+ * One immutable version of the catalog and graph
+ * Rows, attributes and ID slots are chunked, and a version shares every
+ * chunk an update did not write with the version before it. IDs and
+ * ratings are arrays shared by all versions: a node's ID and rating do
+ * not change while any version holds a movie there, so an update to a
+ * rating moves the movie to another node. Removed and moved movies
+ * leave their node with genreId -1 and an empty row; once no version
+ * that held the movie there is pinned, a later insert or move reuses it
+ */
+typedef struct LiveVersion {
+    uint64_t epoch;
+    int nodeCount;
+    int deadNodeCount;          /* Nodes holding no movie, awaiting reuse */
+    LiveRow** rowChunks;
+    LiveMovieInfo** infoChunks;
+    const int32_t* movieIds;    /* Shared storage, first nodeCount used */
+    const float* ratings;       /* NAN for nodes with no catalog entry */
+    NodeIdSlot** slotChunks;    /* Movie ID -> node, as in snapshots */
+    uint32_t idSlotMask;
+    uint32_t idSlotsUsed;       /* Includes IDs whose movie was removed */
+    atomic_int readers;         /* Pins held by liveAcquire */
+    void** retired;             /* Blocks the next version stopped using */
+    int retiredCount;
+    int32_t retiredNode;        /* Node the next version emptied, or -1 */
+    struct LiveVersion* newer;  /* Next version, for reclamation */
+} LiveVersion;
+
+/* Nodes of the current version that share one attribute value */
+typedef struct {
+    int32_t* nodes;
+    int count;
+    int capacity;
+} LiveMembers;
+
+/*
+ * Writer-side index of the current version's movies by one attribute,
+ * so an update finds its neighbors without scanning every node
+ * Lists are keyed by dictionary ID or rating bucket; position[node] is
+ * the node's place in its list
+ */
+typedef struct {
+    LiveMembers* lists;
+    int listCount;
+    int32_t* position;
+    int positionCapacity;
+} LiveAttributeIndex;
+
+/*
+ * A catalog that accepts updates while it is being queried
+ *
+ * Writers copy the current version's chunk directories, copy only the
+ * chunks an update writes and publish the result; readers pin whatever
+ * version is current. Old versions are freed, oldest first, once
+ * unpinned, and the nodes they were the last to hold a movie at become
+ * free for reuse, so node count follows the peak number of movies.
+ */
+typedef struct {
+    LiveVersion* current;
+    LiveVersion* oldest;        /* Head of the retired chain (or current) */
+    StringDictionary genres;    /* Owned by the writer */
+    StringDictionary directors;
+    Arena spellings;            /* Copies of strings first seen in updates */
+    int32_t* movieIds;          /* Storage the current version shares */
+    float* ratings;
+    int storageCapacity;
+    LiveAttributeIndex byGenre; /* Keyed by genre ID */
+    LiveAttributeIndex byDirector;
+    LiveAttributeIndex byRating; /* Keyed by bucket of ratingBuckets */
+    IdMap ratingBuckets;        /* Half-point rating step -> list */
+    int ratingBucketCount;
+    int32_t* freeNodes;         /* Dead nodes no pinned version can see */
+    int freeNodeCount;
+    int freeNodeCapacity;
+#ifdef RECOMMENDER_THREADS
+    pthread_mutex_t publishLock; /* Held only to pin or swap current */
+    pthread_mutex_t writerLock;  /* Serializes writers */
+#endif
+} LiveGraph;
+
+/* =====================================================
+ * INSTRUMENTATION STRUCTURES
+ * ===================================================== */
+
+/* Timed phases, each with total time and call count */
+typedef enum {
+    STATS_LOAD,                 /* loadMovies */
+    STATS_BUILD,                /* buildKnowledgeGraph */
+    STATS_FREEZE,               /* freezeKnowledgeGraph */
+    STATS_SNAPSHOT_LOAD,
+    STATS_SNAPSHOT_WRITE,
+    STATS_QUERY,                /* One query in the command line program */
+    STATS_BATCH,                /* One whole batch */
+    STATS_UPDATE,               /* One live insert, update or remove */
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+#ifdef RECOMMENDER_STATS
+typedef struct {
+    atomic_uint_fast64_t phaseNanos[STATS_PHASE_COUNT];
+    atomic_uint_fast64_t phaseCalls[STATS_PHASE_COUNT];
+    atomic_uint_fast64_t batchQueries;
+    atomic_uint_fast64_t candidatesScanned;  /* Neighbor entries examined */
+    atomic_int_fast64_t arenaBytes;          /* Arena blocks still held */
+} RecommenderStats;
+
+/* The process-wide counters */
+extern RecommenderStats recommenderStats;
+#endif
+
+/* =====================================================
+ * RESULT CACHE STRUCTURES
+ * ===================================================== */
+
+/* One cached ranked list; results holds count candidates */
+typedef struct ResultCacheEntry {
+    BatchQuery key;
+    int count;
+    struct ResultCacheEntry* chainNext;  /* Bucket chain */
+    struct ResultCacheEntry* newer;      /* LRU list, newest at the head */
+    struct ResultCacheEntry* older;
+    Candidate results[];
+} ResultCacheEntry;
+
+/*
+ * LRU cache of ranked result lists, bounded by capacityBytes of entries
+ * and their bucket array
+ * Entries belong to one catalog epoch; a new epoch empties the cache.
+ * Not thread-safe: meant for the single server loop
+ */
+typedef struct {
+    ResultCacheEntry** buckets;
+    int bucketCount;            /* Power of two, 0 until first store */
+    int count;
+    ResultCacheEntry* newest;
+    ResultCacheEntry* oldest;
+    size_t bytes;               /* Entry and bucket memory in use */
+    size_t capacityBytes;       /* 0 disables the cache */
+    uint64_t epoch;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} ResultCache;
+
+/* =====================================================
+ * OUTPUT WRITER STRUCTURES
+ * ===================================================== */
+
+/*
+ * Reply encodings
+ * CSV:    "<id>,<title>,<genre>,<rating>,<director>" rows, "ERROR <message>"
+ * NDJSON: one JSON object per row, {"error": "<message>"} on failure
+ * In both, a reply ends with an empty line. BINARY records are a u32
+ * payload length, a u8 OutputRecordKind and the payload, little-endian:
+ * a movie is i32 id, f32 rating, then title, genre and director each as
+ * u32 length and bytes; an error is the message bytes; END is empty.
+ * A shard's scored candidate is "<id>,<score>,<rating>" in CSV,
+ * {"id":..,"score":..,"rating":..} in NDJSON with the rating's exact
+ * float value, and i32 id, i32 score, f32 rating in BINARY.
+ */
+typedef enum {
+    OUTPUT_CSV,
+    OUTPUT_NDJSON,
+    OUTPUT_BINARY
+} OutputFormat;
+
+typedef enum {
+    OUTPUT_RECORD_END,
+    OUTPUT_RECORD_MOVIE,
+    OUTPUT_RECORD_ERROR,
+    OUTPUT_RECORD_SCORE
+} OutputRecordKind;
+
+/*
+ * Buffered writer over a file descriptor
+ * Formats into one fixed buffer and flushes it with write(), so memory
+ * stays constant however much is written
+ */
+typedef struct {
+    int fd;
+    OutputFormat format;
+    char* buffer;               /* OUTPUT_BUFFER_SIZE bytes */
+    size_t length;              /* Bytes not yet flushed */
+    int failed;                 /* A write failed; later output is dropped */
+} OutputWriter;
+
+/* =====================================================
+ * QUEUE STRUCTURES (For BFS Traversal)
+ * ===================================================== */
+
+/* Ring buffer of IDs; never allocates while size stays below capacity */
+typedef struct {
+    int* items;
+    int capacity;
+    int head;                   /* Index of the front item */
     int size;
 } Queue;
 
+/*
+ * Multi-hop traversal limits
+ * A movie first reached at hop h scores its edge weight scaled by
+ * decayPercent^(h-1); candidateBudget caps the movies discovered
+ * (0 = no cap)
+ */
+typedef struct {
+    int maxHops;                /* 1 = direct neighbors only */
+    int decayPercent;           /* 0-100 */
+    int candidateBudget;
+} MultiHopOptions;
+
+/*
+ * Reusable multi-hop working memory for graphs of up to nodeCount nodes
+ * Left clean after every query, so one traversal costs no allocation
+ */
+typedef struct {
+    Queue frontier;
+    uint64_t* visited;          /* Bitset by node */
+    int32_t* levelScore;        /* Best score this hop, 0 = not reached */
+    int nodeCount;
+} BfsScratch;
+
 /* =====================================================
- * CANDIDATE STRUCTURE (For Weighted Scoring)
+ * FUNCTION PROTOTYPES - ARENA ALLOCATOR
  * ===================================================== */
 
-typedef struct {
-    int movieId;
-    int score;              /* Weighted score based on edge types */
-    float rating;           /* Movie rating for tie-breaking */
-} Candidate;
+/* Initialize an empty arena that grabs blockSize bytes at a time */
+void arenaInit(Arena* arena, size_t blockSize);
+
+/* Allocate size bytes (aligned for any type) - returns NULL on failure */
+void* arenaAlloc(Arena* arena, size_t size);
+
+/* Release every object from the arena at once */
+void arenaFree(Arena* arena);
+
+/* =====================================================
+ * FUNCTION PROTOTYPES - STRING DICTIONARY
+ * ===================================================== */
+
+/* Initialize an empty dictionary */
+void initStringDictionary(StringDictionary* dict);
+
+/*
+ * ID of text, ignoring ASCII case, adding it if new - returns -1 on
+ * allocation failure; text must outlive the dictionary
+ */
+int internString(StringDictionary* dict, StringView text);
+
+/* ID of text, ignoring ASCII case - returns -1 if not interned */
+int findString(const StringDictionary* dict, StringView text);
+
+/* Free dictionary memory (not the interned strings) */
+void freeStringDictionary(StringDictionary* dict);
+
+/* =====================================================
+ * FUNCTION PROTOTYPES - ID MAP
+ * ===================================================== */
+
+/* Initialize an empty map - storage is allocated on first insert */
+void initIdMap(IdMap* map);
+
+/*
+ * Map key to value (>= 0), replacing any existing mapping
+ * Returns 0 on allocation failure, leaving the map unchanged
+ */
+int idMapInsert(IdMap* map, int key, int value);
+
+/* Value of key - returns -1 if not mapped */
+int idMapFind(const IdMap* map, int key);
+
+/* Free map memory */
+void freeIdMap(IdMap* map);
 
 /* =====================================================
  * FUNCTION PROTOTYPES - HASH TABLE
@@ -116,18 +741,56 @@ typedef struct {
 /* Initialize hash table */
 void initHashTable(HashTable* ht);
 
-/* Hash function for movie ID */
-unsigned int hashFunction(int movieId);
+/* Hash function for movie ID over bucketCount buckets */
+unsigned int hashFunction(int movieId, int bucketCount);
 
-/* Insert movie into hash table */
+/*
+ * Insert movie into hash table
+ * Interns its genre and director (setting genreId and directorId); a
+ * movie with an ID already present replaces the stored record
+ */
 void insertMovie(HashTable* ht, Movie movie);
 
-/* Find movie by ID - returns pointer or NULL */
-Movie* findMovie(HashTable* ht, int movieId);
+/* Catalog row of a movie ID - returns -1 if not found */
+int findMovieIndex(const HashTable* ht, int movieId);
+
+/*
+ * Find movie by ID and copy it to out (if not NULL) - returns 0 if not
+ * found; the strings stay valid until the table is freed
+ */
+int findMovie(const HashTable* ht, int movieId, Movie* out);
 
 /* Free hash table memory */
 void freeHashTable(HashTable* ht);
 
+/* =====================================================
+ * FUNCTION PROTOTYPES - TITLE SEARCH
+ * ===================================================== */
+
+/* Initialize an empty index (safe to free) */
+void initTitleIndex(TitleIndex* index);
+
+/*
+ * Index the titles of count movies; row i is movieIds[i] with
+ * strings[i].title. The text is copied, so strings need not outlive it.
+ * Returns 0 on allocation failure, leaving an empty index
+ */
+int buildTitleIndex(TitleIndex* index, const int32_t* movieIds,
+                    const MovieStrings* strings, int count);
+
+/*
+ * IDs of up to maxResults movies whose title contains query (ASCII
+ * case-insensitive), in catalog order - returns how many were found
+ */
+int searchTitles(const TitleIndex* index, StringView query,
+                 int32_t* movieIds, int maxResults);
+
+/* Whether text contains pattern, ignoring ASCII case */
+int containsIgnoringCase(StringView text, StringView pattern);
+
+/* Free index memory */
+void freeTitleIndex(TitleIndex* index);
+
 /* =====================================================
  * FUNCTION PROTOTYPES - KNOWLEDGE GRAPH
  * ===================================================== */
@@ -135,15 +798,51 @@ void freeHashTable(HashTable* ht);
 /* Initialize knowledge graph */
 void initKnowledgeGraph(KnowledgeGraph* kg);
 
-/* Add bidirectional edge between two movies */
+/*
+ * Add bidirectional edge between two movies (before the graph is frozen)
+ * O(1); adding the same edge again has no effect on the frozen graph
+ */
 void addEdge(KnowledgeGraph* kg, int movieId1, int movieId2, EdgeType type);
 
-/* Get graph node for a movie ID */
+/*
+ * Get or create the builder node for a movie ID
+ * Returns NULL once the graph is frozen: queries never create nodes
+ */
 GraphNode* getGraphNode(KnowledgeGraph* kg, int movieId);
 
-/* Build knowledge graph from hash table of movies */
+/*
+ * Build knowledge graph from hash table of movies into an empty graph
+ * Node i is catalog row i; the CSR is the same for any buildThreads.
+ * With kg->implicitEdges set, builds an ImplicitIndex and no edges.
+ * With kg->candidateListSize set, also builds kg->candidates; with
+ * kg->shard set, keeps only the edges to movies that shard owns
+ */
 void buildKnowledgeGraph(KnowledgeGraph* kg, HashTable* ht);
 
+/*
+ * Shard that owns a movie under spec (0 when unsharded)
+ * genreId is the movie's genre dictionary ID, so shards of one catalog
+ * must all be built from the same catalog file
+ */
+int movieShard(const ShardSpec* spec, int movieId, int genreId);
+
+/* Scheme name ("id", "genre") - returns 0 if unknown */
+int parseShardScheme(const char* name, ShardScheme* scheme);
+
+/*
+ * Convert edge lists added with addEdge into the immutable CSR layout
+ * and free the builder (nodes and lists); ratings for tie-breaking are
+ * copied from ht, and no edges can be added afterwards
+ * (buildKnowledgeGraph writes its CSR directly)
+ */
+void freezeKnowledgeGraph(KnowledgeGraph* kg, HashTable* ht);
+
+/*
+ * Node index of a movie ID in a frozen graph - returns -1 if absent
+ * Never allocates or writes, so it is safe from any number of threads
+ */
+int findGraphIndex(const CsrGraph* graph, int movieId);
+
 /* Free knowledge graph memory */
 void freeKnowledgeGraph(KnowledgeGraph* kg);
 
@@ -151,13 +850,19 @@ void freeKnowledgeGraph(KnowledgeGraph* kg);
  * FUNCTION PROTOTYPES - QUEUE
  * ===================================================== */
 
-/* Initialize queue */
+/* Initialize empty queue (allocates nothing) */
 void initQueue(Queue* q);
 
+/* Make room for capacity items - returns 0 on allocation failure */
+int reserveQueue(Queue* q, int capacity);
+
+/* Drop every item, keeping the buffer */
+void clearQueue(Queue* q);
+
 /* Check if queue is empty */
 int isQueueEmpty(Queue* q);
 
-/* Enqueue movie ID */
+/* Enqueue movie ID, growing the buffer if it is full */
 void enqueue(Queue* q, int movieId);
 
 /* Dequeue movie ID - returns -1 if empty */
@@ -170,9 +875,33 @@ void freeQueue(Queue* q);
  * FUNCTION PROTOTYPES - RECOMMENDATION ALGORITHM
  * ===================================================== */
 
+/*
+ * Name of the kernel that scores neighbor rows on this CPU: "avx2",
+ * "neon" or "scalar" (also with -DRECOMMENDER_NO_SIMD)
+ */
+const char* scoringKernelName(void);
+
+/*
+ * Weighted recommendations from a frozen graph
+ * Fills results (room for maxResults) with the best maxResults
+ * candidates, best first; returns count of recommendations found.
+ * Read-only: concurrent calls on one graph need no synchronization
+ */
+int recommendFromGraph(
+    const CsrGraph* graph,
+    int baseMovieId,
+    int genreWeight,
+    int ratingWeight,
+    int directorWeight,
+    Candidate* results,
+    int maxResults
+);
+
 /* 
  * Generate weighted recommendations
- * Returns count of recommendations found
+ * Same contract as recommendFromGraph, for either kind of graph. A
+ * graph assembled with addEdge is frozen by its first query, so only
+ * call this concurrently once the graph is built or frozen
  */
 int recommendMoviesWeighted(
     KnowledgeGraph* kg,
@@ -185,17 +914,306 @@ int recommendMoviesWeighted(
     int maxResults
 );
 
+/*
+ * Answer queries, passing each result list to onResult in input order
+ * The graph is frozen once up front and result buffers are reused, so
+ * the cost is the sum of the base movies' degrees (plus a K log K sort
+ * per query). threadCount workers (0 = one per CPU) share the queries
+ * through work stealing; onResult is only ever called on the calling
+ * thread. Returns 0 if scratch could not be allocated
+ */
+int recommendBatch(
+    KnowledgeGraph* kg,
+    HashTable* ht,
+    const BatchQuery* queries,
+    int queryCount,
+    int threadCount,
+    BatchResultCallback onResult,
+    void* context
+);
+
 /* Compare function for sorting candidates */
 int compareCandidates(const void* a, const void* b);
 
+/*
+ * Precompute candidate lists of listSize neighbors per edge mask for
+ * every node whose row is longer than all its lists could be, on
+ * threadCount workers (0 = one per CPU)
+ * Returns NULL on allocation failure
+ */
+CandidateLists* buildCandidateLists(const CsrGraph* csr, int listSize,
+                                    int threadCount);
+
+/* Free candidate lists (NULL is ignored) */
+void freeCandidateLists(CandidateLists* lists);
+
+/*
+ * Weighted recommendations from the candidate lists of a hot node
+ * Same results as recommendFromGraph in O(listSize) when maxResults is
+ * at most listSize, or when no list the weights score was cut. Other
+ * counts are answered from the lists only with approximate set, and
+ * may then miss movies. Returns -1 when the base movie is not hot or
+ * the answer would not be exact without approximate: the caller then
+ * scores the full row
+ */
+int recommendFromCandidates(
+    const CandidateLists* lists,
+    const CsrGraph* graph,
+    int baseMovieId,
+    int genreWeight,
+    int ratingWeight,
+    int directorWeight,
+    Candidate* results,
+    int maxResults,
+    int approximate
+);
+
+/* Prepare scratch for graphs of up to nodeCount nodes - 0 on failure */
+int initBfsScratch(BfsScratch* scratch, int nodeCount);
+
+/* Free scratch memory */
+void freeBfsScratch(BfsScratch* scratch);
+
+/*
+ * Weighted recommendations up to options->maxHops edges away
+ * With maxHops 1 this matches recommendMoviesWeighted. Each hop is
+ * expanded in full and a movie keeps its best edge from the previous
+ * hop, so results do not depend on edge order. Stops early once no
+ * deeper movie could enter the top maxResults. scratch is grown if the
+ * graph has more nodes than it was prepared for
+ */
+int recommendMultiHop(
+    KnowledgeGraph* kg,
+    HashTable* ht,
+    BfsScratch* scratch,
+    int baseMovieId,
+    int genreWeight,
+    int ratingWeight,
+    int directorWeight,
+    const MultiHopOptions* options,
+    Candidate* results,
+    int maxResults
+);
+
+/* =====================================================
+ * FUNCTION PROTOTYPES - RESULT CACHE
+ * ===================================================== */
+
+/* Initialize an empty cache holding up to capacityBytes of entries */
+void initResultCache(ResultCache* cache, size_t capacityBytes);
+
+/*
+ * Cached results for key in catalog epoch, or NULL (a miss)
+ * A hit becomes the most recently used entry
+ */
+const ResultCacheEntry* resultCacheLookup(
+    ResultCache* cache,
+    uint64_t epoch,
+    const BatchQuery* key
+);
+
+/*
+ * Remember count results for key, evicting least recently used entries
+ * Returns 0 if the entry was not stored (too large, disabled, no memory)
+ */
+int resultCacheStore(
+    ResultCache* cache,
+    uint64_t epoch,
+    const BatchQuery* key,
+    const Candidate* results,
+    int count
+);
+
+/* Free every entry */
+void freeResultCache(ResultCache* cache);
+
 /* =====================================================
  * FUNCTION PROTOTYPES - FILE I/O
  * ===================================================== */
 
-/* Load movies from CSV file */
+/*
+ * Load movies from CSV file
+ * The file stays mapped until freeHashTable; Movie strings view into it
+ */
 int loadMovies(const char* filename, HashTable* ht);
 
+/* View of a NUL-terminated string (which must outlive the view) */
+StringView makeStringView(const char* text);
+
 /* Print movie recommendation */
 void printRecommendation(Movie* movie);
 
+/* =====================================================
+ * FUNCTION PROTOTYPES - OUTPUT WRITER
+ * ===================================================== */
+
+/*
+ * Set up a writer on fd (e.g. 1 for stdout) - returns 0 if the buffer
+ * cannot be allocated
+ */
+int initOutputWriter(OutputWriter* out, int fd, OutputFormat format);
+
+/* Format name ("csv", "ndjson", "binary") - returns 0 if unknown */
+int parseOutputFormat(const char* name, OutputFormat* format);
+
+/* Append one result row */
+void writeMovie(OutputWriter* out, const Movie* movie);
+
+/* Append one scored candidate, for a coordinator to merge */
+void writeScore(OutputWriter* out, const Candidate* candidate);
+
+/* Append an error reply line or record */
+void writeError(OutputWriter* out, const char* message);
+
+/* Append the end of one reply (empty line, or an END record) */
+void writeReplyEnd(OutputWriter* out);
+
+/* Write out everything buffered - returns 0 once a write has failed */
+int flushOutput(OutputWriter* out);
+
+/* Flush, then free the buffer (the descriptor stays open) */
+int freeOutputWriter(OutputWriter* out);
+
+/* =====================================================
+ * FUNCTION PROTOTYPES - SNAPSHOT
+ * ===================================================== */
+
+/*
+ * Write the frozen graph and catalog to filename as a snapshot
+ * Written to a temporary file and renamed, so readers never see a
+ * partial image; returns 1 on success
+ */
+int writeSnapshot(const char* filename, KnowledgeGraph* kg, HashTable* ht);
+
+/*
+ * Map a snapshot for querying - returns 1 on success
+ * No parsing or pointer fixups; verifyChecksum also checksums the
+ * payload and bounds-checks the adjacency (O(file size))
+ */
+int loadSnapshot(const char* filename, Snapshot* snapshot, int verifyChecksum);
+
+/* Node index of a movie ID - returns -1 if absent */
+int snapshotFindIndex(const Snapshot* snapshot, int movieId);
+
+/*
+ * Fill out with a movie whose strings view into the snapshot
+ * Returns 0 if the catalog has no movie with that ID
+ */
+int snapshotGetMovie(const Snapshot* snapshot, int movieId, Movie* out);
+
+/* Same contract as recommendMoviesWeighted, answered from a snapshot */
+int recommendFromSnapshot(
+    const Snapshot* snapshot,
+    int baseMovieId,
+    int genreWeight,
+    int ratingWeight,
+    int directorWeight,
+    Candidate* results,
+    int maxResults
+);
+
+/* Same contract as recommendMultiHop, answered from a snapshot */
+int recommendMultiHopFromSnapshot(
+    const Snapshot* snapshot,
+    BfsScratch* scratch,
+    int baseMovieId,
+    int genreWeight,
+    int ratingWeight,
+    int directorWeight,
+    const MultiHopOptions* options,
+    Candidate* results,
+    int maxResults
+);
+
+/* Same contract as recommendBatch, answered from a snapshot */
+int recommendBatchFromSnapshot(
+    const Snapshot* snapshot,
+    const BatchQuery* queries,
+    int queryCount,
+    int threadCount,
+    BatchResultCallback onResult,
+    void* context
+);
+
+/* Unmap a snapshot */
+void freeSnapshot(Snapshot* snapshot);
+
+/* =====================================================
+ * FUNCTION PROTOTYPES - LIVE UPDATES
+ * ===================================================== */
+
+/*
+ * Start a live graph from a frozen CSR graph and per-node strings
+ * The CSR arrays (and the strings) must outlive the live graph; strings
+ * are indexed by node. Returns 1 on success
+ */
+int initLiveGraph(LiveGraph* live, const CsrGraph* base,
+                  const MovieStrings* strings);
+
+/*
+ * Pin the current version for reading; never waits on a writer's work
+ * Every liveAcquire must be paired with liveRelease
+ */
+const LiveVersion* liveAcquire(LiveGraph* live);
+
+void liveRelease(const LiveVersion* version);
+
+/*
+ * Add a movie, or replace the one with the same ID (update), computing
+ * only its edges and patching the rows of its old and new neighbors.
+ * Strings are copied. Returns 1 on success, 0 if the rating is not
+ * finite, or if (for insert only) the ID exists or (for update only) it
+ * does not
+ */
+int liveInsertMovie(LiveGraph* live, const Movie* movie);
+int liveUpdateMovie(LiveGraph* live, const Movie* movie);
+
+/* Remove a movie - returns 0 if it does not exist */
+int liveRemoveMovie(LiveGraph* live, int movieId);
+
+/* Same contract as snapshotGetMovie, against a pinned version */
+int liveGetMovie(const LiveVersion* version, int movieId, Movie* out);
+
+/* Same contract as recommendMoviesWeighted, against a pinned version */
+int recommendFromLive(
+    const LiveVersion* version,
+    int baseMovieId,
+    int genreWeight,
+    int ratingWeight,
+    int directorWeight,
+    Candidate* results,
+    int maxResults
+);
+
+/* Same contract as recommendMultiHop, against a pinned version */
+int recommendMultiHopFromLive(
+    const LiveVersion* version,
+    BfsScratch* scratch,
+    int baseMovieId,
+    int genreWeight,
+    int ratingWeight,
+    int directorWeight,
+    const MultiHopOptions* options,
+    Candidate* results,
+    int maxResults
+);
+
+/* Free every version; no version may still be pinned */
+void freeLiveGraph(LiveGraph* live);
+
+#ifdef RECOMMENDER_STATS
+/* =====================================================
+ * FUNCTION PROTOTYPES - INSTRUMENTATION
+ * ===================================================== */
+
+/*
+ * Print the counters as "<name>,<value>" rows, then edge counts per
+ * type and a log2 degree histogram of csr or, if csr is NULL, of a live
+ * version (both may be NULL). The graph part walks every row, so it is
+ * computed only when asked for
+ */
+void printRecommenderStats(FILE* out, const CsrGraph* csr,
+                           const LiveVersion* live);
+#endif
+
 #endif /* MOVIE_H */
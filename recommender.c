@@ -7,612 +7,7126 @@
  * - Weighted scoring recommendation algorithm
  *
  * Usage: ./recommender <movie_id> <genre_weight> <rating_weight>
- * <director_weight>
+ * <director_weight> [count]
+ *        ./recommender --serve [movies_file]
+ *        ./recommender --batch <queries_file> [movies_file]
+ *        ./recommender --build-snapshot <movies_file> <snapshot_file>
+ * Add --implicit to compute similarity at query time without stored edges
+ * Add --snapshot <file> to query a prebuilt snapshot instead of a catalog
+ * Add --stats to print phase timings and graph counters to stderr
+ * Add --candidates <m> to answer hot movies from precomputed lists
+ * Add --shards <n> --shard <i> to --build-snapshot to write one shard
  */
 
+/* posix_madvise and the other POSIX calls, even under -std=c11 */
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include "movie.h"
 
+#include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+/* Vector scoring kernels; -DRECOMMENDER_NO_SIMD keeps only the scalar loop */
+#if !defined(RECOMMENDER_NO_SIMD) && defined(__GNUC__) &&                      \
+    (defined(__x86_64__) || defined(__i386__))
+#define RECOMMENDER_SIMD_AVX2 1
+#include <immintrin.h>
+#elif !defined(RECOMMENDER_NO_SIMD) && defined(__GNUC__) &&                    \
+    defined(__aarch64__)
+#define RECOMMENDER_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* =====================================================
+ * INSTRUMENTATION
+ * ===================================================== */
+
+/*
+ * Process-wide counters, updated with relaxed atomics so batch workers
+ * can share them. Per-query work touches them once per query, never per
+ * candidate. With RECOMMENDER_NO_STATS every macro below expands to
+ * nothing and the counters do not exist.
+ */
+#ifdef RECOMMENDER_STATS
+RecommenderStats recommenderStats;
+
+static uint64_t statsNowNanos(void) {
+#ifndef _WIN32
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+  return (uint64_t)clock() * (1000000000ull / CLOCKS_PER_SEC);
+#endif
+}
+
+static void statsRecordPhase(StatsPhase phase, uint64_t startNanos) {
+  atomic_fetch_add_explicit(&recommenderStats.phaseNanos[phase],
+                            statsNowNanos() - startNanos,
+                            memory_order_relaxed);
+  atomic_fetch_add_explicit(&recommenderStats.phaseCalls[phase], 1,
+                            memory_order_relaxed);
+}
+
+#define STATS_TIMER_START(timer) uint64_t timer = statsNowNanos()
+#define STATS_TIMER_STOP(timer, phase) statsRecordPhase(phase, timer)
+#define STATS_ADD(counter, amount)                                             \
+  atomic_fetch_add_explicit(&recommenderStats.counter, (amount),               \
+                            memory_order_relaxed)
+#else
+#define STATS_TIMER_START(timer) ((void)0)
+#define STATS_TIMER_STOP(timer, phase) ((void)0)
+#define STATS_ADD(counter, amount) ((void)(amount))
+#endif
+
+/* =====================================================
+ * ARENA ALLOCATOR
+ * ===================================================== */
+
+/* Every allocation is rounded up so any object type stays aligned */
+#define ARENA_ALIGNMENT (sizeof(max_align_t))
+#define ARENA_ALIGN(n) (((n) + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1))
+
+/*
+ * Initialize arena - blocks are allocated on first use
+ */
+void arenaInit(Arena *arena, size_t blockSize) {
+  arena->blocks = NULL;
+  arena->blockSize = blockSize;
+  arena->allocationCount = 0;
+  arena->bytesAllocated = 0;
+  arena->bytesReserved = 0;
+  arena->blockCount = 0;
+}
+
+/*
+ * Allocate a new block with blockSize usable bytes
+ */
+static ArenaBlock *arenaAddBlock(Arena *arena, size_t blockSize) {
+  ArenaBlock *block =
+      (ArenaBlock *)malloc(ARENA_ALIGN(sizeof(ArenaBlock)) + blockSize);
+  if (block == NULL) {
+    return NULL;
+  }
+
+  block->next = arena->blocks;
+  block->used = 0;
+  block->size = blockSize;
+  arena->blocks = block;
+  arena->bytesReserved += ARENA_ALIGN(sizeof(ArenaBlock)) + blockSize;
+  arena->blockCount++;
+  STATS_ADD(arenaBytes, (int64_t)(ARENA_ALIGN(sizeof(ArenaBlock)) + blockSize));
+  return block;
+}
+
+/*
+ * Allocate from the newest block, starting a new one when it is full
+ * With RECOMMENDER_ARENA_MALLOC every object is its own block
+ */
+void *arenaAlloc(Arena *arena, size_t size) {
+  size = ARENA_ALIGN(size > 0 ? size : 1);
+
+#ifdef RECOMMENDER_ARENA_MALLOC
+  ArenaBlock *block = arenaAddBlock(arena, size);
+#else
+  ArenaBlock *block = arena->blocks;
+  if (block == NULL || block->size - block->used < size) {
+    block = arenaAddBlock(arena, size > arena->blockSize ? size
+                                                         : arena->blockSize);
+  }
+#endif
+
+  if (block == NULL) {
+    return NULL;
+  }
+
+  void *memory = (char *)block + ARENA_ALIGN(sizeof(ArenaBlock)) + block->used;
+  block->used += size;
+  arena->allocationCount++;
+  arena->bytesAllocated += size;
+  return memory;
+}
+
+/*
+ * Free every block - cost is per block, not per object
+ */
+void arenaFree(Arena *arena) {
+  STATS_ADD(arenaBytes, -(int64_t)arena->bytesReserved);
+  ArenaBlock *block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock *next = block->next;
+    free(block);
+    block = next;
+  }
+  arenaInit(arena, arena->blockSize);
+}
+
+/* =====================================================
+ * PARALLEL TASKS
+ * ===================================================== */
+
+/*
+ * Thread count for a request of requested threads (0 = one per CPU)
+ */
+static int resolveThreadCount(int requested) {
+#ifdef RECOMMENDER_THREADS
+  if (requested <= 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+  }
+  return requested;
+#else
+  (void)requested;
+  return 1;
+#endif
+}
+
+/* Runs partition number partition of a job on worker number worker */
+typedef void (*PartitionTask)(void *job, int partition, int worker);
+
+#ifdef RECOMMENDER_THREADS
+
+typedef struct {
+  PartitionTask task;
+  void *job;
+  int partitionCount;
+  int nextPartition;            /* Next partition to hand out */
+  pthread_mutex_t lock;
+} PartitionQueue;
+
+typedef struct {
+  PartitionQueue *queue;
+  int worker;
+} PartitionWorker;
+
+static void drainPartitions(PartitionQueue *queue, int worker) {
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    int partition = queue->nextPartition++;
+    pthread_mutex_unlock(&queue->lock);
+    if (partition >= queue->partitionCount)
+      return;
+    queue->task(queue->job, partition, worker);
+  }
+}
+
+static void *partitionWorkerMain(void *argument) {
+  PartitionWorker *self = (PartitionWorker *)argument;
+  drainPartitions(self->queue, self->worker);
+  return NULL;
+}
+
+#endif /* RECOMMENDER_THREADS */
+
+/*
+ * Run task on every partition, handed out in order to threadCount
+ * workers (the calling thread is worker 0)
+ * Returns the number of workers used, so jobs can size per-worker state
+ * up front with threadCount and rely on worker < threadCount
+ */
+static int runPartitions(PartitionTask task, void *job, int partitionCount,
+                         int threadCount) {
+#ifdef RECOMMENDER_THREADS
+  if (threadCount > partitionCount)
+    threadCount = partitionCount;
+  if (threadCount > 1) {
+    PartitionQueue queue = {task, job, partitionCount, 0,
+                            PTHREAD_MUTEX_INITIALIZER};
+    pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+    PartitionWorker *workers =
+        (PartitionWorker *)malloc(threadCount * sizeof(PartitionWorker));
+    int started = 1;
+    if (threads != NULL && workers != NULL) {
+      for (; started < threadCount; started++) {
+        workers[started].queue = &queue;
+        workers[started].worker = started;
+        if (pthread_create(&threads[started], NULL, partitionWorkerMain,
+                           &workers[started]) != 0)
+          break;
+      }
+    }
+
+    drainPartitions(&queue, 0);
+    for (int i = 1; i < started; i++) {
+      pthread_join(threads[i], NULL);
+    }
+    pthread_mutex_destroy(&queue.lock);
+    free(threads);
+    free(workers);
+    return started;
+  }
+#else
+  (void)threadCount;
+#endif
+
+  for (int partition = 0; partition < partitionCount; partition++) {
+    task(job, partition, 0);
+  }
+  return 1;
+}
+
+/* =====================================================
+ * STRING DICTIONARY IMPLEMENTATION
+ * ===================================================== */
+
+static char foldCase(char c) { return (c >= 'A' && c <= 'Z') ? c + 32 : c; }
+
+/*
+ * FNV-1a over the case-folded bytes
+ */
+static unsigned int hashFoldedString(StringView text) {
+  unsigned int hash = 2166136261u;
+  for (int i = 0; i < text.length; i++) {
+    hash = (hash ^ (unsigned char)foldCase(text.data[i])) * 16777619u;
+  }
+  return hash;
+}
+
+static int equalsIgnoreCase(StringView s1, StringView s2) {
+  if (s1.length != s2.length)
+    return 0;
+  for (int i = 0; i < s1.length; i++) {
+    if (foldCase(s1.data[i]) != foldCase(s2.data[i]))
+      return 0;
+  }
+  return 1;
+}
+
+void initStringDictionary(StringDictionary *dict) {
+  dict->spellings = NULL;
+  dict->slots = NULL;
+  dict->count = 0;
+  dict->capacity = 0;
+  dict->slotCount = 0;
+}
+
+/*
+ * Double the slot array and reinsert every ID
+ */
+static int growDictionarySlots(StringDictionary *dict) {
+  int newCount = dict->slotCount > 0 ? dict->slotCount * 2 : 64;
+  int *newSlots = (int *)calloc(newCount, sizeof(int));
+  if (newSlots == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for dictionary\n");
+    return 0;
+  }
+
+  for (int id = 0; id < dict->count; id++) {
+    unsigned int slot = hashFoldedString(dict->spellings[id]) & (newCount - 1);
+    while (newSlots[slot] != 0) {
+      slot = (slot + 1) & (newCount - 1);
+    }
+    newSlots[slot] = id + 1;
+  }
+
+  free(dict->slots);
+  dict->slots = newSlots;
+  dict->slotCount = newCount;
+  return 1;
+}
+
+int findString(const StringDictionary *dict, StringView text) {
+  if (dict->slotCount == 0) {
+    return -1;
+  }
+
+  unsigned int mask = (unsigned int)dict->slotCount - 1;
+  unsigned int slot = hashFoldedString(text) & mask;
+  while (dict->slots[slot] != 0) {
+    int id = dict->slots[slot] - 1;
+    if (equalsIgnoreCase(dict->spellings[id], text))
+      return id;
+    slot = (slot + 1) & mask;
+  }
+  return -1;
+}
+
+/*
+ * Intern a string with linear probing
+ * A genre or director recurs across many movies, so the common case is
+ * one hash and one compare against the existing spelling
+ */
+int internString(StringDictionary *dict, StringView text) {
+  if ((dict->count + 1) * 2 > dict->slotCount && !growDictionarySlots(dict)) {
+    return -1;
+  }
+
+  unsigned int mask = (unsigned int)dict->slotCount - 1;
+  unsigned int slot = hashFoldedString(text) & mask;
+  while (dict->slots[slot] != 0) {
+    int id = dict->slots[slot] - 1;
+    if (equalsIgnoreCase(dict->spellings[id], text))
+      return id;
+    slot = (slot + 1) & mask;
+  }
+
+  if (dict->count == dict->capacity) {
+    int newCapacity = dict->capacity > 0 ? dict->capacity * 2 : 32;
+    StringView *newSpellings = (StringView *)realloc(
+        dict->spellings, newCapacity * sizeof(StringView));
+    if (newSpellings == NULL) {
+      fprintf(stderr, "Error: Memory allocation failed for dictionary\n");
+      return -1;
+    }
+    dict->spellings = newSpellings;
+    dict->capacity = newCapacity;
+  }
+
+  int id = dict->count++;
+  dict->spellings[id] = text;
+  dict->slots[slot] = id + 1;
+  return id;
+}
+
+void freeStringDictionary(StringDictionary *dict) {
+  free(dict->spellings);
+  free(dict->slots);
+  initStringDictionary(dict);
+}
+
+/* =====================================================
+ * ID MAP (Dense Array or Open Addressing)
+ * ===================================================== */
+
+#define ID_MAP_LINE 64           /* Bucket alignment: one cache line */
+#define ID_MAP_INITIAL_BUCKETS 16
+
+void initIdMap(IdMap *map) {
+  map->dense = NULL;
+  map->denseBase = 0;
+  map->denseCapacity = 0;
+  map->minKey = 0;
+  map->maxKey = 0;
+  map->buckets = NULL;
+  map->bucketStorage = NULL;
+  map->bucketMask = 0;
+  map->bucketShift = 0;
+  map->count = 0;
+}
+
+/* Whether count keys spanning minKey..maxKey may use the dense array */
+static int idMapSpanIsDense(int64_t minKey, int64_t maxKey, int64_t count) {
+  return maxKey - minKey + 1 <= 2 * count + ID_MAP_DENSE_SLACK;
+}
+
+/* Buckets for count keys: a power of two, at most 3/4 full */
+static uint32_t idMapBucketsFor(int64_t count) {
+  uint32_t bucketCount = ID_MAP_INITIAL_BUCKETS;
+  while (count * HASH_MAX_LOAD_DEN >
+         (int64_t)bucketCount * ID_MAP_BUCKET_SLOTS * HASH_MAX_LOAD_NUM)
+    bucketCount *= 2;
+  return bucketCount;
+}
+
+/* First bucket probed for a key: the top bits of a Fibonacci hash */
+static uint32_t idMapHome(const IdMap *map, int key) {
+  return ((uint32_t)key * 2654435769u) >> map->bucketShift;
+}
+
+static int idMapFindHashed(const IdMap *map, int key) {
+  uint32_t bucket = idMapHome(map, key);
+  for (uint32_t probe = 0; probe <= map->bucketMask; probe++) {
+    const IdMapBucket *line = &map->buckets[bucket];
+    for (int slot = 0; slot < ID_MAP_BUCKET_SLOTS; slot++) {
+      if (line->values[slot] < 0)
+        return -1;
+      if (line->keys[slot] == key)
+        return line->values[slot];
+    }
+    bucket = (bucket + 1) & map->bucketMask;
+  }
+  return -1;
+}
+
+/*
+ * Store key in the hashed buckets, which must have a free slot
+ * Returns 1 if the key is new
+ */
+static int idMapStoreHashed(IdMap *map, int key, int value) {
+  uint32_t bucket = idMapHome(map, key);
+  for (;;) {
+    IdMapBucket *line = &map->buckets[bucket];
+    for (int slot = 0; slot < ID_MAP_BUCKET_SLOTS; slot++) {
+      if (line->values[slot] < 0 || line->keys[slot] == key) {
+        int added = line->values[slot] < 0;
+        line->keys[slot] = key;
+        line->values[slot] = value;
+        return added;
+      }
+    }
+    bucket = (bucket + 1) & map->bucketMask;
+  }
+}
+
+/*
+ * Move every mapping into bucketCount hashed buckets
+ * The old dense array or buckets are kept if allocation fails
+ */
+static int idMapRehash(IdMap *map, uint32_t bucketCount) {
+  void *storage = malloc((size_t)bucketCount * sizeof(IdMapBucket) +
+                         ID_MAP_LINE - 1);
+  if (storage == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for ID map\n");
+    return 0;
+  }
+
+  IdMap next = *map;
+  next.buckets = (IdMapBucket *)(((uintptr_t)storage + ID_MAP_LINE - 1) &
+                                 ~(uintptr_t)(ID_MAP_LINE - 1));
+  next.bucketStorage = storage;
+  next.bucketMask = bucketCount - 1;
+  next.bucketShift = 32;
+  for (uint32_t n = bucketCount; n > 1; n >>= 1)
+    next.bucketShift--;
+  /* All bits set: every key and value becomes -1 */
+  memset(next.buckets, 0xFF, (size_t)bucketCount * sizeof(IdMapBucket));
+
+  if (map->dense != NULL) {
+    for (uint32_t i = 0; i < map->denseCapacity; i++) {
+      if (map->dense[i] >= 0)
+        idMapStoreHashed(&next, (int)(map->denseBase + (int64_t)i),
+                         map->dense[i]);
+    }
+  } else if (map->buckets != NULL) {
+    for (uint32_t b = 0; b <= map->bucketMask; b++) {
+      for (int slot = 0; slot < ID_MAP_BUCKET_SLOTS; slot++) {
+        if (map->buckets[b].values[slot] >= 0)
+          idMapStoreHashed(&next, map->buckets[b].keys[slot],
+                           map->buckets[b].values[slot]);
+      }
+    }
+  }
+
+  free(map->dense);
+  free(map->bucketStorage);
+  next.dense = NULL;
+  next.denseCapacity = 0;
+  *map = next;
+  return 1;
+}
+
+/*
+ * Reallocate the dense array to start at base with capacity entries
+ * covering every stored key
+ */
+static int idMapResizeDense(IdMap *map, int64_t base, uint32_t capacity) {
+  int32_t *dense = (int32_t *)malloc((size_t)capacity * sizeof(int32_t));
+  if (dense == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for ID map\n");
+    return 0;
+  }
+
+  for (uint32_t i = 0; i < capacity; i++)
+    dense[i] = -1;
+  for (uint32_t i = 0; i < map->denseCapacity; i++) {
+    if (map->dense[i] >= 0)
+      dense[map->denseBase + (int64_t)i - base] = map->dense[i];
+  }
+
+  free(map->dense);
+  map->dense = dense;
+  map->denseBase = (int32_t)base;
+  map->denseCapacity = capacity;
+  return 1;
+}
+
+/*
+ * Sequential IDs - the usual case for catalogs exported from a database -
+ * stay in the dense array, grown to twice the key count as they arrive.
+ * The first key that would make it too sparse moves the map to hashed
+ * buckets for good; those double at 3/4 load.
+ */
+int idMapInsert(IdMap *map, int key, int value) {
+  if (map->count == 0 && map->dense == NULL && map->buckets == NULL) {
+    if (!idMapResizeDense(map, key, ID_MAP_DENSE_SLACK))
+      return 0;
+    map->minKey = key;
+    map->maxKey = key;
+  }
+
+  int64_t minKey = key < map->minKey ? key : map->minKey;
+  int64_t maxKey = key > map->maxKey ? key : map->maxKey;
+
+  if (map->dense != NULL) {
+    int64_t offset = (int64_t)key - map->denseBase;
+    if (offset < 0 || offset >= map->denseCapacity) {
+      if (idMapSpanIsDense(minKey, maxKey, map->count + 1)) {
+        uint32_t capacity =
+            (uint32_t)(2 * ((int64_t)map->count + 1) + ID_MAP_DENSE_SLACK);
+        /* Keep the headroom on the side the keys are growing towards */
+        int64_t base = minKey;
+        if (offset < 0) {
+          base = maxKey - capacity + 1;
+          if (base < INT32_MIN)
+            base = INT32_MIN;
+        }
+        if (!idMapResizeDense(map, base, capacity))
+          return 0;
+      } else if (!idMapRehash(map, idMapBucketsFor(map->count + 1))) {
+        return 0;
+      }
+    }
+  }
+
+  int added;
+  if (map->dense != NULL) {
+    int32_t *entry = &map->dense[(int64_t)key - map->denseBase];
+    added = *entry < 0;
+    *entry = value;
+  } else {
+    /* Grow before the new key would pass 3/4 of the slots */
+    uint32_t bucketCount = idMapBucketsFor(map->count + 1);
+    if (bucketCount > map->bucketMask + 1 && !idMapRehash(map, bucketCount))
+      return 0;
+    added = idMapStoreHashed(map, key, value);
+  }
+
+  map->count += added;
+  map->minKey = (int32_t)minKey;
+  map->maxKey = (int32_t)maxKey;
+  return 1;
+}
+
+int idMapFind(const IdMap *map, int key) {
+  if (map->dense != NULL) {
+    uint64_t offset = (uint64_t)((int64_t)key - map->denseBase);
+    return offset < map->denseCapacity ? map->dense[offset] : -1;
+  }
+  if (map->buckets == NULL) {
+    return -1;
+  }
+  return idMapFindHashed(map, key);
+}
+
+void freeIdMap(IdMap *map) {
+  free(map->dense);
+  free(map->bucketStorage);
+  initIdMap(map);
+}
+
 /* =====================================================
  * HASH TABLE IMPLEMENTATION
  * ===================================================== */
 
 /*
- * Initialize hash table - set all buckets to NULL
+ * Initialize hash table - buckets are allocated on first insert
  */
 void initHashTable(HashTable *ht) {
-  for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-    ht->buckets[i] = NULL;
-  }
+  initIdMap(&ht->rows);
   ht->count = 0;
+  ht->capacity = 0;
+  ht->ids = NULL;
+  ht->ratings = NULL;
+  ht->genreIds = NULL;
+  ht->directorIds = NULL;
+  ht->strings = NULL;
+  arenaInit(&ht->arena, ARENA_BLOCK_SIZE);
+  ht->files = NULL;
+  initStringDictionary(&ht->genres);
+  initStringDictionary(&ht->directors);
 }
 
 /*
- * Hash function using modulo prime
+ * Hash function using modulo of the (prime-ish) bucket count
  * Provides good distribution for integer keys
  */
-unsigned int hashFunction(int movieId) {
-  return (unsigned int)(movieId % HASH_TABLE_SIZE);
+unsigned int hashFunction(int movieId, int bucketCount) {
+  return (unsigned int)movieId % (unsigned int)bucketCount;
+}
+
+/*
+ * Next bucket count when a table grows: roughly double, kept odd
+ */
+static int nextBucketCount(int bucketCount) {
+  return bucketCount > 0 ? bucketCount * 2 + 1 : HASH_TABLE_SIZE;
+}
+
+/*
+ * Check whether one more entry would exceed the maximum load factor
+ */
+static int needsRehash(int count, int bucketCount) {
+  return (long long)(count + 1) * HASH_MAX_LOAD_DEN >
+         (long long)bucketCount * HASH_MAX_LOAD_NUM;
+}
+
+/*
+ * Grow every catalog column to hold at least one more row
+ * A column that was already grown keeps its larger size if a later one
+ * fails, so a retry is harmless
+ */
+static int growCatalogColumns(HashTable *ht) {
+  int newCapacity = ht->capacity > 0 ? ht->capacity * 2 : 256;
+  int *ids = (int *)realloc(ht->ids, newCapacity * sizeof(int));
+  if (ids != NULL)
+    ht->ids = ids;
+  float *ratings = (float *)realloc(ht->ratings, newCapacity * sizeof(float));
+  if (ratings != NULL)
+    ht->ratings = ratings;
+  int *genreIds = (int *)realloc(ht->genreIds, newCapacity * sizeof(int));
+  if (genreIds != NULL)
+    ht->genreIds = genreIds;
+  int *directorIds =
+      (int *)realloc(ht->directorIds, newCapacity * sizeof(int));
+  if (directorIds != NULL)
+    ht->directorIds = directorIds;
+  MovieStrings *strings = (MovieStrings *)realloc(
+      ht->strings, newCapacity * sizeof(MovieStrings));
+  if (strings != NULL)
+    ht->strings = strings;
+
+  if (ids == NULL || ratings == NULL || genreIds == NULL ||
+      directorIds == NULL || strings == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for catalog columns\n");
+    return 0;
+  }
+  ht->capacity = newCapacity;
+  return 1;
+}
+
+/*
+ * Scatter a movie into its row of every column
+ */
+static void storeMovieRow(HashTable *ht, int row, const Movie *movie) {
+  ht->ids[row] = movie->id;
+  ht->ratings[row] = movie->rating;
+  ht->genreIds[row] = movie->genreId;
+  ht->directorIds[row] = movie->directorId;
+  ht->strings[row].title = movie->title;
+  ht->strings[row].genre = movie->genre;
+  ht->strings[row].director = movie->director;
 }
 
 /*
  * Insert movie into hash table
- * Uses separate chaining for collision handling
+ * The movie is appended as a new row and its ID mapped to that row
  */
 void insertMovie(HashTable *ht, Movie movie) {
-  unsigned int index = hashFunction(movie.id);
+  movie.genreId = internString(&ht->genres, movie.genre);
+  movie.directorId = internString(&ht->directors, movie.director);
+  if (movie.genreId < 0 || movie.directorId < 0) {
+    return;
+  }
 
-  /* Create new hash node */
-  HashNode *newNode = (HashNode *)malloc(sizeof(HashNode));
-  if (newNode == NULL) {
-    fprintf(stderr, "Error: Memory allocation failed for hash node\n");
+  /* Same ID again: keep one record per ID, newest data wins */
+  int existing = findMovieIndex(ht, movie.id);
+  if (existing >= 0) {
+    storeMovieRow(ht, existing, &movie);
     return;
   }
 
-  newNode->movie = movie;
-  newNode->next = ht->buckets[index]; /* Insert at head of chain */
-  ht->buckets[index] = newNode;
+  if (ht->count == ht->capacity && !growCatalogColumns(ht)) {
+    return;
+  }
+  if (!idMapInsert(&ht->rows, movie.id, ht->count)) {
+    return;
+  }
+
+  storeMovieRow(ht, ht->count, &movie);
   ht->count++;
 }
 
 /*
- * Find movie by ID
- * Returns pointer to movie or NULL if not found
- * Average time complexity: O(1)
+ * Find the catalog row of a movie ID
+ * One array read for dense IDs, otherwise usually one cache line
  */
-Movie *findMovie(HashTable *ht, int movieId) {
-  unsigned int index = hashFunction(movieId);
-  HashNode *current = ht->buckets[index];
+int findMovieIndex(const HashTable *ht, int movieId) {
+  return idMapFind(&ht->rows, movieId);
+}
 
-  while (current != NULL) {
-    if (current->movie.id == movieId) {
-      return &(current->movie);
-    }
-    current = current->next;
+/*
+ * Find movie by ID
+ * Gathers the row back into a Movie; pass out = NULL to only test
+ */
+int findMovie(const HashTable *ht, int movieId, Movie *out) {
+  int row = findMovieIndex(ht, movieId);
+  if (row < 0) {
+    return 0;
   }
 
-  return NULL; /* Movie not found */
+  if (out != NULL) {
+    out->id = ht->ids[row];
+    out->genreId = ht->genreIds[row];
+    out->directorId = ht->directorIds[row];
+    out->rating = ht->ratings[row];
+    out->title = ht->strings[row].title;
+    out->genre = ht->strings[row].genre;
+    out->director = ht->strings[row].director;
+  }
+  return 1;
 }
 
 /*
  * Free all memory used by hash table
  */
 void freeHashTable(HashTable *ht) {
-  for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-    HashNode *current = ht->buckets[i];
-    while (current != NULL) {
-      HashNode *temp = current;
-      current = current->next;
-      free(temp);
+  /* Release catalog files before the arena that holds their records */
+  for (CatalogBuffer *file = ht->files; file != NULL; file = file->next) {
+#ifndef _WIN32
+    if (file->mapped) {
+      munmap(file->data, file->size);
+      continue;
     }
-    ht->buckets[i] = NULL;
+#endif
+    free(file->data);
   }
-  ht->count = 0;
+  ht->files = NULL;
+
+  arenaFree(&ht->arena);
+  freeStringDictionary(&ht->genres);
+  freeStringDictionary(&ht->directors);
+  freeIdMap(&ht->rows);
+  free(ht->ids);
+  free(ht->ratings);
+  free(ht->genreIds);
+  free(ht->directorIds);
+  free(ht->strings);
+  initHashTable(ht);
 }
 
 /* =====================================================
- * KNOWLEDGE GRAPH IMPLEMENTATION
+ * TITLE SEARCH INDEX (Bigrams and Trigrams)
  * ===================================================== */
 
-/*
- * Initialize knowledge graph - set all node slots to NULL
- */
-void initKnowledgeGraph(KnowledgeGraph *kg) {
-  for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-    kg->nodes[i] = NULL;
-  }
-  kg->nodeCount = 0;
+#define TITLE_BIGRAM_TAG (1 << 24) /* Keeps bigram keys apart from trigrams */
+
+/* Gram keys over case-folded bytes; text must hold 2 or 3 bytes */
+static int titleBigramKey(const char *text) {
+  return TITLE_BIGRAM_TAG | (unsigned char)foldCase(text[0]) << 8 |
+         (unsigned char)foldCase(text[1]);
+}
+
+static int titleTrigramKey(const char *text) {
+  return (unsigned char)foldCase(text[0]) << 16 |
+         (unsigned char)foldCase(text[1]) << 8 |
+         (unsigned char)foldCase(text[2]);
+}
+
+void initTitleIndex(TitleIndex *index) {
+  index->count = 0;
+  index->movieIds = NULL;
+  index->folded = NULL;
+  index->titleOffsets = NULL;
+  initIdMap(&index->grams);
+  index->gramCount = 0;
+  index->postingOffsets = NULL;
+  index->postings = NULL;
 }
 
 /*
- * Get or create graph node for a movie ID
+ * Per-gram state of one build pass
+ * lastRow stops a gram repeated within a title from listing the row
+ * twice; counts is the row count in the first pass and the fill cursor
+ * in the second.
  */
-GraphNode *getGraphNode(KnowledgeGraph *kg, int movieId) {
-  unsigned int index = hashFunction(movieId);
-  GraphNode *current = kg->nodes[index];
+typedef struct {
+  int32_t *lastRow;
+  uint64_t *counts;
+  int capacity;
+} TitleGramScratch;
 
-  /* Search for existing node */
-  while (current != NULL) {
-    if (current->movieId == movieId) {
-      return current;
+/*
+ * Count (fill = 0) or record (fill = 1) one gram of a row
+ * Gram numbers are handed out in the counting pass; returns 0 when
+ * memory runs out
+ */
+static int visitTitleGram(TitleIndex *index, TitleGramScratch *scratch,
+                          int key, int row, int fill) {
+  int gram = idMapFind(&index->grams, key);
+  if (gram < 0) {
+    if (scratch->capacity == index->gramCount) {
+      int capacity = scratch->capacity > 0 ? scratch->capacity * 2 : 4096;
+      int32_t *lastRow = (int32_t *)realloc(
+          scratch->lastRow, (size_t)capacity * sizeof(int32_t));
+      if (lastRow != NULL)
+        scratch->lastRow = lastRow;
+      uint64_t *counts = (uint64_t *)realloc(
+          scratch->counts, (size_t)capacity * sizeof(uint64_t));
+      if (counts != NULL)
+        scratch->counts = counts;
+      if (lastRow == NULL || counts == NULL)
+        return 0;
+      scratch->capacity = capacity;
     }
-    current = current->next;
+    gram = index->gramCount;
+    if (!idMapInsert(&index->grams, key, gram))
+      return 0;
+    index->gramCount++;
+    scratch->lastRow[gram] = -1;
+    scratch->counts[gram] = 0;
   }
 
-  /* Create new node if not found */
-  GraphNode *newNode = (GraphNode *)malloc(sizeof(GraphNode));
-  if (newNode == NULL) {
-    fprintf(stderr, "Error: Memory allocation failed for graph node\n");
-    return NULL;
+  if (scratch->lastRow[gram] == row)
+    return 1;
+  scratch->lastRow[gram] = row;
+  if (fill)
+    index->postings[scratch->counts[gram]++] = row;
+  else
+    scratch->counts[gram]++;
+  return 1;
+}
+
+/* Visit every bigram and trigram of one folded title */
+static int visitTitleGrams(TitleIndex *index, TitleGramScratch *scratch,
+                           int row, int fill) {
+  const char *title = index->folded + index->titleOffsets[row];
+  uint64_t length = index->titleOffsets[row + 1] - index->titleOffsets[row];
+  for (uint64_t i = 0; i + 1 < length; i++) {
+    if (!visitTitleGram(index, scratch, titleBigramKey(title + i), row, fill))
+      return 0;
+    if (i + 2 < length &&
+        !visitTitleGram(index, scratch, titleTrigramKey(title + i), row,
+                        fill))
+      return 0;
   }
+  return 1;
+}
 
-  newNode->movieId = movieId;
+/*
+ * Build the index in two passes over the folded titles
+ * The first numbers the grams and counts their rows, the second writes
+ * each row into its gram's slice of one postings array, so every list
+ * is ascending without a sort.
+ */
+int buildTitleIndex(TitleIndex *index, const int32_t *movieIds,
+                    const MovieStrings *strings, int count) {
+  initTitleIndex(index);
+  if (count <= 0)
+    return 1;
+
+  uint64_t textBytes = 0;
+  for (int row = 0; row < count; row++)
+    textBytes += (uint64_t)strings[row].title.length;
+
+  index->movieIds = (int32_t *)malloc((size_t)count * sizeof(int32_t));
+  index->folded = (char *)malloc(textBytes > 0 ? (size_t)textBytes : 1);
+  index->titleOffsets =
+      (uint64_t *)malloc(((size_t)count + 1) * sizeof(uint64_t));
+  TitleGramScratch scratch = {NULL, NULL, 0};
+  int ok = index->movieIds != NULL && index->folded != NULL &&
+           index->titleOffsets != NULL;
+
+  if (ok) {
+    uint64_t offset = 0;
+    for (int row = 0; row < count; row++) {
+      index->movieIds[row] = movieIds[row];
+      index->titleOffsets[row] = offset;
+      const StringView title = strings[row].title;
+      for (int i = 0; i < title.length; i++)
+        index->folded[offset++] = foldCase(title.data[i]);
+    }
+    index->titleOffsets[count] = offset;
+    index->count = count;
+
+    for (int row = 0; ok && row < count; row++)
+      ok = visitTitleGrams(index, &scratch, row, 0);
+  }
+
+  if (ok) {
+    index->postingOffsets = (uint64_t *)malloc(
+        ((size_t)index->gramCount + 1) * sizeof(uint64_t));
+    ok = index->postingOffsets != NULL;
+  }
+  if (ok) {
+    /* Counts become each gram's write cursor */
+    uint64_t total = 0;
+    for (int gram = 0; gram < index->gramCount; gram++) {
+      index->postingOffsets[gram] = total;
+      total += scratch.counts[gram];
+      scratch.counts[gram] = index->postingOffsets[gram];
+      scratch.lastRow[gram] = -1;
+    }
+    index->postingOffsets[index->gramCount] = total;
+    index->postings =
+        (int32_t *)malloc((total > 0 ? (size_t)total : 1) * sizeof(int32_t));
+    ok = index->postings != NULL;
+  }
+  for (int row = 0; ok && row < count; row++)
+    ok = visitTitleGrams(index, &scratch, row, 1);
+
+  free(scratch.lastRow);
+  free(scratch.counts);
+  if (!ok) {
+    fprintf(stderr, "Error: Memory allocation failed for title index\n");
+    freeTitleIndex(index);
+    return 0;
+  }
+  return 1;
+}
+
+int containsIgnoringCase(StringView text, StringView pattern) {
+  if (pattern.length == 0)
+    return 1;
+  char first = foldCase(pattern.data[0]);
+  for (int i = 0; i + pattern.length <= text.length; i++) {
+    if (foldCase(text.data[i]) != first)
+      continue;
+    int j = 1;
+    while (j < pattern.length &&
+           foldCase(text.data[i + j]) == foldCase(pattern.data[j]))
+      j++;
+    if (j == pattern.length)
+      return 1;
+  }
+  return 0;
+}
+
+/* Folded title of a row, as a view into the index */
+static StringView titleIndexRow(const TitleIndex *index, int row) {
+  StringView title;
+  title.data = index->folded + index->titleOffsets[row];
+  title.length = (int)(index->titleOffsets[row + 1] - index->titleOffsets[row]);
+  return title;
+}
+
+/* Posting list of a gram key; *length = 0 when no title has it */
+static const int32_t *titlePostings(const TitleIndex *index, int key,
+                                    uint64_t *length) {
+  int gram = idMapFind(&index->grams, key);
+  if (gram < 0) {
+    *length = 0;
+    return NULL;
+  }
+  *length = index->postingOffsets[gram + 1] - index->postingOffsets[gram];
+  return index->postings + index->postingOffsets[gram];
+}
+
+/*
+ * First position at or after from whose row is >= row
+ * Gallops ahead in doubling steps, then binary searches the last step,
+ * so walking a short list against a long one skips most of it
+ */
+static uint64_t gallopPostings(const int32_t *list, uint64_t length,
+                               uint64_t from, int32_t row) {
+  uint64_t step = 1;
+  uint64_t low = from;
+  uint64_t high = from;
+  while (high < length && list[high] < row) {
+    low = high + 1;
+    high += step;
+    step *= 2;
+  }
+  if (high > length)
+    high = length;
+  while (low < high) {
+    uint64_t mid = low + (high - low) / 2;
+    if (list[mid] < row)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  return low;
+}
+
+/*
+ * Single-character queries have no gram; scan the folded text instead,
+ * jumping to the next title after each hit
+ */
+static int searchTitleCharacter(const TitleIndex *index, char c,
+                                int32_t *movieIds, int maxResults) {
+  const char *text = index->folded;
+  uint64_t textBytes = index->titleOffsets[index->count];
+  int found = 0;
+  int row = 0;
+  uint64_t position = 0;
+  while (found < maxResults && position < textBytes) {
+    const char *hit =
+        (const char *)memchr(text + position, c, (size_t)(textBytes - position));
+    if (hit == NULL)
+      break;
+    /* Last row starting at or before the hit */
+    uint64_t at = (uint64_t)(hit - text);
+    int low = row;
+    int high = index->count - 1;
+    while (low < high) {
+      int mid = low + (high - low + 1) / 2;
+      if (index->titleOffsets[mid] <= at)
+        low = mid;
+      else
+        high = mid - 1;
+    }
+    row = low;
+    movieIds[found++] = index->movieIds[row];
+    position = index->titleOffsets[++row];
+  }
+  return found;
+}
+
+int searchTitles(const TitleIndex *index, StringView query, int32_t *movieIds,
+                 int maxResults) {
+  if (query.length <= 0 || maxResults <= 0 || index->count == 0)
+    return 0;
+  if (query.length == 1)
+    return searchTitleCharacter(index, foldCase(query.data[0]), movieIds,
+                                maxResults);
+
+  /* A two-byte query is its own bigram, so its list is the answer */
+  uint64_t length;
+  if (query.length == 2) {
+    const int32_t *list = titlePostings(index, titleBigramKey(query.data),
+                                        &length);
+    int found = length < (uint64_t)maxResults ? (int)length : maxResults;
+    for (int i = 0; i < found; i++)
+      movieIds[i] = index->movieIds[list[i]];
+    return found;
+  }
+
+  /* Every trigram must be present; keep the two rarest lists */
+  const int32_t *rarest = NULL;
+  const int32_t *second = NULL;
+  uint64_t rarestLength = 0;
+  uint64_t secondLength = 0;
+  for (int i = 0; i + 2 < query.length; i++) {
+    const int32_t *list = titlePostings(index, titleTrigramKey(query.data + i),
+                                        &length);
+    if (length == 0)
+      return 0;
+    if (rarest == NULL || length < rarestLength) {
+      second = rarest;
+      secondLength = rarestLength;
+      rarest = list;
+      rarestLength = length;
+    } else if (list != rarest && (second == NULL || length < secondLength)) {
+      second = list;
+      secondLength = length;
+    }
+  }
+
+  /* Rows holding both lists are candidates; the folded title decides */
+  int found = 0;
+  uint64_t cursor = 0;
+  for (uint64_t i = 0; i < rarestLength && found < maxResults; i++) {
+    int32_t row = rarest[i];
+    if (second != NULL) {
+      cursor = gallopPostings(second, secondLength, cursor, row);
+      if (cursor == secondLength)
+        break;
+      if (second[cursor] != row)
+        continue;
+    }
+    if (query.length == 3 || containsIgnoringCase(titleIndexRow(index, row),
+                                                   query))
+      movieIds[found++] = index->movieIds[row];
+  }
+  return found;
+}
+
+void freeTitleIndex(TitleIndex *index) {
+  free(index->movieIds);
+  free(index->folded);
+  free(index->titleOffsets);
+  freeIdMap(&index->grams);
+  free(index->postingOffsets);
+  free(index->postings);
+  initTitleIndex(index);
+}
+
+/* =====================================================
+ * NODE ID INDEX (Open Addressing)
+ * ===================================================== */
+
+/* First slot probed for a movie ID */
+static uint32_t idSlotHome(int movieId, uint32_t mask) {
+  uint32_t hash = (uint32_t)movieId * 2654435761u;
+  return (hash ^ (hash >> 16)) & mask;
+}
+
+/*
+ * Find a movie ID's node index in an ID index of mask + 1 slots
+ * Probing is bounded so a damaged unverified snapshot cannot loop
+ * forever
+ */
+static int lookupIdSlot(const NodeIdSlot *slots, uint32_t mask,
+                        int movieId) {
+  uint32_t slot = idSlotHome(movieId, mask);
+  for (uint32_t probe = 0; probe <= mask; probe++) {
+    if (slots[slot].nodeIndex < 0)
+      return -1;
+    if (slots[slot].movieId == movieId)
+      return slots[slot].nodeIndex;
+    slot = (slot + 1) & mask;
+  }
+  return -1;
+}
+
+/*
+ * Map movieId to nodeIndex, replacing any existing mapping
+ */
+static void storeIdSlot(NodeIdSlot *slots, uint32_t mask, int movieId,
+                        int nodeIndex) {
+  uint32_t slot = idSlotHome(movieId, mask);
+  while (slots[slot].nodeIndex >= 0 && slots[slot].movieId != movieId) {
+    slot = (slot + 1) & mask;
+  }
+  slots[slot].movieId = movieId;
+  slots[slot].nodeIndex = nodeIndex;
+}
+
+/* ID slots for nodeCount nodes: a power of two, at most half full */
+static uint32_t idSlotCount(int nodeCount) {
+  uint32_t slotCount = 16;
+  while (slotCount < 2 * (uint64_t)nodeCount)
+    slotCount *= 2;
+  return slotCount;
+}
+
+/*
+ * Allocate an empty index sized for nodeCount IDs, leaving *mask set
+ * Returns NULL on allocation failure
+ */
+static NodeIdSlot *allocNodeIdIndex(int nodeCount, uint32_t *mask) {
+  uint32_t slotCount = idSlotCount(nodeCount);
+  NodeIdSlot *slots = (NodeIdSlot *)malloc(slotCount * sizeof(NodeIdSlot));
+  if (slots == NULL) {
+    return NULL;
+  }
+
+  for (uint32_t i = 0; i < slotCount; i++) {
+    slots[i].movieId = 0;
+    slots[i].nodeIndex = -1;
+  }
+  *mask = slotCount - 1;
+  return slots;
+}
+
+/*
+ * Index nodeCount movie IDs by node index, leaving *mask set
+ * Returns NULL on allocation failure
+ */
+static NodeIdSlot *buildNodeIdIndex(const int32_t *movieIds, int nodeCount,
+                                    uint32_t *mask) {
+  NodeIdSlot *slots = allocNodeIdIndex(nodeCount, mask);
+  if (slots == NULL) {
+    return NULL;
+  }
+
+  for (int i = 0; i < nodeCount; i++) {
+    storeIdSlot(slots, *mask, movieIds[i], i);
+  }
+  return slots;
+}
+
+int findGraphIndex(const CsrGraph *graph, int movieId) {
+  return lookupIdSlot(graph->idSlots, graph->idSlotMask, movieId);
+}
+
+/* =====================================================
+ * KNOWLEDGE GRAPH IMPLEMENTATION
+ * ===================================================== */
+
+/*
+ * Initialize knowledge graph - node buckets are allocated on first use
+ */
+void initKnowledgeGraph(KnowledgeGraph *kg) {
+  kg->nodes = NULL;
+  kg->bucketCount = 0;
+  kg->nodeByIndex = NULL;
+  arenaInit(&kg->nodeArena, ARENA_BLOCK_SIZE);
+  arenaInit(&kg->edgeArena, ARENA_BLOCK_SIZE);
+  kg->nodeCapacity = 0;
+  kg->nodeCount = 0;
+  kg->csr = NULL;
+  kg->implicitEdges = 0;
+  kg->buildThreads = 0;
+  kg->implicit = NULL;
+  kg->candidateListSize = 0;
+  kg->approximateCandidates = 0;
+  kg->candidates = NULL;
+  kg->shard.count = 0;
+  kg->shard.index = 0;
+  kg->shard.scheme = SHARD_BY_MOVIE_ID;
+}
+
+/*
+ * Movie IDs are spread by a multiplicative hash, then mapped onto the
+ * shard range with a multiply-shift instead of a modulo
+ */
+int movieShard(const ShardSpec *spec, int movieId, int genreId) {
+  if (spec->count <= 1)
+    return 0;
+  if (spec->scheme == SHARD_BY_GENRE)
+    return (int)((unsigned int)genreId % (unsigned int)spec->count);
+  uint32_t hash = (uint32_t)movieId * 2654435761u;
+  return (int)(((uint64_t)hash * (uint64_t)spec->count) >> 32);
+}
+
+int parseShardScheme(const char *name, ShardScheme *scheme) {
+  if (strcmp(name, "id") == 0) {
+    *scheme = SHARD_BY_MOVIE_ID;
+  } else if (strcmp(name, "genre") == 0) {
+    *scheme = SHARD_BY_GENRE;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Move every graph node into a bucket array of the next size
+ */
+static int rehashKnowledgeGraph(KnowledgeGraph *kg) {
+  int newCount = nextBucketCount(kg->bucketCount);
+  GraphNode **newNodes = (GraphNode **)calloc(newCount, sizeof(GraphNode *));
+  if (newNodes == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for graph buckets\n");
+    return 0;
+  }
+
+  for (int i = 0; i < kg->bucketCount; i++) {
+    GraphNode *current = kg->nodes[i];
+    while (current != NULL) {
+      GraphNode *next = current->next;
+      unsigned int index = hashFunction(current->movieId, newCount);
+      current->next = newNodes[index];
+      newNodes[index] = current;
+      current = next;
+    }
+  }
+
+  free(kg->nodes);
+  kg->nodes = newNodes;
+  kg->bucketCount = newCount;
+  return 1;
+}
+
+/*
+ * Find the graph node for a movie ID without creating one
+ * Read-only, so it is safe on a frozen graph shared between threads
+ */
+static GraphNode *findGraphNode(const KnowledgeGraph *kg, int movieId) {
+  if (kg->bucketCount == 0) {
+    return NULL;
+  }
+
+  GraphNode *current = kg->nodes[hashFunction(movieId, kg->bucketCount)];
+  while (current != NULL) {
+    if (current->movieId == movieId) {
+      return current;
+    }
+    current = current->next;
+  }
+  return NULL;
+}
+
+/*
+ * Get or create graph node for a movie ID
+ */
+GraphNode *getGraphNode(KnowledgeGraph *kg, int movieId) {
+  /* The builder is gone once frozen */
+  if (kg->csr != NULL) {
+    return NULL;
+  }
+
+  /* Search for existing node */
+  GraphNode *existing = findGraphNode(kg, movieId);
+  if (existing != NULL) {
+    return existing;
+  }
+
+  /* Keep chains short as the graph grows */
+  if (needsRehash(kg->nodeCount, kg->bucketCount) &&
+      !rehashKnowledgeGraph(kg) && kg->bucketCount == 0) {
+    return NULL;
+  }
+  unsigned int index = hashFunction(movieId, kg->bucketCount);
+
+  /* Grow the dense index table before handing out the next index */
+  if (kg->nodeCount == kg->nodeCapacity) {
+    int newCapacity = kg->nodeCapacity > 0 ? kg->nodeCapacity * 2 : 64;
+    GraphNode **newTable = (GraphNode **)realloc(
+        kg->nodeByIndex, newCapacity * sizeof(GraphNode *));
+    if (newTable == NULL) {
+      fprintf(stderr, "Error: Memory allocation failed for graph index\n");
+      return NULL;
+    }
+    kg->nodeByIndex = newTable;
+    kg->nodeCapacity = newCapacity;
+  }
+
+  /* Create new node if not found */
+  GraphNode *newNode =
+      (GraphNode *)arenaAlloc(&kg->nodeArena, sizeof(GraphNode));
+  if (newNode == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for graph node\n");
+    return NULL;
+  }
+
+  newNode->movieId = movieId;
+  newNode->index = kg->nodeCount;
   newNode->edges = NULL;
   newNode->next = kg->nodes[index];
   kg->nodes[index] = newNode;
+  kg->nodeByIndex[kg->nodeCount] = newNode;
   kg->nodeCount++;
 
   return newNode;
 }
 
 /*
- * Add a single directed edge from source to target
+ * Add a single directed edge from source to target in O(1)
+ */
+static void addDirectedEdge(KnowledgeGraph *kg, int sourceId, int targetId,
+                            EdgeType type) {
+  if (kg->csr != NULL) {
+    fprintf(stderr, "Error: Cannot add edges to a frozen graph\n");
+    return;
+  }
+
+  GraphNode *sourceNode = getGraphNode(kg, sourceId);
+  GraphNode *targetNode = getGraphNode(kg, targetId);
+  if (sourceNode == NULL || targetNode == NULL)
+    return;
+
+  /*
+   * No duplicate scan: a repeated edge only ORs the same bit into the
+   * neighbor's mask when the graph is frozen, so pushing it is O(1)
+   */
+  GraphEdge *newEdge =
+      (GraphEdge *)arenaAlloc(&kg->edgeArena, sizeof(GraphEdge));
+  if (newEdge == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for graph edge\n");
+    return;
+  }
+
+  newEdge->targetMovieId = targetId;
+  newEdge->targetIndex = targetNode->index;
+  newEdge->edgeType = type;
+  newEdge->next = sourceNode->edges;
+  sourceNode->edges = newEdge;
+}
+
+/*
+ * Add bidirectional edge between two movies
+ */
+void addEdge(KnowledgeGraph *kg, int movieId1, int movieId2, EdgeType type) {
+  addDirectedEdge(kg, movieId1, movieId2, type);
+  addDirectedEdge(kg, movieId2, movieId1, type);
+}
+
+/* Attribute orders for sorting catalog rows */
+typedef enum { ORDER_BY_GENRE, ORDER_BY_DIRECTOR, ORDER_BY_RATING } RowOrder;
+
+/*
+ * Map a float to an unsigned key with the same ordering
+ */
+static uint32_t ratingSortKey(float rating) {
+  uint32_t bits;
+  memcpy(&bits, &rating, sizeof(bits));
+  return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+/*
+ * Sort key of a row; genres and directors compare by interned ID, so
+ * equal strings (ignoring case) sit next to each other, which is all
+ * grouping needs
+ */
+static uint32_t rowSortKey(const HashTable *ht, int row, RowOrder order) {
+  switch (order) {
+  case ORDER_BY_GENRE:
+    return (uint32_t)ht->genreIds[row];
+  case ORDER_BY_DIRECTOR:
+    return (uint32_t)ht->directorIds[row];
+  default:
+    return ratingSortKey(ht->ratings[row]);
+  }
+}
+
+static int compareSortEntry(const void *a, const void *b) {
+  uint64_t ka = *(const uint64_t *)a;
+  uint64_t kb = *(const uint64_t *)b;
+  return (ka > kb) - (ka < kb);
+}
+
+/*
+ * Fill rows with every catalog row in the given order
+ * One integer sort of (key << 32 | row) entries: the comparator reads
+ * no movie data, and ties come out in row order
+ */
+static int sortCatalogRows(const HashTable *ht, RowOrder order, int *rows) {
+  uint64_t *entries =
+      (uint64_t *)malloc((ht->count > 0 ? ht->count : 1) * sizeof(uint64_t));
+  if (entries == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for movie list\n");
+    return 0;
+  }
+
+  for (int row = 0; row < ht->count; row++) {
+    entries[row] = ((uint64_t)rowSortKey(ht, row, order) << 32) | (uint32_t)row;
+  }
+  qsort(entries, ht->count, sizeof(uint64_t), compareSortEntry);
+  for (int i = 0; i < ht->count; i++) {
+    rows[i] = (int)(entries[i] & 0xffffffffu);
+  }
+
+  free(entries);
+  return 1;
+}
+
+/*
+ * Find the run [*lo, *hi) of sorted rows whose key equals key
+ */
+static void findKeyRange(const HashTable *ht, const int *sorted, int count,
+                         RowOrder order, uint32_t key, int *lo, int *hi) {
+  int left = 0, right = count;
+  while (left < right) {
+    int mid = left + (right - left) / 2;
+    if (rowSortKey(ht, sorted[mid], order) < key)
+      left = mid + 1;
+    else
+      right = mid;
+  }
+  *lo = left;
+
+  right = count;
+  while (left < right) {
+    int mid = left + (right - left) / 2;
+    if (rowSortKey(ht, sorted[mid], order) <= key)
+      left = mid + 1;
+    else
+      right = mid;
+  }
+  *hi = left;
+}
+
+/*
+ * Find the window [*lo, *hi) of movies whose rating is within 0.5 of
+ * rating, using the same test as the materialized RATING_SIMILAR edges
+ */
+static void findRatingWindow(const HashTable *ht, const int *byRating,
+                             int count, float rating, int *lo, int *hi) {
+  int left = 0, right = count;
+  while (left < right) {
+    int mid = left + (right - left) / 2;
+    float r = ht->ratings[byRating[mid]];
+    if (r < rating && fabs(r - rating) > 0.5)
+      left = mid + 1;
+    else
+      right = mid;
+  }
+  *lo = left;
+
+  right = count;
+  while (left < right) {
+    int mid = left + (right - left) / 2;
+    float r = ht->ratings[byRating[mid]];
+    if (r > rating && fabs(r - rating) > 0.5)
+      right = mid;
+    else
+      left = mid + 1;
+  }
+  *hi = left;
+}
+
+/*
+ * Build the implicit edge index: three sorted orders of the catalog rows
+ * Uses 3 ints per movie no matter how dense the relationships are
+ */
+static ImplicitIndex *buildImplicitIndex(const HashTable *ht) {
+  ImplicitIndex *index = (ImplicitIndex *)malloc(sizeof(ImplicitIndex));
+  size_t arraySize = (ht->count > 0 ? ht->count : 1) * sizeof(int);
+  if (index == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for implicit index\n");
+    return NULL;
+  }
+
+  index->byGenre = (int *)malloc(arraySize);
+  index->byDirector = (int *)malloc(arraySize);
+  index->byRating = (int *)malloc(arraySize);
+  if (index->byGenre == NULL || index->byDirector == NULL ||
+      index->byRating == NULL ||
+      !sortCatalogRows(ht, ORDER_BY_GENRE, index->byGenre) ||
+      !sortCatalogRows(ht, ORDER_BY_DIRECTOR, index->byDirector) ||
+      !sortCatalogRows(ht, ORDER_BY_RATING, index->byRating)) {
+    fprintf(stderr, "Error: Memory allocation failed for implicit index\n");
+    free(index->byGenre);
+    free(index->byDirector);
+    free(index->byRating);
+    free(index);
+    return NULL;
+  }
+  index->movieCount = ht->count;
+
+  return index;
+}
+
+/*
+ * Parallel CSR build
+ *
+ * The catalog rows are split into fixed partitions; node i is row i.
+ * For every row a worker merges its genre run, director run and rating
+ * window (each found by binary search in a sorted order) into one
+ * neighbor list sorted by row, with one edge mask per neighbor, and
+ * appends it to the partition's own buffer. A prefix sum over the
+ * per-row degrees gives the final offsets, and a second parallel pass
+ * copies each partition buffer into place. Neither the partitioning
+ * nor the neighbor order depends on the thread count, so the CSR is
+ * identical for any number of threads.
+ */
+
+#define BUILD_PARTITION_ROWS 1024 /* Catalog rows per build partition */
+
+/* One partition's neighbor lists until they are scattered */
+typedef struct {
+  int32_t *targets;
+  uint8_t *edgeMasks;
+  uint64_t count;
+  uint64_t capacity;
+  uint64_t base;                /* First edge in the final arrays */
+  int failed;
+} BuildPartition;
+
+/* Per-worker scratch for sorting a rating window by row */
+typedef struct {
+  int *rows;
+  int capacity;
+} BuildScratch;
+
+typedef struct {
+  const HashTable *ht;
+  int *orders[3];               /* Rows by genre, director, rating */
+  BuildPartition *partitions;
+  BuildScratch *scratch;        /* One per worker */
+  uint64_t *offsets;            /* Degrees, then CSR offsets */
+  int32_t *targets;
+  uint8_t *edgeMasks;
+  uint8_t *owned;               /* Row -> 1 if the shard owns it; NULL = all */
+} BuildJob;
+
+static void sortOrderTask(void *context, int partition, int worker) {
+  BuildJob *job = (BuildJob *)context;
+  (void)worker;
+  static const RowOrder orders[3] = {ORDER_BY_GENRE, ORDER_BY_DIRECTOR,
+                                     ORDER_BY_RATING};
+  if (!sortCatalogRows(job->ht, orders[partition], job->orders[partition])) {
+    free(job->orders[partition]);
+    job->orders[partition] = NULL;
+  }
+}
+
+static int compareRows(const void *a, const void *b) {
+  int ra = *(const int *)a;
+  int rb = *(const int *)b;
+  return (ra > rb) - (ra < rb);
+}
+
+static int appendNeighbor(BuildPartition *part, int target, uint8_t mask) {
+  if (part->count == part->capacity) {
+    uint64_t newCapacity = part->capacity > 0 ? part->capacity * 2 : 4096;
+    int32_t *targets =
+        (int32_t *)realloc(part->targets, newCapacity * sizeof(int32_t));
+    if (targets != NULL)
+      part->targets = targets;
+    uint8_t *edgeMasks = (uint8_t *)realloc(part->edgeMasks, newCapacity);
+    if (edgeMasks != NULL)
+      part->edgeMasks = edgeMasks;
+    if (targets == NULL || edgeMasks == NULL)
+      return 0;
+    part->capacity = newCapacity;
+  }
+  part->targets[part->count] = target;
+  part->edgeMasks[part->count] = mask;
+  part->count++;
+  return 1;
+}
+
+/*
+ * Generate the neighbor lists of every row in one partition
+ */
+static void buildNeighborsTask(void *context, int partition, int worker) {
+  BuildJob *job = (BuildJob *)context;
+  const HashTable *ht = job->ht;
+  BuildPartition *part = &job->partitions[partition];
+  BuildScratch *scratch = &job->scratch[worker];
+  int count = ht->count;
+  int rowBegin = partition * BUILD_PARTITION_ROWS;
+  int rowEnd = rowBegin + BUILD_PARTITION_ROWS < count
+                   ? rowBegin + BUILD_PARTITION_ROWS
+                   : count;
+
+  for (int row = rowBegin; row < rowEnd; row++) {
+    int genreLo, genreHi, directorLo, directorHi, ratingLo, ratingHi;
+    findKeyRange(ht, job->orders[0], count, ORDER_BY_GENRE,
+                 rowSortKey(ht, row, ORDER_BY_GENRE), &genreLo, &genreHi);
+    findKeyRange(ht, job->orders[1], count, ORDER_BY_DIRECTOR,
+                 rowSortKey(ht, row, ORDER_BY_DIRECTOR), &directorLo,
+                 &directorHi);
+    findRatingWindow(ht, job->orders[2], count, ht->ratings[row], &ratingLo,
+                     &ratingHi);
+
+    /* Equal-key runs are already in row order; the rating window is not */
+    int windowSize = ratingHi - ratingLo;
+    if (windowSize > scratch->capacity) {
+      int *rows = (int *)realloc(scratch->rows, windowSize * sizeof(int));
+      if (rows == NULL) {
+        part->failed = 1;
+        return;
+      }
+      scratch->rows = rows;
+      scratch->capacity = windowSize;
+    }
+    memcpy(scratch->rows, job->orders[2] + ratingLo, windowSize * sizeof(int));
+    qsort(scratch->rows, windowSize, sizeof(int), compareRows);
+
+    /* Three-way merge by row, OR-ing the edge types of equal rows */
+    const int *genre = job->orders[0];
+    const int *director = job->orders[1];
+    const int *rating = scratch->rows;
+    int g = genreLo, d = directorLo, r = 0;
+    uint64_t degree = 0;
+    for (;;) {
+      int next = INT_MAX;
+      if (g < genreHi && genre[g] < next)
+        next = genre[g];
+      if (d < directorHi && director[d] < next)
+        next = director[d];
+      if (r < windowSize && rating[r] < next)
+        next = rating[r];
+      if (next == INT_MAX)
+        break;
+
+      uint8_t mask = 0;
+      if (g < genreHi && genre[g] == next) {
+        mask |= EDGE_MASK(GENRE_SIMILAR);
+        g++;
+      }
+      if (d < directorHi && director[d] == next) {
+        mask |= EDGE_MASK(DIRECTOR_SIMILAR);
+        d++;
+      }
+      if (r < windowSize && rating[r] == next) {
+        mask |= EDGE_MASK(RATING_SIMILAR);
+        r++;
+      }
+
+      /* A movie is never its own neighbor; a shard links only its own */
+      if (next == row || (job->owned != NULL && !job->owned[next]))
+        continue;
+      if (!appendNeighbor(part, next, mask)) {
+        part->failed = 1;
+        return;
+      }
+      degree++;
+    }
+    job->offsets[row + 1] = degree;
+  }
+}
+
+/*
+ * Copy one partition's lists to their final place and free them
+ */
+static void scatterNeighborsTask(void *context, int partition, int worker) {
+  BuildJob *job = (BuildJob *)context;
+  BuildPartition *part = &job->partitions[partition];
+  (void)worker;
+
+  /* An empty partition never allocated its lists */
+  if (part->count == 0)
+    return;
+  memcpy(job->targets + part->base, part->targets,
+         part->count * sizeof(int32_t));
+  memcpy(job->edgeMasks + part->base, part->edgeMasks, part->count);
+  free(part->targets);
+  free(part->edgeMasks);
+  part->targets = NULL;
+  part->edgeMasks = NULL;
+}
+
+/*
+ * Build knowledge graph from attribute buckets
+ * Creates edges based on genre, rating, and director similarity
+ *
+ * Instead of testing all movie pairs, movies are sorted by genre, by
+ * director and by rating. A movie's genre and director neighbors are
+ * the run of equal keys around it; its rating neighbors are the movies
+ * whose rating is within 0.5, a contiguous window of the rating order.
+ * Only pairs that produce an edge are visited, so the build is
+ * O(n log n + edges), and the lists are generated in parallel straight
+ * into CSR form. A shard skips the pairs whose target it does not own,
+ * so it only ever holds its own slice of the edges.
+ */
+static void buildGraph(KnowledgeGraph *kg, HashTable *ht) {
+  if (kg->nodeCount > 0 || kg->csr != NULL || kg->implicit != NULL) {
+    fprintf(stderr, "Error: Knowledge graph is not empty\n");
+    return;
+  }
+
+  /* Implicit mode: keep only the sorted indexes, no per-pair edges */
+  if (kg->implicitEdges) {
+    kg->implicit = buildImplicitIndex(ht);
+    return;
+  }
+
+  /* Node i is row i, so every catalog movie has a node */
+  int count = ht->count;
+
+  int threadCount = resolveThreadCount(kg->buildThreads);
+  int partitionCount = (count + BUILD_PARTITION_ROWS - 1) / BUILD_PARTITION_ROWS;
+  size_t slots = count > 0 ? count : 1;
+  BuildJob job;
+  memset(&job, 0, sizeof(job));
+  job.ht = ht;
+  for (int i = 0; i < 3; i++) {
+    job.orders[i] = (int *)malloc(slots * sizeof(int));
+  }
+  job.partitions = (BuildPartition *)calloc(
+      partitionCount > 0 ? partitionCount : 1, sizeof(BuildPartition));
+  job.scratch = (BuildScratch *)calloc(threadCount, sizeof(BuildScratch));
+  job.offsets = (uint64_t *)calloc(slots + 1, sizeof(uint64_t));
+  int32_t *movieIds = (int32_t *)malloc(slots * sizeof(int32_t));
+  float *ratings = (float *)malloc(slots * sizeof(float));
+  CsrGraph *csr = (CsrGraph *)malloc(sizeof(CsrGraph));
+  uint32_t idSlotMask = 0;
+  NodeIdSlot *idSlots = buildNodeIdIndex(ht->ids, count, &idSlotMask);
+
+  int sharded = kg->shard.count > 1;
+  if (sharded)
+    job.owned = (uint8_t *)malloc(slots);
+
+  int ok = job.orders[0] != NULL && job.orders[1] != NULL &&
+           job.orders[2] != NULL && job.partitions != NULL &&
+           job.scratch != NULL && job.offsets != NULL && movieIds != NULL &&
+           ratings != NULL && csr != NULL && idSlots != NULL &&
+           (!sharded || job.owned != NULL);
+
+  if (ok && sharded) {
+    for (int row = 0; row < count; row++)
+      job.owned[row] = movieShard(&kg->shard, ht->ids[row],
+                                  ht->genreIds[row]) == kg->shard.index;
+  }
+
+  /* The three sorts are independent */
+  if (ok) {
+    runPartitions(sortOrderTask, &job, 3, threadCount);
+    ok = job.orders[0] != NULL && job.orders[1] != NULL &&
+         job.orders[2] != NULL;
+  }
+
+  if (ok) {
+    runPartitions(buildNeighborsTask, &job, partitionCount, threadCount);
+    for (int i = 0; i < partitionCount; i++) {
+      ok = ok && !job.partitions[i].failed;
+    }
+  }
+
+  /* Degrees -> offsets, and each partition's place in the final arrays */
+  uint64_t edgeCount = 0;
+  if (ok) {
+    for (int row = 0; row < count; row++) {
+      job.offsets[row + 1] += job.offsets[row];
+    }
+    for (int i = 0; i < partitionCount; i++) {
+      job.partitions[i].base = edgeCount;
+      edgeCount += job.partitions[i].count;
+    }
+    job.targets =
+        (int32_t *)malloc((edgeCount > 0 ? edgeCount : 1) * sizeof(int32_t));
+    job.edgeMasks = (uint8_t *)malloc(edgeCount > 0 ? edgeCount : 1);
+    ok = job.targets != NULL && job.edgeMasks != NULL;
+  }
+
+  if (ok) {
+    runPartitions(scatterNeighborsTask, &job, partitionCount, threadCount);
+    memcpy(movieIds, ht->ids, count * sizeof(int32_t));
+    memcpy(ratings, ht->ratings, count * sizeof(float));
+
+    csr->offsets = job.offsets;
+    csr->targets = job.targets;
+    csr->edgeMasks = job.edgeMasks;
+    csr->movieIds = movieIds;
+    csr->ratings = ratings;
+    csr->idSlots = idSlots;
+    csr->idSlotMask = idSlotMask;
+    csr->nodeCount = count;
+    csr->edgeCount = edgeCount;
+    kg->csr = csr;
+  } else {
+    fprintf(stderr, "Error: Memory allocation failed for knowledge graph\n");
+    free(job.offsets);
+    free(job.targets);
+    free(job.edgeMasks);
+    free(movieIds);
+    free(ratings);
+    free(idSlots);
+    free(csr);
+  }
+
+  for (int i = 0; i < 3; i++) {
+    free(job.orders[i]);
+  }
+  for (int i = 0; job.partitions != NULL && i < partitionCount; i++) {
+    free(job.partitions[i].targets);
+    free(job.partitions[i].edgeMasks);
+  }
+  for (int i = 0; job.scratch != NULL && i < threadCount; i++) {
+    free(job.scratch[i].rows);
+  }
+  free(job.partitions);
+  free(job.scratch);
+  free(job.owned);
+}
+
+void buildKnowledgeGraph(KnowledgeGraph *kg, HashTable *ht) {
+  STATS_TIMER_START(timer);
+  buildGraph(kg, ht);
+  if (kg->candidateListSize > 0 && kg->csr != NULL)
+    kg->candidates = buildCandidateLists(kg->csr, kg->candidateListSize,
+                                         kg->buildThreads);
+  STATS_TIMER_STOP(timer, STATS_BUILD);
+}
+
+/*
+ * Free the nodes and edge lists used to assemble a graph
+ */
+static void releaseGraphBuilder(KnowledgeGraph *kg) {
+  arenaFree(&kg->nodeArena);
+  arenaFree(&kg->edgeArena);
+  free(kg->nodes);
+  kg->nodes = NULL;
+  kg->bucketCount = 0;
+  free(kg->nodeByIndex);
+  kg->nodeByIndex = NULL;
+  kg->nodeCapacity = 0;
+  kg->nodeCount = 0;
+}
+
+/*
+ * Freeze the graph into CSR form
+ *
+ * 1. Copy each node's movie ID and rating into dense columns, with
+ *    an ID index, so queries never touch the hash table or builder
+ * 2. Count each node's distinct neighbors to get the row offsets
+ * 3. Copy every list into its row, OR-ing all edge types to the same
+ *    neighbor into one mask entry
+ * 4. Release the builder's nodes and edge lists
+ *
+ * lastSource[t] records the last node whose row already holds neighbor
+ * t, and rowPosition[t] where that entry is, so merging is O(edges).
+ */
+static void freezeGraph(KnowledgeGraph *kg, HashTable *ht) {
+  int nodeCount = kg->nodeCount;
+  size_t slots = nodeCount > 0 ? nodeCount : 1;
+  CsrGraph *csr = (CsrGraph *)malloc(sizeof(CsrGraph));
+  uint64_t *offsets = (uint64_t *)malloc((nodeCount + 1) * sizeof(uint64_t));
+  int32_t *movieIds = (int32_t *)malloc(slots * sizeof(int32_t));
+  float *ratings = (float *)malloc(slots * sizeof(float));
+  int *lastSource = (int *)malloc(slots * sizeof(int));
+  uint64_t *rowPosition = (uint64_t *)malloc(slots * sizeof(uint64_t));
+  /* The frozen graph gets its own ID index; the builder is then dropped */
+  uint32_t idSlotMask = 0;
+  NodeIdSlot *idSlots = allocNodeIdIndex(nodeCount, &idSlotMask);
+  if (csr == NULL || offsets == NULL || movieIds == NULL || ratings == NULL ||
+      lastSource == NULL || rowPosition == NULL || idSlots == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for CSR graph\n");
+    free(csr);
+    free(offsets);
+    free(movieIds);
+    free(ratings);
+    free(lastSource);
+    free(rowPosition);
+    free(idSlots);
+    return;
+  }
+
+  /* Nodes added by addEdge for IDs outside the catalog get NAN */
+  for (int i = 0; i < nodeCount; i++) {
+    int row = findMovieIndex(ht, kg->nodeByIndex[i]->movieId);
+    movieIds[i] = kg->nodeByIndex[i]->movieId;
+    ratings[i] = row >= 0 ? ht->ratings[row] : NAN;
+    storeIdSlot(idSlots, idSlotMask, movieIds[i], i);
+  }
+
+  for (int t = 0; t < nodeCount; t++) {
+    lastSource[t] = -1;
+  }
+
+  uint64_t edgeCount = 0;
+  for (int i = 0; i < nodeCount; i++) {
+    offsets[i] = edgeCount;
+    for (GraphEdge *edge = kg->nodeByIndex[i]->edges; edge != NULL;
+         edge = edge->next) {
+      if (lastSource[edge->targetIndex] != i) {
+        lastSource[edge->targetIndex] = i;
+        edgeCount++;
+      }
+    }
+  }
+  offsets[nodeCount] = edgeCount;
+
+  int32_t *targets =
+      (int32_t *)malloc((edgeCount > 0 ? edgeCount : 1) * sizeof(int32_t));
+  uint8_t *edgeMasks = (uint8_t *)malloc(edgeCount > 0 ? edgeCount : 1);
+  if (targets == NULL || edgeMasks == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for CSR graph\n");
+    free(csr);
+    free(offsets);
+    free(movieIds);
+    free(ratings);
+    free(lastSource);
+    free(rowPosition);
+    free(targets);
+    free(edgeMasks);
+    free(idSlots);
+    return;
+  }
+
+  for (int t = 0; t < nodeCount; t++) {
+    lastSource[t] = -1;
+  }
+
+  for (int i = 0; i < nodeCount; i++) {
+    uint64_t position = offsets[i];
+    for (GraphEdge *edge = kg->nodeByIndex[i]->edges; edge != NULL;
+         edge = edge->next) {
+      int target = edge->targetIndex;
+
+      if (lastSource[target] != i) {
+        /* First edge to this neighbor: new entry */
+        lastSource[target] = i;
+        rowPosition[target] = position;
+        targets[position] = target;
+        edgeMasks[position] = 0;
+        position++;
+      }
+      edgeMasks[rowPosition[target]] |= EDGE_MASK(edge->edgeType);
+    }
+  }
+
+  free(lastSource);
+  free(rowPosition);
+
+  csr->offsets = offsets;
+  csr->targets = targets;
+  csr->edgeMasks = edgeMasks;
+  csr->movieIds = movieIds;
+  csr->ratings = ratings;
+  csr->idSlots = idSlots;
+  csr->idSlotMask = idSlotMask;
+  csr->nodeCount = nodeCount;
+  csr->edgeCount = edgeCount;
+  kg->csr = csr;
+
+  /* Every edge list has been copied; drop the builder in one go */
+  releaseGraphBuilder(kg);
+}
+
+void freezeKnowledgeGraph(KnowledgeGraph *kg, HashTable *ht) {
+  if (kg->csr != NULL) {
+    return;
+  }
+
+  STATS_TIMER_START(timer);
+  freezeGraph(kg, ht);
+  STATS_TIMER_STOP(timer, STATS_FREEZE);
+}
+
+/*
+ * Free all memory used by knowledge graph
+ * Nodes and any unfrozen edges live in arenas, so nothing is walked
+ */
+void freeKnowledgeGraph(KnowledgeGraph *kg) {
+  releaseGraphBuilder(kg);
+  freeCandidateLists(kg->candidates);
+  kg->candidates = NULL;
+
+  if (kg->csr != NULL) {
+    free((void *)kg->csr->offsets);
+    free((void *)kg->csr->targets);
+    free((void *)kg->csr->edgeMasks);
+    free((void *)kg->csr->movieIds);
+    free((void *)kg->csr->ratings);
+    free((void *)kg->csr->idSlots);
+    free(kg->csr);
+    kg->csr = NULL;
+  }
+
+  if (kg->implicit != NULL) {
+    free(kg->implicit->byGenre);
+    free(kg->implicit->byDirector);
+    free(kg->implicit->byRating);
+    free(kg->implicit);
+    kg->implicit = NULL;
+  }
+}
+
+/* =====================================================
+ * QUEUE IMPLEMENTATION (For BFS)
+ * ===================================================== */
+
+/*
+ * Initialize empty queue
+ */
+void initQueue(Queue *q) {
+  q->items = NULL;
+  q->capacity = 0;
+  q->head = 0;
+  q->size = 0;
+}
+
+/*
+ * Grow the buffer to at least capacity, unwrapping the items
+ */
+int reserveQueue(Queue *q, int capacity) {
+  if (capacity <= q->capacity) {
+    return 1;
+  }
+
+  int *items = (int *)malloc(capacity * sizeof(int));
+  if (items == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for queue\n");
+    return 0;
+  }
+  for (int i = 0; i < q->size; i++) {
+    items[i] = q->items[(q->head + i) % q->capacity];
+  }
+
+  free(q->items);
+  q->items = items;
+  q->capacity = capacity;
+  q->head = 0;
+  return 1;
+}
+
+void clearQueue(Queue *q) {
+  q->head = 0;
+  q->size = 0;
+}
+
+/*
+ * Check if queue is empty
+ */
+int isQueueEmpty(Queue *q) { return q->size == 0; }
+
+/*
+ * Add movie ID to rear of queue
+ */
+void enqueue(Queue *q, int movieId) {
+  if (q->size == q->capacity &&
+      !reserveQueue(q, q->capacity > 0 ? q->capacity * 2 : 64)) {
+    return;
+  }
+
+  q->items[(q->head + q->size) % q->capacity] = movieId;
+  q->size++;
+}
+
+/*
+ * Remove and return movie ID from front of queue
+ * Returns -1 if queue is empty
+ */
+int dequeue(Queue *q) {
+  if (isQueueEmpty(q)) {
+    return -1;
+  }
+
+  int movieId = q->items[q->head];
+  q->head = (q->head + 1) % q->capacity;
+  q->size--;
+
+  return movieId;
+}
+
+/*
+ * Free all memory used by queue
+ */
+void freeQueue(Queue *q) {
+  free(q->items);
+  initQueue(q);
+}
+
+/* =====================================================
+ * WEIGHTED RECOMMENDATION ALGORITHM
+ * ===================================================== */
+
+/*
+ * Comparison function for sorting candidates
+ * Sort by: 1. Total score (descending), 2. Rating (descending),
+ * 3. Movie ID (descending) so ties do not depend on edge list order
+ */
+int compareCandidates(const void *a, const void *b) {
+  const Candidate *ca = (const Candidate *)a;
+  const Candidate *cb = (const Candidate *)b;
+
+  /* First compare by score (descending) */
+  if (cb->score != ca->score) {
+    return cb->score - ca->score;
+  }
+
+  /* Tie-breaker: compare by rating (descending) */
+  if (cb->rating > ca->rating)
+    return 1;
+  if (cb->rating < ca->rating)
+    return -1;
+
+  /* Final tie-breaker: compare by movie ID (descending) */
+  return (cb->movieId > ca->movieId) - (cb->movieId < ca->movieId);
+}
+
+/*
+ * Score of every possible edge mask for one set of weights
+ */
+static void buildWeightTable(int genreWeight, int ratingWeight,
+                             int directorWeight,
+                             int weightTable[EDGE_MASK_COUNT]) {
+  for (unsigned int mask = 0; mask < EDGE_MASK_COUNT; mask++) {
+    weightTable[mask] =
+        ((mask & EDGE_MASK(GENRE_SIMILAR)) ? genreWeight : 0) +
+        ((mask & EDGE_MASK(RATING_SIMILAR)) ? ratingWeight : 0) +
+        ((mask & EDGE_MASK(DIRECTOR_SIMILAR)) ? directorWeight : 0);
+  }
+}
+
+/*
+ * Bounded top-K selection
+ *
+ * The K best candidates seen so far are kept in a binary heap whose root
+ * is the worst of them under compareCandidates. A new candidate only
+ * enters by replacing the root, so selecting from n candidates costs
+ * O(n log K) and never needs a buffer larger than K.
+ */
+typedef struct {
+  Candidate *heap;
+  int size;
+  int capacity;
+} TopK;
+
+static void topKInit(TopK *top, Candidate *buffer, int capacity) {
+  top->heap = buffer;
+  top->size = 0;
+  top->capacity = capacity > 0 ? capacity : 0;
+}
+
+/*
+ * Cheap pre-check: could a candidate with this score still enter?
+ * Lets callers skip the rating lookup for hopeless candidates
+ */
+static int topKAccepts(const TopK *top, int score) {
+  return top->capacity > 0 &&
+         (top->size < top->capacity || score >= top->heap[0].score);
+}
+
+static void topKSiftDown(TopK *top, int i) {
+  Candidate *heap = top->heap;
+  for (;;) {
+    int worst = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < top->size && compareCandidates(&heap[left], &heap[worst]) > 0)
+      worst = left;
+    if (right < top->size &&
+        compareCandidates(&heap[right], &heap[worst]) > 0)
+      worst = right;
+    if (worst == i)
+      return;
+    Candidate temp = heap[i];
+    heap[i] = heap[worst];
+    heap[worst] = temp;
+    i = worst;
+  }
+}
+
+static void topKPush(TopK *top, const Candidate *candidate) {
+  Candidate *heap = top->heap;
+
+  if (top->size < top->capacity) {
+    /* Not full yet: append and sift up */
+    int i = top->size++;
+    heap[i] = *candidate;
+    while (i > 0) {
+      int parent = (i - 1) / 2;
+      if (compareCandidates(&heap[i], &heap[parent]) <= 0)
+        break;
+      Candidate temp = heap[i];
+      heap[i] = heap[parent];
+      heap[parent] = temp;
+      i = parent;
+    }
+  } else if (top->capacity > 0 && compareCandidates(candidate, &heap[0]) < 0) {
+    /* Better than the current worst: replace the root */
+    heap[0] = *candidate;
+    topKSiftDown(top, 0);
+  }
+}
+
+/*
+ * Order the kept candidates best first and return how many there are
+ */
+static int topKFinish(TopK *top) {
+  /* Sort by score (desc), then rating (desc), then ID (desc) */
+  qsort(top->heap, top->size, sizeof(Candidate), compareCandidates);
+  return top->size;
+}
+
+/* One implicit edge from the base movie, before merging per candidate */
+typedef struct {
+  int row;
+  EdgeType edgeType;
+} ImplicitMatch;
+
+static int compareImplicitMatch(const void *a, const void *b) {
+  const ImplicitMatch *ma = (const ImplicitMatch *)a;
+  const ImplicitMatch *mb = (const ImplicitMatch *)b;
+  if (ma->row != mb->row)
+    return (ma->row > mb->row) - (ma->row < mb->row);
+  return (int)ma->edgeType - (int)mb->edgeType;
+}
+
+/*
+ * Weighted recommendations from the implicit edge index
+ *
+ * Genre and director neighbors are the run of equal keys around the base
+ * movie; rating neighbors are a binary-searched window of the rating
+ * order. Matches are merged per catalog row, so each relationship counts
+ * once exactly as a materialized edge would.
+ */
+static int recommendImplicit(const ImplicitIndex *index, const HashTable *ht,
+                             int baseMovieId, int genreWeight,
+                             int ratingWeight, int directorWeight,
+                             Candidate *results, int maxResults) {
+  int baseRow = findMovieIndex(ht, baseMovieId);
+  if (index == NULL || baseRow < 0 || maxResults <= 0) {
+    return 0;
+  }
+
+  int genreLo = 0, genreHi = 0, directorLo = 0, directorHi = 0;
+  int ratingLo = 0, ratingHi = 0;
+
+  /* Zero weights cannot change a score, so their neighbors are skipped */
+  if (genreWeight > 0)
+    findKeyRange(ht, index->byGenre, index->movieCount, ORDER_BY_GENRE,
+                 rowSortKey(ht, baseRow, ORDER_BY_GENRE), &genreLo, &genreHi);
+  if (directorWeight > 0)
+    findKeyRange(ht, index->byDirector, index->movieCount, ORDER_BY_DIRECTOR,
+                 rowSortKey(ht, baseRow, ORDER_BY_DIRECTOR), &directorLo,
+                 &directorHi);
+  if (ratingWeight > 0)
+    findRatingWindow(ht, index->byRating, index->movieCount,
+                     ht->ratings[baseRow], &ratingLo, &ratingHi);
+
+  int matchCount =
+      (genreHi - genreLo) + (directorHi - directorLo) + (ratingHi - ratingLo);
+  if (matchCount == 0) {
+    return 0;
+  }
+
+  ImplicitMatch *matches =
+      (ImplicitMatch *)malloc(matchCount * sizeof(ImplicitMatch));
+  if (matches == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for candidates\n");
+    return 0;
+  }
+
+  int m = 0;
+  for (int i = genreLo; i < genreHi; i++)
+    matches[m++] = (ImplicitMatch){index->byGenre[i], GENRE_SIMILAR};
+  for (int i = directorLo; i < directorHi; i++)
+    matches[m++] = (ImplicitMatch){index->byDirector[i], DIRECTOR_SIMILAR};
+  for (int i = ratingLo; i < ratingHi; i++)
+    matches[m++] = (ImplicitMatch){index->byRating[i], RATING_SIMILAR};
+
+  qsort(matches, matchCount, sizeof(ImplicitMatch), compareImplicitMatch);
+
+  int weightTable[EDGE_MASK_COUNT];
+  buildWeightTable(genreWeight, ratingWeight, directorWeight, weightTable);
+
+  TopK top;
+  topKInit(&top, results, maxResults);
+
+  /* Merge matches per row into the same edge mask as the graph */
+  int i = 0;
+  while (i < matchCount) {
+    int row = matches[i].row;
+    unsigned int mask = 0;
+
+    for (; i < matchCount && matches[i].row == row; i++) {
+      mask |= EDGE_MASK(matches[i].edgeType);
+    }
+    int score = weightTable[mask];
+
+    /* Skip the base movie itself */
+    if (row == baseRow || score <= 0 || !topKAccepts(&top, score))
+      continue;
+
+    Candidate candidate = {ht->ids[row], score, ht->ratings[row]};
+    topKPush(&top, &candidate);
+  }
+
+  free(matches);
+  STATS_ADD(candidatesScanned, (uint64_t)matchCount);
+  return topKFinish(&top);
+}
+
+/* =====================================================
+ * SCORING KERNELS
+ * ===================================================== */
+
+#define SCORE_BLOCK 32       /* Edge masks filtered per vector step */
+#define SCORE_ACCEPT_SIZE 16 /* Accept table padded to one shuffle lane */
+
+/*
+ * Sets bit i of the result when accept[edgeMasks[i]] is nonzero, for the
+ * SCORE_BLOCK masks starting at edgeMasks. Masks are below
+ * EDGE_MASK_COUNT, so the table fits one byte shuffle.
+ */
+typedef uint32_t (*MaskFilter)(const uint8_t *edgeMasks, const uint8_t *accept);
+
+#ifdef RECOMMENDER_SIMD_AVX2
+__attribute__((target("avx2"))) static uint32_t
+filterMasksAvx2(const uint8_t *edgeMasks, const uint8_t *accept) {
+  __m256i table = _mm256_broadcastsi128_si256(
+      _mm_loadu_si128((const __m128i *)accept));
+  __m256i masks = _mm256_loadu_si256((const __m256i *)edgeMasks);
+  return (uint32_t)_mm256_movemask_epi8(_mm256_shuffle_epi8(table, masks));
+}
+#endif
+
+#ifdef RECOMMENDER_SIMD_NEON
+static uint32_t filterMasksNeon(const uint8_t *edgeMasks,
+                                const uint8_t *accept) {
+  static const uint8_t laneBits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                       1, 2, 4, 8, 16, 32, 64, 128};
+  uint8x16_t table = vld1q_u8(accept);
+  uint8x16_t bits = vld1q_u8(laneBits);
+  uint8x16_t low = vandq_u8(vqtbl1q_u8(table, vld1q_u8(edgeMasks)), bits);
+  uint8x16_t high =
+      vandq_u8(vqtbl1q_u8(table, vld1q_u8(edgeMasks + 16)), bits);
+
+  /* No movemask on NEON: bit-weight each lane and add per half */
+  return (uint32_t)vaddv_u8(vget_low_u8(low)) |
+         (uint32_t)vaddv_u8(vget_high_u8(low)) << 8 |
+         (uint32_t)vaddv_u8(vget_low_u8(high)) << 16 |
+         (uint32_t)vaddv_u8(vget_high_u8(high)) << 24;
+}
+#endif
+
+/*
+ * Pick the widest kernel this CPU runs, or NULL for the scalar loop
+ * AVX2 is checked at run time, so one binary runs on any x86-64 CPU;
+ * NEON is part of every AArch64 CPU.
+ */
+static MaskFilter selectMaskFilter(void) {
+#if defined(RECOMMENDER_SIMD_AVX2)
+  if (__builtin_cpu_supports("avx2"))
+    return filterMasksAvx2;
+#elif defined(RECOMMENDER_SIMD_NEON)
+  return filterMasksNeon;
+#endif
+  return NULL;
+}
+
+const char *scoringKernelName(void) {
+  MaskFilter filter = selectMaskFilter();
+#if defined(RECOMMENDER_SIMD_AVX2)
+  if (filter == filterMasksAvx2)
+    return "avx2";
+#elif defined(RECOMMENDER_SIMD_NEON)
+  if (filter == filterMasksNeon)
+    return "neon";
+#endif
+  return filter == NULL ? "scalar" : "unknown";
+}
+
+/*
+ * Mark the edge masks whose score could still enter the top K
+ * Rebuilt whenever the K-th score rises, so once the heap is full most
+ * neighbors are rejected 32 at a time without touching their targets.
+ */
+static void buildAcceptTable(const int weightTable[EDGE_MASK_COUNT],
+                             const TopK *top,
+                             uint8_t accept[SCORE_ACCEPT_SIZE]) {
+  for (int mask = 0; mask < SCORE_ACCEPT_SIZE; mask++) {
+    int score = mask < EDGE_MASK_COUNT ? weightTable[mask] : 0;
+    accept[mask] = score > 0 && topKAccepts(top, score) ? 0xFF : 0;
+  }
+}
+
+/*
+ * Offer one neighbor with a positive score to the top K
+ * Returns 1 when it was pushed, so the K-th score may have changed
+ */
+static int considerNeighbor(TopK *top, int score, int slot, int baseIndex,
+                            const int32_t *movieIds, const float *ratings) {
+  /* Skip the base movie itself */
+  if (slot == baseIndex || !topKAccepts(top, score)) {
+    return 0;
+  }
+
+  /* NAN marks a node with no catalog entry */
+  float rating = ratings[slot];
+  if (isnan(rating)) {
+    return 0;
+  }
+
+  Candidate candidate = {movieIds[slot], score, rating};
+  topKPush(top, &candidate);
+  return 1;
+}
+
+/*
+ * Score one adjacency row: count neighbors of node baseIndex
+ *
+ * One entry per neighbor, so the score is a single table lookup.
+ * Candidates go straight into a top-K heap in the caller's results
+ * buffer; ones that cannot beat the current K-th score are dropped
+ * before their target or rating is even read. With a vector kernel that
+ * check runs on SCORE_BLOCK masks at once and only surviving lanes are
+ * visited; the scalar loop handles the tail and CPUs without one.
+ */
+static int scoreNeighbors(const int32_t *targets, const uint8_t *edgeMasks,
+                          uint64_t count, int baseIndex,
+                          const int32_t *movieIds, const float *ratings,
+                          int genreWeight, int ratingWeight,
+                          int directorWeight, Candidate *results,
+                          int maxResults) {
+  if (maxResults <= 0) {
+    return 0;
+  }
+
+  int weightTable[EDGE_MASK_COUNT];
+  buildWeightTable(genreWeight, ratingWeight, directorWeight, weightTable);
+
+  TopK top;
+  topKInit(&top, results, maxResults);
+
+  uint64_t e = 0;
+  MaskFilter filter = selectMaskFilter();
+  if (filter != NULL && count >= SCORE_BLOCK) {
+    uint8_t accept[SCORE_ACCEPT_SIZE];
+    buildAcceptTable(weightTable, &top, accept);
+    int acceptRoot = INT_MIN; /* K-th score the table was built for */
+
+    for (; e + SCORE_BLOCK <= count; e += SCORE_BLOCK) {
+      uint32_t hits = filter(edgeMasks + e, accept);
+      while (hits != 0) {
+        uint64_t at = e + (uint64_t)__builtin_ctz(hits);
+        hits &= hits - 1;
+        if (considerNeighbor(&top, weightTable[edgeMasks[at]], targets[at],
+                             baseIndex, movieIds, ratings) &&
+            top.size == top.capacity && top.heap[0].score != acceptRoot) {
+          acceptRoot = top.heap[0].score;
+          buildAcceptTable(weightTable, &top, accept);
+        }
+      }
+    }
+  }
+
+  for (; e < count; e++) {
+    int score = weightTable[edgeMasks[e]];
+    if (score > 0) {
+      considerNeighbor(&top, score, targets[e], baseIndex, movieIds, ratings);
+    }
+  }
+
+  STATS_ADD(candidatesScanned, count);
+  return topKFinish(&top);
+}
+
+/*
+ * Score the neighbors of one node in a frozen CSR graph
+ * Shared by the in-memory graph and mapped snapshots
+ */
+static int recommendFromCsr(const CsrGraph *csr, int baseIndex,
+                            int genreWeight, int ratingWeight,
+                            int directorWeight, Candidate *results,
+                            int maxResults) {
+  /* Nodes created after freezing (unknown IDs) have no row */
+  uint64_t edgeBegin = 0, edgeEnd = 0;
+  if (baseIndex >= 0 && baseIndex < csr->nodeCount) {
+    edgeBegin = csr->offsets[baseIndex];
+    edgeEnd = csr->offsets[baseIndex + 1];
+  }
+
+  return scoreNeighbors(csr->targets + edgeBegin, csr->edgeMasks + edgeBegin,
+                        edgeEnd - edgeBegin, baseIndex, csr->movieIds,
+                        csr->ratings, genreWeight, ratingWeight,
+                        directorWeight, results, maxResults);
+}
+
+/*
+ * Generate weighted recommendations based on knowledge graph
+ *
+ * Algorithm:
+ * 1. Get all neighbors of base movie from knowledge graph
+ * 2. For each neighbor, calculate weighted score based on edge types
+ * 3. Movies with multiple edge types share one neighbor entry whose
+ *    mask indexes a per-query weight table (O(1) per neighbor)
+ * 4. Keep the best maxResults (K) in a bounded heap ordered by score
+ *    (descending), then rating (descending), then ID
+ * 5. Return those K unique recommendations, best first
+ * A hot base movie with candidate lists skips steps 1-2 and merges its
+ * lists instead, whenever that gives the same results (or
+ * approximateCandidates allows it)
+ */
+int recommendMoviesWeighted(KnowledgeGraph *kg, HashTable *ht, int baseMovieId,
+                            int genreWeight, int ratingWeight,
+                            int directorWeight, Candidate *results,
+                            int maxResults) {
+  if (kg->implicitEdges) {
+    return recommendImplicit(kg->implicit, ht, baseMovieId, genreWeight,
+                             ratingWeight, directorWeight, results,
+                             maxResults);
+  }
+
+  /* Graphs assembled with addEdge are frozen on their first query */
+  if (kg->csr == NULL) {
+    freezeKnowledgeGraph(kg, ht);
+    if (kg->csr == NULL)
+      return 0;
+  }
+
+  int count = recommendFromCandidates(
+      kg->candidates, kg->csr, baseMovieId, genreWeight, ratingWeight,
+      directorWeight, results, maxResults, kg->approximateCandidates);
+  if (count >= 0)
+    return count;
+  return recommendFromGraph(kg->csr, baseMovieId, genreWeight, ratingWeight,
+                            directorWeight, results, maxResults);
+}
+
+/*
+ * Weighted recommendations straight from a frozen graph
+ *
+ * Looks the base movie up in the graph's own ID index, so the query
+ * path is read-only and never allocates.
+ */
+int recommendFromGraph(const CsrGraph *graph, int baseMovieId,
+                       int genreWeight, int ratingWeight, int directorWeight,
+                       Candidate *results, int maxResults) {
+  int baseIndex = findGraphIndex(graph, baseMovieId);
+  if (baseIndex < 0) {
+    return 0; /* Base movie not in graph */
+  }
+
+  return recommendFromCsr(graph, baseIndex, genreWeight, ratingWeight,
+                          directorWeight, results, maxResults);
+}
+
+/* =====================================================
+ * PRECOMPUTED CANDIDATES (Hot Nodes)
+ * ===================================================== */
+
+#define CANDIDATE_PARTITION_NODES 256 /* Hot nodes per build partition */
+
+/* A row longer than every list put together gains from the lists */
+static int candidateNodeIsHot(const CsrGraph *csr, int node, int listSize) {
+  return csr->offsets[node + 1] - csr->offsets[node] >
+         (uint64_t)(EDGE_MASK_COUNT - 1) * (uint64_t)listSize;
+}
+
+typedef struct {
+  const CsrGraph *csr;
+  CandidateLists *lists;
+  const int32_t *hotNodes;      /* Hot node number -> node */
+  Candidate *scratch;           /* EDGE_MASK_COUNT heaps per worker */
+} CandidateJob;
+
+/* Hot nodes of one partition */
+static void candidatePartitionRange(const CandidateJob *job, int partition,
+                                    int *begin, int *end) {
+  *begin = partition * CANDIDATE_PARTITION_NODES;
+  *end = *begin + CANDIDATE_PARTITION_NODES < job->lists->hotCount
+             ? *begin + CANDIDATE_PARTITION_NODES
+             : job->lists->hotCount;
+}
+
+/*
+ * First pass: each list's length (kept neighbors per mask) goes in its
+ * listOffsets slot, and masks with more neighbors than fit are marked
+ * cut. The neighbors counted are the ones scoring can return: not the
+ * node itself and with a catalog entry.
+ */
+static void countCandidatesTask(void *context, int partition, int worker) {
+  CandidateJob *job = (CandidateJob *)context;
+  const CsrGraph *csr = job->csr;
+  CandidateLists *lists = job->lists;
+  (void)worker;
+
+  int begin, end;
+  candidatePartitionRange(job, partition, &begin, &end);
+  for (int hot = begin; hot < end; hot++) {
+    int node = job->hotNodes[hot];
+    uint64_t counts[EDGE_MASK_COUNT] = {0};
+    for (uint64_t e = csr->offsets[node]; e < csr->offsets[node + 1]; e++) {
+      int target = csr->targets[e];
+      if (target != node && !isnan(csr->ratings[target]))
+        counts[csr->edgeMasks[e]]++;
+    }
+
+    uint8_t truncated = 0;
+    uint64_t *lengths = lists->listOffsets + (uint64_t)hot * EDGE_MASK_COUNT;
+    for (int mask = 0; mask < EDGE_MASK_COUNT; mask++) {
+      lengths[mask] = mask == 0 ? 0 : counts[mask];
+      if (lengths[mask] > (uint64_t)lists->listSize) {
+        lengths[mask] = (uint64_t)lists->listSize;
+        truncated |= (uint8_t)(1u << mask);
+      }
+    }
+    lists->truncated[hot] = truncated;
+  }
+}
+
+/*
+ * Second pass: pick each mask's best neighbors through a bounded heap
+ * of equal-score candidates, so compareCandidates ranks them by rating
+ * and then ID, and write them into the mask's list best first
+ */
+static void fillCandidatesTask(void *context, int partition, int worker) {
+  CandidateJob *job = (CandidateJob *)context;
+  const CsrGraph *csr = job->csr;
+  CandidateLists *lists = job->lists;
+  Candidate *scratch = job->scratch + (size_t)worker * EDGE_MASK_COUNT *
+                                          (size_t)lists->listSize;
+
+  int begin, end;
+  candidatePartitionRange(job, partition, &begin, &end);
+  for (int hot = begin; hot < end; hot++) {
+    int node = job->hotNodes[hot];
+    TopK tops[EDGE_MASK_COUNT];
+    for (int mask = 0; mask < EDGE_MASK_COUNT; mask++)
+      topKInit(&tops[mask], scratch + (size_t)mask * lists->listSize,
+               lists->listSize);
+
+    for (uint64_t e = csr->offsets[node]; e < csr->offsets[node + 1]; e++) {
+      int target = csr->targets[e];
+      uint8_t mask = csr->edgeMasks[e];
+      if (target == node || mask == 0 || isnan(csr->ratings[target]))
+        continue;
+      Candidate candidate = {csr->movieIds[target], 0, csr->ratings[target]};
+      topKPush(&tops[mask], &candidate);
+    }
+
+    const uint64_t *starts =
+        lists->listOffsets + (uint64_t)hot * EDGE_MASK_COUNT;
+    for (int mask = 1; mask < EDGE_MASK_COUNT; mask++) {
+      int count = topKFinish(&tops[mask]);
+      for (int i = 0; i < count; i++) {
+        lists->entries[starts[mask] + i].movieId = tops[mask].heap[i].movieId;
+        lists->entries[starts[mask] + i].rating = tops[mask].heap[i].rating;
+      }
+    }
+  }
+}
+
+void freeCandidateLists(CandidateLists *lists) {
+  if (lists == NULL)
+    return;
+  free(lists->hotIndex);
+  free(lists->listOffsets);
+  free(lists->entries);
+  free(lists->truncated);
+  free(lists);
+}
+
+/*
+ * Build the lists in two partitioned passes: count every list's length,
+ * turn the lengths into offsets, then select and write the neighbors
+ */
+CandidateLists *buildCandidateLists(const CsrGraph *csr, int listSize,
+                                    int threadCount) {
+  if (csr == NULL || listSize <= 0)
+    return NULL;
+
+  int nodeCount = csr->nodeCount;
+  CandidateLists *lists = (CandidateLists *)calloc(1, sizeof(CandidateLists));
+  int32_t *hotNodes = NULL;
+  int ok = lists != NULL;
+  if (ok) {
+    lists->listSize = listSize;
+    lists->nodeCount = nodeCount;
+    lists->hotIndex = (int32_t *)malloc(
+        (nodeCount > 0 ? nodeCount : 1) * sizeof(int32_t));
+    ok = lists->hotIndex != NULL;
+  }
+
+  if (ok) {
+    for (int node = 0; node < nodeCount; node++) {
+      lists->hotIndex[node] =
+          candidateNodeIsHot(csr, node, listSize) ? lists->hotCount++ : -1;
+    }
+    size_t hotSlots = lists->hotCount > 0 ? lists->hotCount : 1;
+    hotNodes = (int32_t *)malloc(hotSlots * sizeof(int32_t));
+    lists->listOffsets = (uint64_t *)malloc(
+        (hotSlots * EDGE_MASK_COUNT + 1) * sizeof(uint64_t));
+    lists->truncated = (uint8_t *)malloc(hotSlots);
+    ok = hotNodes != NULL && lists->listOffsets != NULL &&
+         lists->truncated != NULL;
+  }
+
+  threadCount = resolveThreadCount(threadCount);
+  CandidateJob job = {csr, lists, hotNodes, NULL};
+  int partitionCount = 0;
+  if (ok) {
+    for (int node = 0; node < nodeCount; node++) {
+      if (lists->hotIndex[node] >= 0)
+        hotNodes[lists->hotIndex[node]] = node;
+    }
+    partitionCount = (lists->hotCount + CANDIDATE_PARTITION_NODES - 1) /
+                     CANDIDATE_PARTITION_NODES;
+    runPartitions(countCandidatesTask, &job, partitionCount, threadCount);
+
+    /* Lengths -> offsets; the last slot is one past the end */
+    uint64_t total = 0;
+    uint64_t slots = (uint64_t)lists->hotCount * EDGE_MASK_COUNT;
+    for (uint64_t i = 0; i < slots; i++) {
+      uint64_t length = lists->listOffsets[i];
+      lists->listOffsets[i] = total;
+      total += length;
+    }
+    lists->listOffsets[slots] = total;
+
+    lists->entries = (RankedNeighbor *)malloc(
+        (total > 0 ? total : 1) * sizeof(RankedNeighbor));
+    job.scratch = (Candidate *)malloc((size_t)threadCount * EDGE_MASK_COUNT *
+                                      (size_t)listSize * sizeof(Candidate));
+    ok = lists->entries != NULL && job.scratch != NULL;
+  }
+
+  if (ok)
+    runPartitions(fillCandidatesTask, &job, partitionCount, threadCount);
+
+  free(job.scratch);
+  free(hotNodes);
+  if (!ok) {
+    fprintf(stderr, "Error: Memory allocation failed for candidate lists\n");
+    freeCandidateLists(lists);
+    return NULL;
+  }
+  return lists;
+}
+
+/*
+ * Merge the lists of the masks the weights score
+ * Each list is best first and its entries all score the same, so a list
+ * stops at the first entry that cannot beat the current K-th result.
+ */
+int recommendFromCandidates(const CandidateLists *lists,
+                            const CsrGraph *graph, int baseMovieId,
+                            int genreWeight, int ratingWeight,
+                            int directorWeight, Candidate *results,
+                            int maxResults, int approximate) {
+  if (lists == NULL || graph == NULL || lists->nodeCount != graph->nodeCount)
+    return -1;
+  int baseIndex = findGraphIndex(graph, baseMovieId);
+  if (baseIndex < 0 || lists->hotIndex[baseIndex] < 0)
+    return -1;
+  if (maxResults <= 0)
+    return 0;
+
+  int hot = lists->hotIndex[baseIndex];
+  int weightTable[EDGE_MASK_COUNT];
+  buildWeightTable(genreWeight, ratingWeight, directorWeight, weightTable);
+
+  /* Past M results, a cut list may be hiding some of them */
+  if (maxResults > lists->listSize && !approximate) {
+    for (int mask = 1; mask < EDGE_MASK_COUNT; mask++) {
+      if (weightTable[mask] > 0 && (lists->truncated[hot] >> mask & 1))
+        return -1;
+    }
+  }
+
+  TopK top;
+  topKInit(&top, results, maxResults);
+  uint64_t scanned = 0;
+  /* Mask 0 lists are empty, so every list ends where the next slot starts */
+  const uint64_t *starts = lists->listOffsets + (uint64_t)hot * EDGE_MASK_COUNT;
+  for (int mask = 1; mask < EDGE_MASK_COUNT; mask++) {
+    int score = weightTable[mask];
+    if (score <= 0)
+      continue;
+    for (uint64_t e = starts[mask]; e < starts[mask + 1]; e++) {
+      Candidate candidate = {lists->entries[e].movieId, score,
+                             lists->entries[e].rating};
+      if (top.size == top.capacity &&
+          compareCandidates(&candidate, &top.heap[0]) >= 0)
+        break;
+      topKPush(&top, &candidate);
+      scanned++;
+    }
+  }
+
+  STATS_ADD(candidatesScanned, scanned);
+  return topKFinish(&top);
+}
+
+/* =====================================================
+ * MULTI-HOP RECOMMENDATION (Bounded BFS)
+ * ===================================================== */
+
+int initBfsScratch(BfsScratch *scratch, int nodeCount) {
+  size_t words = ((size_t)nodeCount + 63) / 64;
+  initQueue(&scratch->frontier);
+  scratch->visited = (uint64_t *)calloc(words > 0 ? words : 1, sizeof(uint64_t));
+  scratch->levelScore =
+      (int32_t *)calloc(nodeCount > 0 ? nodeCount : 1, sizeof(int32_t));
+  scratch->nodeCount = nodeCount;
+  if (scratch->visited == NULL || scratch->levelScore == NULL ||
+      !reserveQueue(&scratch->frontier, nodeCount > 0 ? nodeCount : 1)) {
+    fprintf(stderr, "Error: Memory allocation failed for traversal\n");
+    freeBfsScratch(scratch);
+    return 0;
+  }
+  return 1;
+}
+
+void freeBfsScratch(BfsScratch *scratch) {
+  freeQueue(&scratch->frontier);
+  free(scratch->visited);
+  free(scratch->levelScore);
+  scratch->visited = NULL;
+  scratch->levelScore = NULL;
+  scratch->nodeCount = 0;
+}
+
+/*
+ * Adjacency the traversal reads: a CSR graph, or the chunked rows of a
+ * live version (rowChunks != NULL)
+ */
+typedef struct {
+  const uint64_t *offsets;
+  const int32_t *targets;
+  const uint8_t *edgeMasks;
+  LiveRow *const *rowChunks;
+  const int32_t *movieIds;
+  const float *ratings;
+  int nodeCount;
+} BfsGraph;
+
+static BfsGraph csrBfsGraph(const CsrGraph *csr) {
+  BfsGraph graph = {csr->offsets,  csr->targets, csr->edgeMasks, NULL,
+                    csr->movieIds, csr->ratings, csr->nodeCount};
+  return graph;
+}
+
+#define BFS_VISITED(bits, node) ((bits)[(node) >> 6] >> ((node) & 63) & 1)
+#define BFS_VISIT(bits, node) ((bits)[(node) >> 6] |= 1ull << ((node) & 63))
+
+/*
+ * Level-synchronous BFS from baseIndex
+ *
+ * The queue holds exactly one hop at a time. While a hop is expanded,
+ * levelScore keeps the best decayed edge weight into each newly reached
+ * node; once the hop is done those nodes are scored, marked visited and
+ * become the next frontier. Every node is queued at most once, so a
+ * queue reserved for nodeCount items never wraps or grows, and only the
+ * bits of queued nodes need clearing afterwards.
+ */
+static int recommendFromBfs(const BfsGraph *graph, BfsScratch *scratch,
+                            int baseIndex, int genreWeight, int ratingWeight,
+                            int directorWeight, const MultiHopOptions *options,
+                            Candidate *results, int maxResults) {
+  if (baseIndex < 0 || baseIndex >= graph->nodeCount || maxResults <= 0) {
+    return 0;
+  }
+  if (scratch->nodeCount < graph->nodeCount) {
+    freeBfsScratch(scratch);
+    if (!initBfsScratch(scratch, graph->nodeCount))
+      return 0;
+  }
+
+  int maxHops = options->maxHops;
+  if (maxHops < 1)
+    maxHops = 1;
+  if (maxHops > MULTI_HOP_MAX_HOPS)
+    maxHops = MULTI_HOP_MAX_HOPS;
+  int decay = options->decayPercent;
+  if (decay < 0)
+    decay = 0;
+  if (decay > 100)
+    decay = 100;
+  int budget = options->candidateBudget > 0 ? options->candidateBudget
+                                            : graph->nodeCount;
+
+  int weightTable[EDGE_MASK_COUNT];
+  buildWeightTable(genreWeight, ratingWeight, directorWeight, weightTable);
+  int bestWeight = weightTable[EDGE_MASK_COUNT - 1];
+
+  TopK top;
+  topKInit(&top, results, maxResults);
+
+  Queue *frontier = &scratch->frontier;
+  uint64_t *visited = scratch->visited;
+  int32_t *levelScore = scratch->levelScore;
+  clearQueue(frontier);
+  BFS_VISIT(visited, baseIndex);
+  enqueue(frontier, baseIndex);
+  int queued = 1;
+  uint64_t scanned = 0;
+
+  /* Hop h scales edge weights by scale / 100 */
+  int scale = 100;
+  for (int hop = 1; hop <= maxHops && !isQueueEmpty(frontier); hop++) {
+    for (int remaining = frontier->size; remaining > 0; remaining--) {
+      int node = dequeue(frontier);
+      const int32_t *targets;
+      const uint8_t *edgeMasks;
+      uint64_t degree;
+      if (graph->rowChunks != NULL) {
+        const LiveRow *row = LIVE_CHUNK_ENTRY(graph->rowChunks, node);
+        targets = row->targets;
+        edgeMasks = row->edgeMasks;
+        degree = row->degree;
+      } else {
+        uint64_t begin = graph->offsets[node];
+        targets = graph->targets + begin;
+        edgeMasks = graph->edgeMasks + begin;
+        degree = graph->offsets[node + 1] - begin;
+      }
+      scanned += degree;
+
+      for (uint64_t e = 0; e < degree; e++) {
+        int target = targets[e];
+        int score = weightTable[edgeMasks[e]] * scale / 100;
+
+        /* NAN marks a node with no catalog entry */
+        if (score <= 0 || BFS_VISITED(visited, target) ||
+            isnan(graph->ratings[target]))
+          continue;
+        if (levelScore[target] == 0) {
+          if (queued - 1 >= budget)
+            continue;
+          enqueue(frontier, target);
+          queued++;
+          levelScore[target] = score;
+        } else if (score > levelScore[target]) {
+          levelScore[target] = score;
+        }
+      }
+    }
+
+    /* The queue now holds exactly this hop's movies */
+    for (int i = 0; i < frontier->size; i++) {
+      int node = frontier->items[(frontier->head + i) % frontier->capacity];
+      int score = levelScore[node];
+      levelScore[node] = 0;
+      BFS_VISIT(visited, node);
+      if (topKAccepts(&top, score)) {
+        Candidate candidate = {graph->movieIds[node], score,
+                               graph->ratings[node]};
+        topKPush(&top, &candidate);
+      }
+    }
+
+    /* Stop once nothing deeper could enter the top K */
+    scale = scale * decay / 100;
+    int nextBest = bestWeight * scale / 100;
+    if (nextBest <= 0 || queued - 1 >= budget ||
+        (top.size == top.capacity && !topKAccepts(&top, nextBest)))
+      break;
+  }
+
+  /* No wrap-around: every queued node is still in items[0, queued) */
+  for (int i = 0; i < queued; i++) {
+    int node = frontier->items[i];
+    visited[node >> 6] = 0;
+  }
+  clearQueue(frontier);
+
+  STATS_ADD(candidatesScanned, scanned);
+  return topKFinish(&top);
+}
+
+int recommendMultiHop(KnowledgeGraph *kg, HashTable *ht, BfsScratch *scratch,
+                      int baseMovieId, int genreWeight, int ratingWeight,
+                      int directorWeight, const MultiHopOptions *options,
+                      Candidate *results, int maxResults) {
+  /* Implicit edges are never stored, so there is nothing to walk */
+  if (kg->implicitEdges) {
+    return 0;
+  }
+  if (kg->csr == NULL) {
+    freezeKnowledgeGraph(kg, ht);
+    if (kg->csr == NULL)
+      return 0;
+  }
+
+  int baseIndex = findGraphIndex(kg->csr, baseMovieId);
+  if (baseIndex < 0) {
+    return 0; /* Base movie not in graph */
+  }
+
+  BfsGraph graph = csrBfsGraph(kg->csr);
+  return recommendFromBfs(&graph, scratch, baseIndex, genreWeight,
+                          ratingWeight, directorWeight, options, results,
+                          maxResults);
+}
+
+/* =====================================================
+ * BATCH RECOMMENDATION
+ * ===================================================== */
+
+/* Answers one query from a read-only source into results */
+typedef int (*BatchQueryFunction)(const void *source, const BatchQuery *query,
+                                  Candidate *results);
+
+/* A frozen in-memory graph with its catalog */
+typedef struct {
+  const KnowledgeGraph *kg;
+  const HashTable *ht;
+} GraphSource;
+
+static int answerGraphQuery(const void *source, const BatchQuery *query,
+                            Candidate *results) {
+  const GraphSource *graph = (const GraphSource *)source;
+  if (graph->kg->implicitEdges) {
+    return recommendImplicit(graph->kg->implicit, graph->ht,
+                             query->baseMovieId, query->genreWeight,
+                             query->ratingWeight, query->directorWeight,
+                             results, query->maxResults);
+  }
+
+  int count = recommendFromCandidates(
+      graph->kg->candidates, graph->kg->csr, query->baseMovieId,
+      query->genreWeight, query->ratingWeight, query->directorWeight, results,
+      query->maxResults, graph->kg->approximateCandidates);
+  if (count >= 0)
+    return count;
+  return recommendFromGraph(graph->kg->csr, query->baseMovieId,
+                            query->genreWeight, query->ratingWeight,
+                            query->directorWeight, results, query->maxResults);
+}
+
+static int answerSnapshotQuery(const void *source, const BatchQuery *query,
+                               Candidate *results) {
+  return recommendFromSnapshot((const Snapshot *)source, query->baseMovieId,
+                               query->genreWeight, query->ratingWeight,
+                               query->directorWeight, results,
+                               query->maxResults);
+}
+
+/*
+ * Run every query against source with one results buffer sized for
+ * the largest maxResults in the batch
+ */
+static int runBatchSequential(const void *source, BatchQueryFunction answer,
+                              const BatchQuery *queries, int queryCount,
+                              BatchResultCallback onResult, void *context) {
+  int capacity = 1;
+  for (int i = 0; i < queryCount; i++) {
+    if (queries[i].maxResults > capacity)
+      capacity = queries[i].maxResults;
+  }
+
+  Candidate *results = (Candidate *)malloc(capacity * sizeof(Candidate));
+  if (results == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for results\n");
+    return 0;
+  }
+
+  for (int i = 0; i < queryCount; i++) {
+    int count = queries[i].maxResults > 0
+                    ? answer(source, &queries[i], results)
+                    : 0;
+    onResult(i, results, count, context);
+  }
+
+  free(results);
+  return 1;
+}
+
+#ifdef RECOMMENDER_THREADS
+
+/*
+ * Parallel batches
+ *
+ * Queries run in windows of BATCH_WINDOW_PER_THREAD per worker. Each
+ * window is split into one contiguous range per worker; a worker takes
+ * queries from the front of its own range and, once that is empty,
+ * steals the back half of another worker's, so a few high-degree base
+ * movies do not leave the other cores idle. Every query builds its
+ * top-K heap directly in its own result slots, so workers share nothing
+ * but the read-only source. When the window is done the calling thread
+ * hands the results to the callback in input order.
+ */
+
+/* Window queries [next, end) still owned by one worker */
+typedef struct {
+  pthread_mutex_t lock;
+  int next;
+  int end;
+} WorkRange;
+
+typedef struct {
+  const void *source;
+  BatchQueryFunction answer;
+  const BatchQuery *queries;    /* First query of the current window */
+  const size_t *slotOffsets;    /* Window query -> first result slot */
+  Candidate *results;
+  int *counts;                  /* Window query -> results found */
+  WorkRange *ranges;            /* One per worker */
+  int workerCount;
+  pthread_mutex_t lock;
+  pthread_cond_t windowReady;
+  pthread_cond_t windowDone;
+  int generation;               /* Bumped as each window is published */
+  int busyWorkers;              /* Pool threads still on the window */
+  int shutdown;
+} BatchPool;
+
+typedef struct {
+  BatchPool *pool;
+  int worker;
+} BatchWorker;
+
+/*
+ * Next window query for worker - returns -1 when none is left anywhere
+ */
+static int takeBatchQuery(BatchPool *pool, int worker) {
+  WorkRange *own = &pool->ranges[worker];
+  pthread_mutex_lock(&own->lock);
+  if (own->next < own->end) {
+    int query = own->next++;
+    pthread_mutex_unlock(&own->lock);
+    return query;
+  }
+  pthread_mutex_unlock(&own->lock);
+
+  for (int step = 1; step < pool->workerCount; step++) {
+    WorkRange *victim = &pool->ranges[(worker + step) % pool->workerCount];
+    pthread_mutex_lock(&victim->lock);
+    int remaining = victim->end - victim->next;
+    if (remaining <= 0) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+
+    int stolenEnd = victim->end;
+    int stolenBegin = stolenEnd - (remaining + 1) / 2;
+    victim->end = stolenBegin;
+    pthread_mutex_unlock(&victim->lock);
+
+    /* Run the first stolen query now, keep the rest for stealing back */
+    pthread_mutex_lock(&own->lock);
+    own->next = stolenBegin + 1;
+    own->end = stolenEnd;
+    pthread_mutex_unlock(&own->lock);
+    return stolenBegin;
+  }
+  return -1;
+}
+
+static void runBatchWindow(BatchPool *pool, int worker) {
+  int query;
+  while ((query = takeBatchQuery(pool, worker)) >= 0) {
+    const BatchQuery *q = &pool->queries[query];
+    pool->counts[query] =
+        q->maxResults > 0
+            ? pool->answer(pool->source, q,
+                           pool->results + pool->slotOffsets[query])
+            : 0;
+  }
+}
+
+static void *batchWorkerMain(void *argument) {
+  BatchWorker *self = (BatchWorker *)argument;
+  BatchPool *pool = self->pool;
+  int seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == seen && !pool->shutdown)
+      pthread_cond_wait(&pool->windowReady, &pool->lock);
+    if (pool->shutdown)
+      break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    runBatchWindow(pool, self->worker);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busyWorkers == 0)
+      pthread_cond_signal(&pool->windowDone);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+static int runBatchParallel(const void *source, BatchQueryFunction answer,
+                            const BatchQuery *queries, int queryCount,
+                            int threadCount, BatchResultCallback onResult,
+                            void *context) {
+  int windowSize = threadCount * BATCH_WINDOW_PER_THREAD;
+  size_t slotCapacity = 1;
+  for (int begin = 0; begin < queryCount; begin += windowSize) {
+    size_t slots = 0;
+    for (int i = begin; i < queryCount && i < begin + windowSize; i++) {
+      if (queries[i].maxResults > 0)
+        slots += queries[i].maxResults;
+    }
+    if (slots > slotCapacity)
+      slotCapacity = slots;
+  }
+
+  BatchPool pool;
+  memset(&pool, 0, sizeof(pool));
+  size_t *slotOffsets = (size_t *)malloc(windowSize * sizeof(size_t));
+  int *counts = (int *)malloc(windowSize * sizeof(int));
+  Candidate *results = (Candidate *)malloc(slotCapacity * sizeof(Candidate));
+  WorkRange *ranges = (WorkRange *)malloc(threadCount * sizeof(WorkRange));
+  pthread_t *threads = (pthread_t *)malloc(threadCount * sizeof(pthread_t));
+  BatchWorker *workers =
+      (BatchWorker *)malloc(threadCount * sizeof(BatchWorker));
+  if (slotOffsets == NULL || counts == NULL || results == NULL ||
+      ranges == NULL || threads == NULL || workers == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for batch workers\n");
+    free(slotOffsets);
+    free(counts);
+    free(results);
+    free(ranges);
+    free(threads);
+    free(workers);
+    return 0;
+  }
+
+  pool.source = source;
+  pool.answer = answer;
+  pool.slotOffsets = slotOffsets;
+  pool.results = results;
+  pool.counts = counts;
+  pool.ranges = ranges;
+  pthread_mutex_init(&pool.lock, NULL);
+  pthread_cond_init(&pool.windowReady, NULL);
+  pthread_cond_init(&pool.windowDone, NULL);
+  for (int i = 0; i < threadCount; i++) {
+    pthread_mutex_init(&ranges[i].lock, NULL);
+  }
+
+  /* The calling thread is worker 0; run with fewer if threads run out */
+  int started = 1;
+  for (; started < threadCount; started++) {
+    workers[started].pool = &pool;
+    workers[started].worker = started;
+    if (pthread_create(&threads[started], NULL, batchWorkerMain,
+                       &workers[started]) != 0)
+      break;
+  }
+  pool.workerCount = started;
+
+  for (int begin = 0; begin < queryCount; begin += windowSize) {
+    int count = queryCount - begin < windowSize ? queryCount - begin
+                                                 : windowSize;
+    size_t slot = 0;
+    for (int i = 0; i < count; i++) {
+      slotOffsets[i] = slot;
+      if (queries[begin + i].maxResults > 0)
+        slot += queries[begin + i].maxResults;
+    }
+    for (int w = 0; w < pool.workerCount; w++) {
+      ranges[w].next = (int)((long long)count * w / pool.workerCount);
+      ranges[w].end = (int)((long long)count * (w + 1) / pool.workerCount);
+    }
+
+    pthread_mutex_lock(&pool.lock);
+    pool.queries = queries + begin;
+    pool.busyWorkers = pool.workerCount - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.windowReady);
+    pthread_mutex_unlock(&pool.lock);
+
+    runBatchWindow(&pool, 0);
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.busyWorkers > 0)
+      pthread_cond_wait(&pool.windowDone, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+
+    for (int i = 0; i < count; i++) {
+      onResult(begin + i, results + slotOffsets[i], counts[i], context);
+    }
+  }
+
+  pthread_mutex_lock(&pool.lock);
+  pool.shutdown = 1;
+  pthread_cond_broadcast(&pool.windowReady);
+  pthread_mutex_unlock(&pool.lock);
+  for (int i = 1; i < pool.workerCount; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (int i = 0; i < threadCount; i++) {
+    pthread_mutex_destroy(&ranges[i].lock);
+  }
+  pthread_cond_destroy(&pool.windowDone);
+  pthread_cond_destroy(&pool.windowReady);
+  pthread_mutex_destroy(&pool.lock);
+  free(slotOffsets);
+  free(counts);
+  free(results);
+  free(ranges);
+  free(threads);
+  free(workers);
+  return 1;
+}
+
+#endif /* RECOMMENDER_THREADS */
+
+/*
+ * Pick sequential or parallel execution for a batch
+ */
+static int runBatch(const void *source, BatchQueryFunction answer,
+                    const BatchQuery *queries, int queryCount,
+                    int threadCount, BatchResultCallback onResult,
+                    void *context) {
+  STATS_TIMER_START(timer);
+  STATS_ADD(batchQueries, (uint64_t)(queryCount > 0 ? queryCount : 0));
+  int ok;
+#ifdef RECOMMENDER_THREADS
+  threadCount = resolveThreadCount(threadCount);
+  /* No point in more workers than queries */
+  if (threadCount > 1 && queryCount > 1) {
+    if (threadCount > queryCount)
+      threadCount = queryCount;
+    ok = runBatchParallel(source, answer, queries, queryCount, threadCount,
+                          onResult, context);
+  } else
+#else
+  (void)threadCount;
+#endif
+  {
+    ok = runBatchSequential(source, answer, queries, queryCount, onResult,
+                            context);
+  }
+  STATS_TIMER_STOP(timer, STATS_BATCH);
+  return ok;
+}
+
+int recommendBatch(KnowledgeGraph *kg, HashTable *ht,
+                   const BatchQuery *queries, int queryCount, int threadCount,
+                   BatchResultCallback onResult, void *context) {
+  /* Freeze once so every query below is a pure read */
+  if (!kg->implicitEdges && kg->csr == NULL) {
+    freezeKnowledgeGraph(kg, ht);
+    if (kg->csr == NULL)
+      return 0;
+  }
+
+  GraphSource source = {kg, ht};
+  return runBatch(&source, answerGraphQuery, queries, queryCount, threadCount,
+                  onResult, context);
+}
+
+/* =====================================================
+ * RESULT CACHE
+ * ===================================================== */
+
+void initResultCache(ResultCache *cache, size_t capacityBytes) {
+  memset(cache, 0, sizeof(*cache));
+  cache->capacityBytes = capacityBytes;
+}
+
+static size_t resultCacheEntrySize(int count) {
+  return sizeof(ResultCacheEntry) + (size_t)count * sizeof(Candidate);
+}
+
+static unsigned int resultCacheHash(const BatchQuery *key) {
+  /* Weights are 0-10, so they pack into the low bits beside the count */
+  uint64_t h = ((uint64_t)(uint32_t)key->baseMovieId << 32) ^
+               ((uint64_t)key->genreWeight << 24) ^
+               ((uint64_t)key->ratingWeight << 16) ^
+               ((uint64_t)key->directorWeight << 8) ^
+               (uint64_t)(uint32_t)key->maxResults * 0x9E3779B97F4A7C15ull;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 32;
+  return (unsigned int)h;
+}
+
+static int resultCacheKeyEquals(const BatchQuery *a, const BatchQuery *b) {
+  return a->baseMovieId == b->baseMovieId &&
+         a->genreWeight == b->genreWeight &&
+         a->ratingWeight == b->ratingWeight &&
+         a->directorWeight == b->directorWeight &&
+         a->maxResults == b->maxResults;
+}
+
+static void resultCacheUnlink(ResultCache *cache, ResultCacheEntry *entry) {
+  if (entry->newer != NULL)
+    entry->newer->older = entry->older;
+  else
+    cache->newest = entry->older;
+  if (entry->older != NULL)
+    entry->older->newer = entry->newer;
+  else
+    cache->oldest = entry->newer;
+}
+
+static void resultCachePushNewest(ResultCache *cache, ResultCacheEntry *entry) {
+  entry->newer = NULL;
+  entry->older = cache->newest;
+  if (cache->newest != NULL)
+    cache->newest->newer = entry;
+  else
+    cache->oldest = entry;
+  cache->newest = entry;
+}
+
+/*
+ * Unlink entry from its bucket and the LRU list, then free it
+ */
+static void resultCacheRemove(ResultCache *cache, ResultCacheEntry *entry) {
+  ResultCacheEntry **link =
+      &cache->buckets[resultCacheHash(&entry->key) & (cache->bucketCount - 1)];
+  while (*link != entry) {
+    link = &(*link)->chainNext;
+  }
+  *link = entry->chainNext;
+
+  resultCacheUnlink(cache, entry);
+  cache->bytes -= resultCacheEntrySize(entry->count);
+  cache->count--;
+  free(entry);
+}
+
+/* Drop every entry when the catalog moves to a new epoch */
+static void resultCacheSetEpoch(ResultCache *cache, uint64_t epoch) {
+  if (epoch == cache->epoch) {
+    return;
+  }
+
+  ResultCacheEntry *entry = cache->newest;
+  while (entry != NULL) {
+    ResultCacheEntry *older = entry->older;
+    free(entry);
+    entry = older;
+  }
+  if (cache->buckets != NULL)
+    memset(cache->buckets, 0, cache->bucketCount * sizeof(ResultCacheEntry *));
+  cache->newest = cache->oldest = NULL;
+  cache->count = 0;
+  cache->bytes = cache->bucketCount * sizeof(ResultCacheEntry *);
+  cache->epoch = epoch;
+}
+
+/*
+ * Double the bucket array once entries outnumber buckets
+ * The array counts toward bytes, and is not grown past the capacity
+ */
+static void resultCacheRehash(ResultCache *cache) {
+  int bucketCount = cache->bucketCount > 0 ? cache->bucketCount * 2 : 256;
+  size_t oldBytes = cache->bucketCount * sizeof(ResultCacheEntry *);
+  size_t newBytes = bucketCount * sizeof(ResultCacheEntry *);
+  if (cache->bytes - oldBytes + newBytes > cache->capacityBytes) {
+    return; /* Longer chains, still correct */
+  }
+  ResultCacheEntry **buckets =
+      (ResultCacheEntry **)calloc(bucketCount, sizeof(ResultCacheEntry *));
+  if (buckets == NULL) {
+    return; /* Longer chains, still correct */
+  }
+
+  for (ResultCacheEntry *e = cache->newest; e != NULL; e = e->older) {
+    unsigned int slot = resultCacheHash(&e->key) & (bucketCount - 1);
+    e->chainNext = buckets[slot];
+    buckets[slot] = e;
+  }
+  free(cache->buckets);
+  cache->buckets = buckets;
+  cache->bucketCount = bucketCount;
+  cache->bytes += newBytes - oldBytes;
+}
+
+const ResultCacheEntry *resultCacheLookup(ResultCache *cache, uint64_t epoch,
+                                          const BatchQuery *key) {
+  resultCacheSetEpoch(cache, epoch);
+
+  ResultCacheEntry *entry = NULL;
+  if (cache->bucketCount > 0) {
+    entry = cache->buckets[resultCacheHash(key) & (cache->bucketCount - 1)];
+    while (entry != NULL && !resultCacheKeyEquals(&entry->key, key)) {
+      entry = entry->chainNext;
+    }
+  }
+
+  if (entry == NULL) {
+    cache->misses++;
+    return NULL;
+  }
+
+  cache->hits++;
+  if (entry != cache->newest) {
+    resultCacheUnlink(cache, entry);
+    resultCachePushNewest(cache, entry);
+  }
+  return entry;
+}
+
+int resultCacheStore(ResultCache *cache, uint64_t epoch, const BatchQuery *key,
+                     const Candidate *results, int count) {
+  size_t size = resultCacheEntrySize(count);
+  if (size > cache->capacityBytes) {
+    return 0;
+  }
+  resultCacheSetEpoch(cache, epoch);
+
+  /* Replace rather than duplicate a key that is already cached */
+  if (cache->bucketCount > 0) {
+    ResultCacheEntry *old =
+        cache->buckets[resultCacheHash(key) & (cache->bucketCount - 1)];
+    while (old != NULL && !resultCacheKeyEquals(&old->key, key)) {
+      old = old->chainNext;
+    }
+    if (old != NULL)
+      resultCacheRemove(cache, old);
+  }
+
+  if (cache->count >= cache->bucketCount) {
+    resultCacheRehash(cache);
+    if (cache->bucketCount == 0)
+      return 0;
+  }
+  while (cache->bytes + size > cache->capacityBytes && cache->oldest != NULL) {
+    resultCacheRemove(cache, cache->oldest);
+    cache->evictions++;
+  }
+  if (cache->bytes + size > cache->capacityBytes) {
+    return 0; /* The buckets leave no room for this entry */
+  }
+
+  ResultCacheEntry *entry = (ResultCacheEntry *)malloc(size);
+  if (entry == NULL) {
+    return 0; /* The cache is an optimization; callers still have results */
+  }
+  entry->key = *key;
+  entry->count = count;
+  memcpy(entry->results, results, count * sizeof(Candidate));
+
+  unsigned int slot = resultCacheHash(key) & (cache->bucketCount - 1);
+  entry->chainNext = cache->buckets[slot];
+  cache->buckets[slot] = entry;
+  resultCachePushNewest(cache, entry);
+  cache->bytes += size;
+  cache->count++;
+  return 1;
+}
+
+void freeResultCache(ResultCache *cache) {
+  ResultCacheEntry *entry = cache->newest;
+  while (entry != NULL) {
+    ResultCacheEntry *older = entry->older;
+    free(entry);
+    entry = older;
+  }
+  free(cache->buckets);
+  initResultCache(cache, 0);
+}
+
+/* =====================================================
+ * FILE I/O
+ * ===================================================== */
+
+/*
+ * View of a NUL-terminated string
+ */
+StringView makeStringView(const char *text) {
+  StringView view = {text, (int)strlen(text)};
+  return view;
+}
+
+/*
+ * Map a catalog file read-only (or read it whole where mmap is missing)
+ * The buffer is recorded in ht->files so it lives as long as the table
+ */
+static CatalogBuffer *openCatalogFile(const char *filename, HashTable *ht) {
+  CatalogBuffer *file =
+      (CatalogBuffer *)arenaAlloc(&ht->arena, sizeof(CatalogBuffer));
+  if (file == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for catalog\n");
+    return NULL;
+  }
+  file->data = NULL;
+  file->size = 0;
+  file->mapped = 0;
+
+#ifndef _WIN32
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Error: Cannot open file %s\n", filename);
+    return NULL;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    fprintf(stderr, "Error: Cannot read file %s\n", filename);
+    close(fd);
+    return NULL;
+  }
+  if (info.st_size > 0) {
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      /* One front-to-back pass: let the kernel read ahead aggressively */
+      posix_madvise(data, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+      file->data = data;
+      file->size = (size_t)info.st_size;
+      file->mapped = 1;
+    }
+  }
+  close(fd);
+
+  if (!file->mapped && info.st_size > 0) {
+    fprintf(stderr, "Error: Cannot map file %s\n", filename);
+    return NULL;
+  }
+#else
+  FILE *stream = fopen(filename, "rb");
+  if (stream == NULL) {
+    fprintf(stderr, "Error: Cannot open file %s\n", filename);
+    return NULL;
+  }
+
+  fseek(stream, 0, SEEK_END);
+  long size = ftell(stream);
+  fseek(stream, 0, SEEK_SET);
+  if (size > 0) {
+    file->data = malloc((size_t)size);
+    if (file->data == NULL ||
+        fread(file->data, 1, (size_t)size, stream) != (size_t)size) {
+      fprintf(stderr, "Error: Cannot read file %s\n", filename);
+      free(file->data);
+      fclose(stream);
+      return NULL;
+    }
+    file->size = (size_t)size;
+  }
+  fclose(stream);
+#endif
+
+  file->next = ht->files;
+  ht->files = file;
+  return file;
+}
+
+/*
+ * Scan one CSV field starting at p
+ *
+ * Unquoted fields run to the next ',' or newline (a trailing '\r' is
+ * dropped). Quoted fields may contain commas, newlines and "" for a
+ * literal quote. The field is returned as a view into the buffer; only
+ * a quoted field containing "" is copied (unescaped) into the arena.
+ * Sets *recordEnd when the field ended its record and returns the
+ * position after the field's terminator.
+ */
+static const char *scanCsvField(const char *p, const char *end, Arena *arena,
+                                StringView *field, int *recordEnd) {
+  *recordEnd = 0;
+
+  if (p < end && *p == '"') {
+    const char *start = ++p;
+    int escapes = 0;
+
+    while (p < end) {
+      if (*p == '"') {
+        if (p + 1 < end && p[1] == '"') {
+          escapes++;
+          p += 2;
+          continue;
+        }
+        break;
+      }
+      p++;
+    }
+
+    const char *close = p;
+    field->data = start;
+    field->length = (int)(close - start);
+
+    if (escapes > 0) {
+      /* Collapse each "" pair into a single quote */
+      char *copy = (char *)arenaAlloc(arena, close - start - escapes);
+      int length = 0;
+      for (const char *q = start; copy != NULL && q < close; q++) {
+        copy[length++] = *q;
+        if (*q == '"')
+          q++;
+      }
+      if (copy != NULL) {
+        field->data = copy;
+        field->length = length;
+      }
+    }
+
+    /* Skip the closing quote and anything up to the terminator */
+    if (p < end)
+      p++;
+    while (p < end && *p != ',' && *p != '\n')
+      p++;
+  } else {
+    const char *start = p;
+    while (p < end && *p != ',' && *p != '\n')
+      p++;
+
+    const char *stop = p;
+    if (stop > start && stop[-1] == '\r')
+      stop--;
+    field->data = start;
+    field->length = (int)(stop - start);
+  }
+
+  if (p >= end || *p == '\n')
+    *recordEnd = 1;
+  return p < end ? p + 1 : end;
+}
+
+/*
+ * Parse a decimal integer the way atoi does (leading spaces, sign)
+ * Returns 0 if it does not fit in an int32_t, where atoi would be
+ * undefined
+ */
+static int parseIntField(StringView field, int *value) {
+  int i = 0;
+  while (i < field.length && (field.data[i] == ' ' || field.data[i] == '\t'))
+    i++;
+
+  int negative = 0;
+  if (i < field.length && (field.data[i] == '-' || field.data[i] == '+')) {
+    negative = field.data[i] == '-';
+    i++;
+  }
+
+  /* INT32_MAX + 1 is the magnitude of INT32_MIN */
+  int64_t limit = (int64_t)INT32_MAX + negative;
+  int64_t magnitude = 0;
+  for (; i < field.length && field.data[i] >= '0' && field.data[i] <= '9';
+       i++) {
+    magnitude = magnitude * 10 + (field.data[i] - '0');
+    if (magnitude > limit)
+      return 0;
+  }
+  *value = (int)(negative ? -magnitude : magnitude);
+  return 1;
+}
+
+/*
+ * Parse a rating with the same rounding as atof
+ */
+static float parseFloatField(StringView field) {
+  char buffer[64];
+  int length = field.length < (int)sizeof(buffer) - 1
+                   ? field.length
+                   : (int)sizeof(buffer) - 1;
+  memcpy(buffer, field.data, length);
+  buffer[length] = '\0';
+  return (float)atof(buffer);
+}
+
+/*
+ * Scan one CSV record (id,title,genre,rating,director) into movie
+ * Returns the position after the record; *fieldCount is the number of
+ * fields seen, and movie is only filled when there were at least five
+ * An ID that does not fit in an int32_t reports 0 fields, so callers
+ * treat the record like any other malformed one
+ */
+static const char *scanMovieRecord(const char *p, const char *end,
+                                   Arena *arena, Movie *movie,
+                                   int *fieldCount) {
+  StringView fields[5];
+  int recordEnd = 0;
+  *fieldCount = 0;
+
+  /* Read one record, keeping the first five fields */
+  while (!recordEnd) {
+    StringView field;
+    p = scanCsvField(p, end, arena, &field, &recordEnd);
+    if (*fieldCount < 5)
+      fields[*fieldCount] = field;
+    (*fieldCount)++;
+  }
+
+  if (*fieldCount >= 5 && !parseIntField(fields[0], &movie->id))
+    *fieldCount = 0;
+  if (*fieldCount >= 5) {
+    movie->title = fields[1];
+    movie->genre = fields[2];
+    movie->rating = parseFloatField(fields[3]);
+    movie->director = fields[4];
+  }
+  return p;
+}
+
+/*
+ * Load movies from CSV file
+ * Format: id,title,genre,rating,director
+ *
+ * The file is memory-mapped and parsed in a single pass. Strings are
+ * not copied: each Movie field is a view into the mapping, which stays
+ * alive until freeHashTable. Records with fewer than five fields, an
+ * ID that does not fit in an int32_t, or a rating that is not finite
+ * are skipped; extra fields are ignored. A NAN rating is how the graph
+ * marks a node with no catalog entry, so such a row would vanish from
+ * every query rather than load.
+ */
+static int parseMoviesFile(const char *filename, HashTable *ht) {
+  CatalogBuffer *file = openCatalogFile(filename, ht);
+  if (file == NULL) {
+    return 0;
+  }
+
+  const char *p = (const char *)file->data;
+  const char *end = p + file->size;
+  int count = 0;
+  int lineNumber = 0;
+
+  while (p < end) {
+    Movie movie;
+    int fieldCount;
+    p = scanMovieRecord(p, end, &ht->arena, &movie, &fieldCount);
+
+    /* Skip header line */
+    if (lineNumber++ == 0 || fieldCount < 5 || !isfinite(movie.rating))
+      continue;
+
+    insertMovie(ht, movie);
+    count++;
+  }
+
+  return count;
+}
+
+int loadMovies(const char *filename, HashTable *ht) {
+  STATS_TIMER_START(timer);
+  int loaded = parseMoviesFile(filename, ht);
+  STATS_TIMER_STOP(timer, STATS_LOAD);
+  return loaded;
+}
+
+/*
+ * Print one CSV field, quoting it when it contains a comma, quote or
+ * line break so the row can be read back by any CSV parser
+ */
+static void printCsvField(StringView field) {
+  int needsQuotes = 0;
+  for (int i = 0; i < field.length; i++) {
+    char c = field.data[i];
+    if (c == ',' || c == '"' || c == '\n' || c == '\r') {
+      needsQuotes = 1;
+      break;
+    }
+  }
+
+  if (!needsQuotes) {
+    fwrite(field.data, 1, field.length, stdout);
+    return;
+  }
+
+  putchar('"');
+  for (int i = 0; i < field.length; i++) {
+    if (field.data[i] == '"')
+      putchar('"');
+    putchar(field.data[i]);
+  }
+  putchar('"');
+}
+
+/*
+ * Print movie recommendation in CSV format
+ */
+void printRecommendation(Movie *movie) {
+  printf("%d,", movie->id);
+  printCsvField(movie->title);
+  putchar(',');
+  printCsvField(movie->genre);
+  printf(",%.1f,", movie->rating);
+  printCsvField(movie->director);
+  putchar('\n');
+}
+
+/* =====================================================
+ * OUTPUT WRITER (Buffered CSV, NDJSON and Binary)
+ * ===================================================== */
+
+int initOutputWriter(OutputWriter *out, int fd, OutputFormat format) {
+  out->fd = fd;
+  out->format = format;
+  out->length = 0;
+  out->failed = 0;
+  out->buffer = (char *)malloc(OUTPUT_BUFFER_SIZE);
+  if (out->buffer == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for output buffer\n");
+    return 0;
+  }
+#ifdef _WIN32
+  /* Keep Windows from turning every \n of a binary record into \r\n */
+  if (format == OUTPUT_BINARY)
+    _setmode(fd, _O_BINARY);
+#endif
+  return 1;
+}
+
+int parseOutputFormat(const char *name, OutputFormat *format) {
+  if (strcmp(name, "csv") == 0) {
+    *format = OUTPUT_CSV;
+  } else if (strcmp(name, "ndjson") == 0) {
+    *format = OUTPUT_NDJSON;
+  } else if (strcmp(name, "binary") == 0) {
+    *format = OUTPUT_BINARY;
+  } else {
+    return 0;
+  }
+  return 1;
+}
+
+/* Write size bytes straight to the descriptor, retrying short writes */
+static void writeAll(OutputWriter *out, const char *data, size_t size) {
+  while (size > 0 && !out->failed) {
+#ifndef _WIN32
+    ssize_t written = write(out->fd, data, size);
+#else
+    int written = _write(out->fd, data,
+                         size > INT_MAX ? INT_MAX : (unsigned int)size);
+#endif
+    if (written < 0 && errno == EINTR)
+      continue;
+    if (written <= 0) {
+      fprintf(stderr, "Error: Cannot write output\n");
+      out->failed = 1;
+      return;
+    }
+    data += written;
+    size -= (size_t)written;
+  }
+}
+
+int flushOutput(OutputWriter *out) {
+  writeAll(out, out->buffer, out->length);
+  out->length = 0;
+  return !out->failed;
+}
+
+int freeOutputWriter(OutputWriter *out) {
+  int ok = out->buffer == NULL || flushOutput(out);
+  free(out->buffer);
+  out->buffer = NULL;
+  return ok;
+}
+
+/*
+ * Room for size more bytes at the end of the buffer
+ * Flushes when full; returns NULL for runs larger than the whole buffer,
+ * which go to writeAll unbuffered
+ */
+static char *outputReserve(OutputWriter *out, size_t size) {
+  if (out->length + size > OUTPUT_BUFFER_SIZE)
+    flushOutput(out);
+  if (size > OUTPUT_BUFFER_SIZE)
+    return NULL;
+  char *at = out->buffer + out->length;
+  out->length += size;
+  return at;
+}
+
+static void outputBytes(OutputWriter *out, const char *data, size_t size) {
+  char *at = outputReserve(out, size);
+  if (at == NULL) {
+    writeAll(out, data, size);
+    return;
+  }
+  memcpy(at, data, size);
+}
+
+static void outputChar(OutputWriter *out, char c) {
+  *outputReserve(out, 1) = c;
+}
+
+/* Decimal digits of value, most significant first; returns the length */
+static int formatUnsigned(char *digits, uint64_t value) {
+  char reversed[20];
+  int length = 0;
+  do {
+    reversed[length++] = (char)('0' + value % 10);
+    value /= 10;
+  } while (value != 0);
+  for (int i = 0; i < length; i++)
+    digits[i] = reversed[length - 1 - i];
+  return length;
+}
+
+static void outputInt(OutputWriter *out, int value) {
+  char text[21];
+  int length = 0;
+  uint64_t magnitude = (uint64_t)value;
+  if (value < 0) {
+    text[length++] = '-';
+    magnitude = (uint64_t)(-(int64_t)value);
+  }
+  length += formatUnsigned(text + length, magnitude);
+  outputBytes(out, text, length);
+}
+
+/*
+ * A rating with one decimal, exactly as printf("%.1f") renders it
+ * rating * 10 is exact in a double, and rint rounds halves to even as
+ * printf does, so the digits match for every finite float
+ */
+static void outputRating(OutputWriter *out, float rating) {
+  char text[48];
+  int length;
+  double tenths = rint((double)rating * 10.0);
+  if (!isfinite(rating) || fabs(tenths) >= 1e18) {
+    length = snprintf(text, sizeof(text), "%.1f", rating);
+  } else {
+    length = 0;
+    if (signbit(rating))
+      text[length++] = '-';
+    uint64_t magnitude = (uint64_t)fabs(tenths);
+    length += formatUnsigned(text + length, magnitude / 10);
+    text[length++] = '.';
+    text[length++] = (char)('0' + magnitude % 10);
+  }
+  outputBytes(out, text, length);
+}
+
+/* A CSV field, quoted like printCsvField */
+static void outputCsvField(OutputWriter *out, StringView field) {
+  int needsQuotes = 0;
+  for (int i = 0; i < field.length; i++) {
+    char c = field.data[i];
+    if (c == ',' || c == '"' || c == '\n' || c == '\r') {
+      needsQuotes = 1;
+      break;
+    }
+  }
+
+  if (!needsQuotes) {
+    outputBytes(out, field.data, field.length);
+    return;
+  }
+
+  outputChar(out, '"');
+  for (int i = 0; i < field.length; i++) {
+    if (field.data[i] == '"')
+      outputChar(out, '"');
+    outputChar(out, field.data[i]);
+  }
+  outputChar(out, '"');
+}
+
+/* A JSON string; bytes from 0x80 up pass through as UTF-8 */
+static void outputJsonString(OutputWriter *out, const char *data,
+                             size_t length) {
+  static const char hex[] = "0123456789abcdef";
+  outputChar(out, '"');
+  size_t runStart = 0;
+  for (size_t i = 0; i < length; i++) {
+    unsigned char c = (unsigned char)data[i];
+    if (c >= 0x20 && c != '"' && c != '\\')
+      continue;
+
+    outputBytes(out, data + runStart, i - runStart);
+    runStart = i + 1;
+    if (c == '"' || c == '\\') {
+      char escape[2] = {'\\', (char)c};
+      outputBytes(out, escape, 2);
+    } else if (c == '\n') {
+      outputBytes(out, "\\n", 2);
+    } else {
+      char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 15]};
+      outputBytes(out, escape, 6);
+    }
+  }
+  outputBytes(out, data + runStart, length - runStart);
+  outputChar(out, '"');
+}
+
+static void outputU32(OutputWriter *out, uint32_t value) {
+  char bytes[4] = {(char)(value & 0xFF), (char)((value >> 8) & 0xFF),
+                   (char)((value >> 16) & 0xFF), (char)(value >> 24)};
+  outputBytes(out, bytes, 4);
+}
+
+static void outputRecordHeader(OutputWriter *out, uint32_t payloadLength,
+                               OutputRecordKind kind) {
+  outputU32(out, payloadLength);
+  outputChar(out, (char)kind);
+}
+
+static void outputBinaryString(OutputWriter *out, StringView text) {
+  outputU32(out, (uint32_t)text.length);
+  outputBytes(out, text.data, text.length);
+}
+
+void writeMovie(OutputWriter *out, const Movie *movie) {
+  switch (out->format) {
+  case OUTPUT_CSV:
+    outputInt(out, movie->id);
+    outputChar(out, ',');
+    outputCsvField(out, movie->title);
+    outputChar(out, ',');
+    outputCsvField(out, movie->genre);
+    outputChar(out, ',');
+    outputRating(out, movie->rating);
+    outputChar(out, ',');
+    outputCsvField(out, movie->director);
+    outputChar(out, '\n');
+    break;
+  case OUTPUT_NDJSON:
+    outputBytes(out, "{\"id\":", 6);
+    outputInt(out, movie->id);
+    outputBytes(out, ",\"title\":", 9);
+    outputJsonString(out, movie->title.data, movie->title.length);
+    outputBytes(out, ",\"genre\":", 9);
+    outputJsonString(out, movie->genre.data, movie->genre.length);
+    outputBytes(out, ",\"rating\":", 10);
+    if (isfinite(movie->rating))
+      outputRating(out, movie->rating);
+    else
+      outputBytes(out, "null", 4);
+    outputBytes(out, ",\"director\":", 12);
+    outputJsonString(out, movie->director.data, movie->director.length);
+    outputBytes(out, "}\n", 2);
+    break;
+  case OUTPUT_BINARY: {
+    uint32_t payload = 4 + 4 + 12 + (uint32_t)movie->title.length +
+                       (uint32_t)movie->genre.length +
+                       (uint32_t)movie->director.length;
+    uint32_t ratingBits;
+    memcpy(&ratingBits, &movie->rating, sizeof(ratingBits));
+    outputRecordHeader(out, payload, OUTPUT_RECORD_MOVIE);
+    outputU32(out, (uint32_t)movie->id);
+    outputU32(out, ratingBits);
+    outputBinaryString(out, movie->title);
+    outputBinaryString(out, movie->genre);
+    outputBinaryString(out, movie->director);
+    break;
+  }
+  }
+}
+
+/*
+ * A rating's exact float value, for merges that must tie-break on it
+ * Nine significant digits read back as the same float
+ */
+static void outputExactRating(OutputWriter *out, float rating) {
+  char text[32];
+  int length = snprintf(text, sizeof(text), "%.9g", rating);
+  outputBytes(out, text, length);
+}
+
+void writeScore(OutputWriter *out, const Candidate *candidate) {
+  switch (out->format) {
+  case OUTPUT_CSV:
+    outputInt(out, candidate->movieId);
+    outputChar(out, ',');
+    outputInt(out, candidate->score);
+    outputChar(out, ',');
+    outputExactRating(out, candidate->rating);
+    outputChar(out, '\n');
+    break;
+  case OUTPUT_NDJSON:
+    outputBytes(out, "{\"id\":", 6);
+    outputInt(out, candidate->movieId);
+    outputBytes(out, ",\"score\":", 9);
+    outputInt(out, candidate->score);
+    outputBytes(out, ",\"rating\":", 10);
+    if (isfinite(candidate->rating))
+      outputExactRating(out, candidate->rating);
+    else
+      outputBytes(out, "null", 4);
+    outputBytes(out, "}\n", 2);
+    break;
+  case OUTPUT_BINARY: {
+    uint32_t ratingBits;
+    memcpy(&ratingBits, &candidate->rating, sizeof(ratingBits));
+    outputRecordHeader(out, 12, OUTPUT_RECORD_SCORE);
+    outputU32(out, (uint32_t)candidate->movieId);
+    outputU32(out, (uint32_t)candidate->score);
+    outputU32(out, ratingBits);
+    break;
+  }
+  }
+}
+
+void writeError(OutputWriter *out, const char *message) {
+  size_t length = strlen(message);
+  switch (out->format) {
+  case OUTPUT_CSV:
+    outputBytes(out, "ERROR ", 6);
+    outputBytes(out, message, length);
+    outputChar(out, '\n');
+    break;
+  case OUTPUT_NDJSON:
+    outputBytes(out, "{\"error\":", 9);
+    outputJsonString(out, message, length);
+    outputBytes(out, "}\n", 2);
+    break;
+  case OUTPUT_BINARY:
+    outputRecordHeader(out, (uint32_t)length, OUTPUT_RECORD_ERROR);
+    outputBytes(out, message, length);
+    break;
+  }
+}
+
+void writeReplyEnd(OutputWriter *out) {
+  if (out->format == OUTPUT_BINARY)
+    outputRecordHeader(out, 0, OUTPUT_RECORD_END);
+  else
+    outputChar(out, '\n');
+}
+
+/* =====================================================
+ * SNAPSHOT (Binary Graph Image)
+ * ===================================================== */
+
+/*
+ * Layout: header, then CSR offsets, targets, edge masks, movie IDs,
+ * ratings, per-node string locations, the movie ID index and finally
+ * the string bytes, each section starting on a SNAPSHOT_ALIGNMENT
+ * boundary. Every array is used in place from the mapping; strings are
+ * (offset, length) pairs rather than pointers, so loading is one mmap
+ * and a header check.
+ */
+
+static uint64_t snapshotAlign(uint64_t offset) {
+  return (offset + SNAPSHOT_ALIGNMENT - 1) &
+         ~(uint64_t)(SNAPSHOT_ALIGNMENT - 1);
+}
+
+/*
+ * Word-at-a-time FNV-1a over the payload, with a final avalanche
+ */
+static uint64_t snapshotChecksum(const unsigned char *data, size_t size) {
+  uint64_t hash = 0xcbf29ce484222325ull;
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(word));
+    hash = (hash ^ word) * 0x100000001b3ull;
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ data[i]) * 0x100000001b3ull;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdull;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static void storeSnapshotString(unsigned char *image, uint64_t *cursor,
+                                const SnapshotHeader *header, StringView text,
+                                SnapshotString *out) {
+  out->offset = *cursor;
+  out->length = (uint32_t)text.length;
+  out->reserved = 0;
+  memcpy(image + header->stringDataOffset + *cursor, text.data, text.length);
+  *cursor += text.length;
+}
+
+/*
+ * Write a snapshot of a frozen graph and its catalog
+ *
+ * Nodes keep their CSR indexes; catalog movies without any edge (and so
+ * without a node) are appended with empty rows so every movie can be
+ * looked up. The image is assembled in memory, checksummed, written to
+ * "<filename>.tmp" and renamed over filename.
+ */
+static int writeSnapshotFile(const char *filename, KnowledgeGraph *kg,
+                             HashTable *ht) {
+  if (kg->implicitEdges) {
+    fprintf(stderr, "Error: Snapshots need a graph with stored edges\n");
+    return 0;
+  }
+  if (kg->csr == NULL) {
+    freezeKnowledgeGraph(kg, ht);
+    if (kg->csr == NULL)
+      return 0;
+  }
+
+  const CsrGraph *csr = kg->csr;
+  uint64_t maxNodes = (uint64_t)csr->nodeCount + ht->count;
+  uint32_t idSlotCount = 16;
+  while (idSlotCount < 2 * maxNodes) {
+    if (idSlotCount >= (1u << 31)) {
+      fprintf(stderr, "Error: Too many movies for a snapshot\n");
+      return 0;
+    }
+    idSlotCount *= 2;
+  }
+
+  /* Movie ID index first: it tells which catalog movies lack a node */
+  NodeIdSlot *idSlots =
+      (NodeIdSlot *)malloc(idSlotCount * sizeof(NodeIdSlot));
+  int32_t *nodeMovieIds = (int32_t *)malloc(
+      (maxNodes > 0 ? maxNodes : 1) * sizeof(int32_t));
+  if (idSlots == NULL || nodeMovieIds == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for snapshot\n");
+    free(idSlots);
+    free(nodeMovieIds);
+    return 0;
+  }
+  for (uint32_t i = 0; i < idSlotCount; i++) {
+    idSlots[i].movieId = 0;
+    idSlots[i].nodeIndex = -1;
+  }
+
+  uint32_t mask = idSlotCount - 1;
+  int nodeCount = csr->nodeCount;
+  for (int i = 0; i < nodeCount; i++) {
+    nodeMovieIds[i] = csr->movieIds[i];
+    storeIdSlot(idSlots, mask, csr->movieIds[i], i);
+  }
+
+  uint64_t stringBytes = 0;
+  for (int row = 0; row < ht->count; row++) {
+    int movieId = ht->ids[row];
+    if (lookupIdSlot(idSlots, mask, movieId) < 0) {
+      nodeMovieIds[nodeCount] = movieId;
+      storeIdSlot(idSlots, mask, movieId, nodeCount);
+      nodeCount++;
+    }
+    const MovieStrings *text = &ht->strings[row];
+    stringBytes += (uint64_t)text->title.length + text->genre.length +
+                   text->director.length;
+  }
+
+  /* Lay out the sections */
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.byteOrder = SNAPSHOT_BYTE_ORDER;
+  header.headerSize = sizeof(SnapshotHeader);
+  header.nodeCount = nodeCount;
+  header.idSlotCount = idSlotCount;
+  header.edgeCount = csr->edgeCount;
+  header.stringBytes = stringBytes;
+  header.shardCount = kg->shard.count > 1 ? kg->shard.count : 0;
+  header.shardIndex = header.shardCount > 0 ? kg->shard.index : 0;
+  header.shardScheme = (uint32_t)kg->shard.scheme;
+
+  uint64_t offset = snapshotAlign(sizeof(SnapshotHeader));
+  header.offsetsOffset = offset;
+  offset = snapshotAlign(offset + ((uint64_t)nodeCount + 1) * sizeof(uint64_t));
+  header.targetsOffset = offset;
+  offset = snapshotAlign(offset + csr->edgeCount * sizeof(int32_t));
+  header.edgeMasksOffset = offset;
+  offset = snapshotAlign(offset + csr->edgeCount);
+  header.movieIdsOffset = offset;
+  offset = snapshotAlign(offset + (uint64_t)nodeCount * sizeof(int32_t));
+  header.ratingsOffset = offset;
+  offset = snapshotAlign(offset + (uint64_t)nodeCount * sizeof(float));
+  header.stringsOffset = offset;
+  offset = snapshotAlign(offset + (uint64_t)nodeCount *
+                                      sizeof(SnapshotMovieStrings));
+  header.idSlotsOffset = offset;
+  offset = snapshotAlign(offset + (uint64_t)idSlotCount *
+                                      sizeof(NodeIdSlot));
+  header.stringDataOffset = offset;
+  header.fileSize = offset + stringBytes;
+
+  /* Zeroed, so padding is deterministic and checksums are reproducible */
+  unsigned char *image = (unsigned char *)calloc(1, header.fileSize);
+  if (image == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for snapshot\n");
+    free(idSlots);
+    free(nodeMovieIds);
+    return 0;
+  }
+
+  uint64_t *offsets = (uint64_t *)(image + header.offsetsOffset);
+  int32_t *movieIds = (int32_t *)(image + header.movieIdsOffset);
+  float *ratings = (float *)(image + header.ratingsOffset);
+  SnapshotMovieStrings *strings =
+      (SnapshotMovieStrings *)(image + header.stringsOffset);
+
+  memcpy(offsets, csr->offsets, ((size_t)csr->nodeCount + 1) * sizeof(uint64_t));
+  for (int i = csr->nodeCount + 1; i <= nodeCount; i++) {
+    offsets[i] = csr->edgeCount;
+  }
+  memcpy(image + header.targetsOffset, csr->targets,
+         csr->edgeCount * sizeof(int32_t));
+  memcpy(image + header.edgeMasksOffset, csr->edgeMasks, csr->edgeCount);
+  memcpy(image + header.idSlotsOffset, idSlots,
+         idSlotCount * sizeof(NodeIdSlot));
+
+  uint64_t cursor = 0;
+  for (int i = 0; i < nodeCount; i++) {
+    int row = findMovieIndex(ht, nodeMovieIds[i]);
+    movieIds[i] = nodeMovieIds[i];
+    ratings[i] = row >= 0 ? ht->ratings[row] : NAN;
+    if (row >= 0) {
+      const MovieStrings *text = &ht->strings[row];
+      storeSnapshotString(image, &cursor, &header, text->title,
+                          &strings[i].title);
+      storeSnapshotString(image, &cursor, &header, text->genre,
+                          &strings[i].genre);
+      storeSnapshotString(image, &cursor, &header, text->director,
+                          &strings[i].director);
+    }
+  }
+  free(idSlots);
+  free(nodeMovieIds);
+
+  header.checksum = snapshotChecksum(image + header.headerSize,
+                                     header.fileSize - header.headerSize);
+  memcpy(image, &header, sizeof(header));
+
+  size_t nameLength = strlen(filename);
+  char *tempName = (char *)malloc(nameLength + 5);
+  if (tempName == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for snapshot\n");
+    free(image);
+    return 0;
+  }
+  memcpy(tempName, filename, nameLength);
+  memcpy(tempName + nameLength, ".tmp", 5);
+
+  FILE *stream = fopen(tempName, "wb");
+  if (stream == NULL) {
+    fprintf(stderr, "Error: Cannot create file %s\n", tempName);
+    free(image);
+    free(tempName);
+    return 0;
+  }
+  int written = fwrite(image, 1, header.fileSize, stream) == header.fileSize;
+  written = fclose(stream) == 0 && written;
+  free(image);
+
+#ifdef _WIN32
+  /* rename does not replace an existing file on Windows */
+  if (written)
+    remove(filename);
+#endif
+  if (!written || rename(tempName, filename) != 0) {
+    fprintf(stderr, "Error: Cannot write snapshot %s\n", filename);
+    remove(tempName);
+    free(tempName);
+    return 0;
+  }
+
+  free(tempName);
+  return 1;
+}
+
+int writeSnapshot(const char *filename, KnowledgeGraph *kg, HashTable *ht) {
+  STATS_TIMER_START(timer);
+  int written = writeSnapshotFile(filename, kg, ht);
+  STATS_TIMER_STOP(timer, STATS_SNAPSHOT_WRITE);
+  return written;
+}
+
+/*
+ * Check that a section of count elements lies inside the file
+ */
+static int snapshotSectionValid(const SnapshotHeader *header, uint64_t offset,
+                                uint64_t count, uint64_t elementSize) {
+  if (offset % SNAPSHOT_ALIGNMENT != 0 || offset < header->headerSize ||
+      offset > header->fileSize)
+    return 0;
+  return count <= (header->fileSize - offset) / elementSize;
+}
+
+static int snapshotStringValid(const SnapshotHeader *header,
+                               SnapshotString text) {
+  return text.offset <= header->stringBytes &&
+         text.length <= header->stringBytes - text.offset;
+}
+
+/*
+ * Full structural check of the adjacency and string tables
+ */
+static int snapshotContentsValid(const Snapshot *snapshot) {
+  const SnapshotHeader *header = snapshot->header;
+  const CsrGraph *csr = &snapshot->csr;
+
+  if (csr->offsets[0] != 0)
+    return 0;
+  for (int i = 0; i < csr->nodeCount; i++) {
+    if (csr->offsets[i + 1] < csr->offsets[i])
+      return 0;
+  }
+  for (uint64_t e = 0; e < csr->edgeCount; e++) {
+    if (csr->targets[e] < 0 || csr->targets[e] >= csr->nodeCount ||
+        csr->edgeMasks[e] >= EDGE_MASK_COUNT)
+      return 0;
+  }
+  for (int i = 0; i < csr->nodeCount; i++) {
+    const SnapshotMovieStrings *strings = &snapshot->strings[i];
+    if (!snapshotStringValid(header, strings->title) ||
+        !snapshotStringValid(header, strings->genre) ||
+        !snapshotStringValid(header, strings->director))
+      return 0;
+  }
+  for (uint32_t i = 0; i < header->idSlotCount; i++) {
+    if (csr->idSlots[i].nodeIndex >= csr->nodeCount)
+      return 0;
+  }
+  return 1;
+}
+
+/*
+ * Map a snapshot file read-only and point the views into it
+ */
+static int mapSnapshot(const char *filename, Snapshot *snapshot,
+                       int verifyChecksum) {
+  memset(snapshot, 0, sizeof(*snapshot));
+
+#ifndef _WIN32
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Error: Cannot open file %s\n", filename);
+    return 0;
+  }
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    void *data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      snapshot->mapping = data;
+      snapshot->mappingSize = (size_t)info.st_size;
+      snapshot->mapped = 1;
+    }
+  }
+  close(fd);
+#else
+  FILE *stream = fopen(filename, "rb");
+  if (stream == NULL) {
+    fprintf(stderr, "Error: Cannot open file %s\n", filename);
+    return 0;
+  }
+
+  fseek(stream, 0, SEEK_END);
+  long size = ftell(stream);
+  fseek(stream, 0, SEEK_SET);
+  if (size > 0) {
+    snapshot->mapping = malloc((size_t)size);
+    if (snapshot->mapping != NULL &&
+        fread(snapshot->mapping, 1, (size_t)size, stream) == (size_t)size) {
+      snapshot->mappingSize = (size_t)size;
+    } else {
+      free(snapshot->mapping);
+      snapshot->mapping = NULL;
+    }
+  }
+  fclose(stream);
+#endif
+
+  if (snapshot->mapping == NULL) {
+    fprintf(stderr, "Error: Cannot map file %s\n", filename);
+    return 0;
+  }
+
+  const unsigned char *base = (const unsigned char *)snapshot->mapping;
+  const SnapshotHeader *header = (const SnapshotHeader *)base;
+  if (snapshot->mappingSize < sizeof(SnapshotHeader) ||
+      memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 ||
+      header->byteOrder != SNAPSHOT_BYTE_ORDER) {
+    fprintf(stderr, "Error: %s is not a snapshot for this machine\n",
+            filename);
+    freeSnapshot(snapshot);
+    return 0;
+  }
+  if (header->version != SNAPSHOT_VERSION) {
+    fprintf(stderr, "Error: %s has snapshot version %u, expected %d\n",
+            filename, header->version, SNAPSHOT_VERSION);
+    freeSnapshot(snapshot);
+    return 0;
+  }
+
+  uint32_t slotCount = header->idSlotCount;
+  if (header->headerSize != sizeof(SnapshotHeader) ||
+      header->fileSize != snapshot->mappingSize || header->nodeCount < 0 ||
+      slotCount == 0 || (slotCount & (slotCount - 1)) != 0 ||
+      header->shardCount < 0 || header->shardIndex < 0 ||
+      (header->shardCount > 0 && header->shardIndex >= header->shardCount) ||
+      header->shardScheme > SHARD_BY_GENRE ||
+      !snapshotSectionValid(header, header->offsetsOffset,
+                            (uint64_t)header->nodeCount + 1,
+                            sizeof(uint64_t)) ||
+      !snapshotSectionValid(header, header->targetsOffset, header->edgeCount,
+                            sizeof(int32_t)) ||
+      !snapshotSectionValid(header, header->edgeMasksOffset,
+                            header->edgeCount, 1) ||
+      !snapshotSectionValid(header, header->movieIdsOffset, header->nodeCount,
+                            sizeof(int32_t)) ||
+      !snapshotSectionValid(header, header->ratingsOffset, header->nodeCount,
+                            sizeof(float)) ||
+      !snapshotSectionValid(header, header->stringsOffset, header->nodeCount,
+                            sizeof(SnapshotMovieStrings)) ||
+      !snapshotSectionValid(header, header->idSlotsOffset, slotCount,
+                            sizeof(NodeIdSlot)) ||
+      !snapshotSectionValid(header, header->stringDataOffset,
+                            header->stringBytes, 1)) {
+    fprintf(stderr, "Error: Snapshot %s is truncated or malformed\n",
+            filename);
+    freeSnapshot(snapshot);
+    return 0;
+  }
+
+  snapshot->header = header;
+  snapshot->csr.offsets = (const uint64_t *)(base + header->offsetsOffset);
+  snapshot->csr.targets = (const int32_t *)(base + header->targetsOffset);
+  snapshot->csr.edgeMasks = (const uint8_t *)(base + header->edgeMasksOffset);
+  snapshot->csr.movieIds = (const int32_t *)(base + header->movieIdsOffset);
+  snapshot->csr.ratings = (const float *)(base + header->ratingsOffset);
+  snapshot->csr.nodeCount = header->nodeCount;
+  snapshot->csr.edgeCount = header->edgeCount;
+  snapshot->strings =
+      (const SnapshotMovieStrings *)(base + header->stringsOffset);
+  snapshot->stringData = (const char *)(base + header->stringDataOffset);
+  snapshot->csr.idSlots = (const NodeIdSlot *)(base + header->idSlotsOffset);
+  snapshot->csr.idSlotMask = slotCount - 1;
+
+  /* The last offset is read on every query of the last node */
+  if (snapshot->csr.offsets[header->nodeCount] != header->edgeCount) {
+    fprintf(stderr, "Error: Snapshot %s is truncated or malformed\n",
+            filename);
+    freeSnapshot(snapshot);
+    return 0;
+  }
+
+  if (verifyChecksum &&
+      (snapshotChecksum(base + header->headerSize,
+                        header->fileSize - header->headerSize) !=
+           header->checksum ||
+       !snapshotContentsValid(snapshot))) {
+    fprintf(stderr, "Error: Snapshot %s failed verification\n", filename);
+    freeSnapshot(snapshot);
+    return 0;
+  }
+
+  return 1;
+}
+
+int loadSnapshot(const char *filename, Snapshot *snapshot, int verifyChecksum) {
+  STATS_TIMER_START(timer);
+  int loaded = mapSnapshot(filename, snapshot, verifyChecksum);
+  STATS_TIMER_STOP(timer, STATS_SNAPSHOT_LOAD);
+  return loaded;
+}
+
+int snapshotFindIndex(const Snapshot *snapshot, int movieId) {
+  return findGraphIndex(&snapshot->csr, movieId);
+}
+
+static StringView snapshotString(const Snapshot *snapshot,
+                                 SnapshotString text) {
+  StringView view = {snapshot->stringData + text.offset, (int)text.length};
+  return view;
+}
+
+int snapshotGetMovie(const Snapshot *snapshot, int movieId, Movie *out) {
+  int index = snapshotFindIndex(snapshot, movieId);
+  if (index < 0 || isnan(snapshot->csr.ratings[index])) {
+    return 0;
+  }
+
+  /* Snapshots carry no dictionaries: the IDs are not meaningful here */
+  const SnapshotMovieStrings *strings = &snapshot->strings[index];
+  out->id = movieId;
+  out->genreId = -1;
+  out->directorId = -1;
+  out->title = snapshotString(snapshot, strings->title);
+  out->genre = snapshotString(snapshot, strings->genre);
+  out->director = snapshotString(snapshot, strings->director);
+  out->rating = snapshot->csr.ratings[index];
+  return 1;
+}
+
+int recommendFromSnapshot(const Snapshot *snapshot, int baseMovieId,
+                          int genreWeight, int ratingWeight,
+                          int directorWeight, Candidate *results,
+                          int maxResults) {
+  int baseIndex = snapshotFindIndex(snapshot, baseMovieId);
+  if (baseIndex < 0) {
+    return 0; /* Base movie not in graph */
+  }
+
+  return recommendFromCsr(&snapshot->csr, baseIndex, genreWeight, ratingWeight,
+                          directorWeight, results, maxResults);
+}
+
+int recommendMultiHopFromSnapshot(const Snapshot *snapshot, BfsScratch *scratch,
+                                  int baseMovieId, int genreWeight,
+                                  int ratingWeight, int directorWeight,
+                                  const MultiHopOptions *options,
+                                  Candidate *results, int maxResults) {
+  int baseIndex = snapshotFindIndex(snapshot, baseMovieId);
+  if (baseIndex < 0) {
+    return 0; /* Base movie not in graph */
+  }
+
+  BfsGraph graph = csrBfsGraph(&snapshot->csr);
+  return recommendFromBfs(&graph, scratch, baseIndex, genreWeight,
+                          ratingWeight, directorWeight, options, results,
+                          maxResults);
+}
+
+int recommendBatchFromSnapshot(const Snapshot *snapshot,
+                               const BatchQuery *queries, int queryCount,
+                               int threadCount, BatchResultCallback onResult,
+                               void *context) {
+  return runBatch(snapshot, answerSnapshotQuery, queries, queryCount,
+                  threadCount, onResult, context);
+}
+
+void freeSnapshot(Snapshot *snapshot) {
+  if (snapshot->mapping != NULL) {
+#ifndef _WIN32
+    if (snapshot->mapped)
+      munmap(snapshot->mapping, snapshot->mappingSize);
+    else
+      free(snapshot->mapping);
+#else
+    free(snapshot->mapping);
+#endif
+  }
+  memset(snapshot, 0, sizeof(*snapshot));
+}
+
+/* =====================================================
+ * LIVE UPDATES (Epoch-Swapped Versions)
+ * ===================================================== */
+
+/*
+ * Each update builds the next version from the current one. The chunk
+ * directories are copied, which is O(n / LIVE_CHUNK_NODES), and a chunk
+ * is copied only when the update writes one of its entries: those of
+ * the changed movie and of its old and new neighbors. Its new edges
+ * follow the build's rules and come from the writer's attribute
+ * indexes - the movies with its genre, with its director and in the
+ * rating buckets around its rating - rather than a scan of the catalog.
+ * A neighbor that only gains the edge appends it to its row in place,
+ * in room earlier versions do not read, so an insert costs amortized
+ * O(1) per neighbor. A neighbor that loses the edge or whose mask
+ * changes has its whole row copied, because earlier versions still read
+ * it: a removal or a rating change costs the sum of its neighbors'
+ * degrees, which with dense RATING_SIMILAR edges approaches a
+ * rebuild. IDs and ratings live in storage every version shares.
+ * Unchanged rows and chunks keep pointing at the same blocks, so
+ * versions share almost all of their memory.
+ *
+ * A rating change or a removal empties the movie's node. The version
+ * it was emptied from records it, and once that version is reclaimed no
+ * reader can see a movie there, so the next insert or move reuses it
+ * instead of growing the tables. Only a movie's node is ever reused, so
+ * versions that hold it empty never read its shared ID or rating. The
+ * node count, and with it the directories every update copies, follows
+ * the peak movie count plus one node per update a pinned reader is
+ * behind. ID slots of removed movies are dropped when the slot table is
+ * next rebuilt, which happens once it is half full.
+ *
+ * Publishing swaps the current pointer under publishLock, which readers
+ * also take only to pin a version, so a reader never waits for an
+ * update to be computed. A version has exactly one successor; the
+ * blocks the successor dropped are recorded on it and freed together
+ * with it once it and every older version are unpinned.
+ */
+
+static void *liveAlloc(size_t size) {
+  void *block = malloc(size > 0 ? size : 1);
+  if (block == NULL)
+    fprintf(stderr, "Error: Memory allocation failed for live graph\n");
+  return block;
+}
+
+/* Chunks holding entries entries */
+static int liveChunkCount(uint64_t entries) {
+  return (int)((entries + LIVE_CHUNK_NODES - 1) / LIVE_CHUNK_NODES);
+}
+
+/* Blocks an update allocates, or stops using */
+typedef struct {
+  void **items;
+  int count;
+  int capacity;
+} LiveBlockList;
+
+static int pushLiveBlock(LiveBlockList *list, void *block) {
+  if (list->count == list->capacity) {
+    int newCapacity = list->capacity > 0 ? list->capacity * 2 : 64;
+    void **items = (void **)realloc(list->items, newCapacity * sizeof(void *));
+    if (items == NULL) {
+      fprintf(stderr, "Error: Memory allocation failed for live graph\n");
+      return 0;
+    }
+    list->items = items;
+    list->capacity = newCapacity;
+  }
+  list->items[list->count++] = block;
+  return 1;
+}
+
+static void freeLiveVersion(LiveVersion *version) {
+  for (int i = 0; i < version->retiredCount; i++) {
+    free(version->retired[i]);
+  }
+  free(version->retired);
+  free(version->rowChunks);
+  free(version->infoChunks);
+  free(version->slotChunks);
+  free(version);
+}
+
+/*
+ * Allocate a version with chunk directories for nodeCount nodes and
+ * slotCount ID slots; every chunk pointer starts NULL
+ */
+static LiveVersion *allocLiveVersion(int nodeCount, uint32_t slotCount) {
+  LiveVersion *version = (LiveVersion *)calloc(1, sizeof(LiveVersion));
+  if (version == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for live graph\n");
+    return NULL;
+  }
+
+  size_t chunks = nodeCount > 0 ? liveChunkCount(nodeCount) : 1;
+  version->nodeCount = nodeCount;
+  version->rowChunks = (LiveRow **)calloc(chunks, sizeof(LiveRow *));
+  version->infoChunks =
+      (LiveMovieInfo **)calloc(chunks, sizeof(LiveMovieInfo *));
+  version->slotChunks =
+      (NodeIdSlot **)calloc(liveChunkCount(slotCount), sizeof(NodeIdSlot *));
+  version->idSlotMask = slotCount - 1;
+  version->retiredNode = -1;
+  atomic_init(&version->readers, 0);
+  if (version->rowChunks == NULL || version->infoChunks == NULL ||
+      version->slotChunks == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for live graph\n");
+    freeLiveVersion(version);
+    return NULL;
+  }
+  return version;
+}
+
+/* A chunk of empty ID slots */
+static NodeIdSlot *allocSlotChunk(void) {
+  NodeIdSlot *chunk =
+      (NodeIdSlot *)liveAlloc(LIVE_CHUNK_NODES * sizeof(NodeIdSlot));
+  if (chunk == NULL)
+    return NULL;
+  for (int i = 0; i < LIVE_CHUNK_NODES; i++) {
+    chunk[i].movieId = 0;
+    chunk[i].nodeIndex = -1;
+  }
+  return chunk;
+}
+
+/* lookupIdSlot over a version's chunked slots */
+static int liveLookupSlot(const LiveVersion *version, int movieId) {
+  uint32_t mask = version->idSlotMask;
+  uint32_t slot = idSlotHome(movieId, mask);
+  for (uint32_t probe = 0; probe <= mask; probe++) {
+    const NodeIdSlot *entry = LIVE_CHUNK_ENTRY(version->slotChunks, slot);
+    if (entry->nodeIndex < 0)
+      return -1;
+    if (entry->movieId == movieId)
+      return entry->nodeIndex;
+    slot = (slot + 1) & mask;
+  }
+  return -1;
+}
+
+/*
+ * Node of movieId in version - -1 if absent or removed
+ * A removed movie's slot may name a node that is empty or, in a later
+ * version, reused; the shared ID and rating are read only once the
+ * version's own info shows a movie there
+ */
+static int liveFindNode(const LiveVersion *version, int movieId) {
+  int node = liveLookupSlot(version, movieId);
+  if (node < 0 || LIVE_CHUNK_ENTRY(version->infoChunks, node)->genreId < 0 ||
+      version->movieIds[node] != movieId || isnan(version->ratings[node]))
+    return -1;
+  return node;
+}
+
+/*
+ * One update in progress: the version it reads and the one it builds
+ * next shares chunks below the *Shared counts with current until one
+ * is written; a written chunk is copied first, the copy recorded in
+ * fresh and the shared chunk in stale
+ */
+typedef struct {
+  const LiveVersion *current;
+  LiveVersion *next;
+  int nodeChunksShared;         /* Row and info chunks */
+  int slotChunksShared;
+  LiveBlockList fresh;          /* Allocated here: freed if the update fails */
+  LiveBlockList stale;          /* Dropped by next: retired with current */
+} LiveUpdate;
+
+/* Copy of a chunk next is about to write - NULL on allocation failure */
+static void *copyLiveChunk(LiveUpdate *update, void *chunk, size_t entrySize) {
+  void *copy = liveAlloc(LIVE_CHUNK_NODES * entrySize);
+  if (copy == NULL)
+    return NULL;
+  if (!pushLiveBlock(&update->fresh, copy)) {
+    free(copy);
+    return NULL;
+  }
+  if (!pushLiveBlock(&update->stale, chunk))
+    return NULL;
+  memcpy(copy, chunk, LIVE_CHUNK_NODES * entrySize);
+  return copy;
+}
+
+static LiveRow *writableLiveRow(LiveUpdate *update, int node) {
+  int chunk = node >> LIVE_CHUNK_SHIFT;
+  LiveRow **chunks = update->next->rowChunks;
+  if (chunk < update->nodeChunksShared &&
+      chunks[chunk] == update->current->rowChunks[chunk]) {
+    LiveRow *copy = (LiveRow *)copyLiveChunk(update, chunks[chunk],
+                                             sizeof(LiveRow));
+    if (copy == NULL)
+      return NULL;
+    chunks[chunk] = copy;
+  }
+  return LIVE_CHUNK_ENTRY(chunks, node);
+}
+
+static LiveMovieInfo *writableLiveInfo(LiveUpdate *update, int node) {
+  int chunk = node >> LIVE_CHUNK_SHIFT;
+  LiveMovieInfo **chunks = update->next->infoChunks;
+  if (chunk < update->nodeChunksShared &&
+      chunks[chunk] == update->current->infoChunks[chunk]) {
+    LiveMovieInfo *copy = (LiveMovieInfo *)copyLiveChunk(
+        update, chunks[chunk], sizeof(LiveMovieInfo));
+    if (copy == NULL)
+      return NULL;
+    chunks[chunk] = copy;
+  }
+  return LIVE_CHUNK_ENTRY(chunks, node);
+}
+
+/*
+ * storeIdSlot over next's chunked slots, copying the chunk it writes
+ * Returns 0 on allocation failure
+ */
+static int storeLiveSlot(LiveUpdate *update, int movieId, int node) {
+  LiveVersion *next = update->next;
+  uint32_t mask = next->idSlotMask;
+  uint32_t slot = idSlotHome(movieId, mask);
+  const NodeIdSlot *entry;
+  while ((entry = LIVE_CHUNK_ENTRY(next->slotChunks, slot))->nodeIndex >= 0 &&
+         entry->movieId != movieId) {
+    slot = (slot + 1) & mask;
+  }
+
+  int chunk = (int)(slot >> LIVE_CHUNK_SHIFT);
+  if (chunk < update->slotChunksShared &&
+      next->slotChunks[chunk] == update->current->slotChunks[chunk]) {
+    NodeIdSlot *copy = (NodeIdSlot *)copyLiveChunk(
+        update, next->slotChunks[chunk], sizeof(NodeIdSlot));
+    if (copy == NULL)
+      return 0;
+    next->slotChunks[chunk] = copy;
+  }
+  NodeIdSlot *target = LIVE_CHUNK_ENTRY(next->slotChunks, slot);
+  if (target->nodeIndex < 0)
+    next->idSlotsUsed++;
+  target->movieId = movieId;
+  target->nodeIndex = node;
+  return 1;
+}
+
+/*
+ * Make room for one more node in list key and for nodeCount positions
+ * Returns 0 on allocation failure
+ */
+static int reserveLiveMember(LiveAttributeIndex *index, int key,
+                             int nodeCount) {
+  if (key >= index->listCount) {
+    int newCount = index->listCount > 0 ? index->listCount : 16;
+    while (newCount <= key)
+      newCount *= 2;
+    LiveMembers *lists =
+        (LiveMembers *)realloc(index->lists, newCount * sizeof(LiveMembers));
+    if (lists == NULL)
+      return 0;
+    memset(lists + index->listCount, 0,
+           (newCount - index->listCount) * sizeof(LiveMembers));
+    index->lists = lists;
+    index->listCount = newCount;
+  }
+
+  LiveMembers *list = &index->lists[key];
+  if (list->count == list->capacity) {
+    int newCapacity = list->capacity > 0 ? list->capacity * 2 : 8;
+    int32_t *nodes =
+        (int32_t *)realloc(list->nodes, newCapacity * sizeof(int32_t));
+    if (nodes == NULL)
+      return 0;
+    list->nodes = nodes;
+    list->capacity = newCapacity;
+  }
+
+  if (nodeCount > index->positionCapacity) {
+    int newCapacity = index->positionCapacity > 0 ? index->positionCapacity : 64;
+    while (newCapacity < nodeCount)
+      newCapacity *= 2;
+    int32_t *position =
+        (int32_t *)realloc(index->position, newCapacity * sizeof(int32_t));
+    if (position == NULL)
+      return 0;
+    index->position = position;
+    index->positionCapacity = newCapacity;
+  }
+  return 1;
+}
+
+/* Add node to list key, after reserveLiveMember */
+static void addLiveMember(LiveAttributeIndex *index, int key, int node) {
+  LiveMembers *list = &index->lists[key];
+  index->position[node] = list->count;
+  list->nodes[list->count++] = node;
+}
+
+static void removeLiveMember(LiveAttributeIndex *index, int key, int node) {
+  LiveMembers *list = &index->lists[key];
+  int position = index->position[node];
+  int last = list->nodes[--list->count];
+  list->nodes[position] = last;
+  index->position[last] = position;
+}
+
+static void freeLiveAttributeIndex(LiveAttributeIndex *index) {
+  for (int i = 0; i < index->listCount; i++) {
+    free(index->lists[i].nodes);
+  }
+  free(index->lists);
+  free(index->position);
+}
+
+/* Half-point step of a rating; ratings beyond +-1e6 share the end steps */
+static int ratingStep(float rating) {
+  double clamped = rating > 1e6 ? 1e6 : rating < -1e6 ? -1e6 : rating;
+  return (int)floor(clamped * 2.0);
+}
+
+/*
+ * List of a rating's step in live->byRating, added if new
+ * Returns -1 on allocation failure
+ */
+static int ratingBucketFor(LiveGraph *live, float rating) {
+  int step = ratingStep(rating);
+  int bucket = idMapFind(&live->ratingBuckets, step);
+  if (bucket >= 0)
+    return bucket;
+
+  bucket = live->ratingBucketCount;
+  if (!reserveLiveMember(&live->byRating, bucket, 0) ||
+      !idMapInsert(&live->ratingBuckets, step, bucket))
+    return -1;
+  live->ratingBucketCount++;
+  return bucket;
+}
+
+/*
+ * Reserve room to index a node with these attributes among nodeCount
+ * nodes; base nodes with no catalog entry (a NAN rating) are not
+ * indexed
+ * Returns 0 on allocation failure
+ */
+static int reserveLiveNode(LiveGraph *live, int genreId, int directorId,
+                           float rating, int nodeCount) {
+  if (isnan(rating))
+    return 1;
+  int bucket = ratingBucketFor(live, rating);
+  return bucket >= 0 &&
+         reserveLiveMember(&live->byGenre, genreId, nodeCount) &&
+         reserveLiveMember(&live->byDirector, directorId, nodeCount) &&
+         reserveLiveMember(&live->byRating, bucket, nodeCount);
+}
+
+/* Index a node, after reserveLiveNode */
+static void indexLiveNode(LiveGraph *live, int node, int genreId,
+                          int directorId, float rating) {
+  if (isnan(rating))
+    return;
+  addLiveMember(&live->byGenre, genreId, node);
+  addLiveMember(&live->byDirector, directorId, node);
+  addLiveMember(&live->byRating,
+                idMapFind(&live->ratingBuckets, ratingStep(rating)), node);
+}
+
+static void unindexLiveNode(LiveGraph *live, int node, int genreId,
+                            int directorId, float rating) {
+  removeLiveMember(&live->byGenre, genreId, node);
+  removeLiveMember(&live->byDirector, directorId, node);
+  removeLiveMember(&live->byRating,
+                   idMapFind(&live->ratingBuckets, ratingStep(rating)), node);
+}
+
+/*
+ * Intern a string for the writer, copying it first if it is new, since
+ * the movie it came from may later be updated or removed
+ */
+static int liveIntern(LiveGraph *live, StringDictionary *dict,
+                      StringView text) {
+  int id = findString(dict, text);
+  if (id >= 0)
+    return id;
+
+  char *copy = (char *)arenaAlloc(&live->spellings, text.length);
+  if (copy == NULL && text.length > 0) {
+    fprintf(stderr, "Error: Memory allocation failed for live graph\n");
+    return -1;
+  }
+  if (text.length > 0)
+    memcpy(copy, text.data, text.length);
+  StringView owned = {copy, text.length};
+  return internString(dict, owned);
+}
+
+int initLiveGraph(LiveGraph *live, const CsrGraph *base,
+                  const MovieStrings *strings) {
+  memset(live, 0, sizeof(*live));
+  int nodeCount = base->nodeCount;
+  LiveVersion *version = allocLiveVersion(nodeCount, idSlotCount(nodeCount));
+  if (version == NULL) {
+    return 0;
+  }
+
+  initStringDictionary(&live->genres);
+  initStringDictionary(&live->directors);
+  arenaInit(&live->spellings, ARENA_BLOCK_SIZE);
+  initIdMap(&live->ratingBuckets);
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_init(&live->publishLock, NULL);
+  pthread_mutex_init(&live->writerLock, NULL);
+#endif
+  live->current = version;
+  live->oldest = version;
+
+  /* From here freeLiveGraph releases whatever was allocated */
+  size_t capacity = nodeCount > 0 ? nodeCount : 1;
+  live->movieIds = (int32_t *)liveAlloc(capacity * sizeof(int32_t));
+  live->ratings = (float *)liveAlloc(capacity * sizeof(float));
+  live->storageCapacity = (int)capacity;
+  int ok = live->movieIds != NULL && live->ratings != NULL;
+  for (int c = 0; ok && c < liveChunkCount(nodeCount); c++) {
+    version->rowChunks[c] =
+        (LiveRow *)calloc(LIVE_CHUNK_NODES, sizeof(LiveRow));
+    version->infoChunks[c] =
+        (LiveMovieInfo *)calloc(LIVE_CHUNK_NODES, sizeof(LiveMovieInfo));
+    ok = version->rowChunks[c] != NULL && version->infoChunks[c] != NULL;
+  }
+  for (int c = 0; ok && c < liveChunkCount(version->idSlotMask + 1); c++) {
+    version->slotChunks[c] = allocSlotChunk();
+    ok = version->slotChunks[c] != NULL;
+  }
+  if (!ok) {
+    fprintf(stderr, "Error: Memory allocation failed for live graph\n");
+    freeLiveGraph(live);
+    return 0;
+  }
+  if (nodeCount > 0) {
+    memcpy(live->movieIds, base->movieIds, nodeCount * sizeof(int32_t));
+    memcpy(live->ratings, base->ratings, nodeCount * sizeof(float));
+  }
+  version->movieIds = live->movieIds;
+  version->ratings = live->ratings;
+
+  /* Every chunk is new, so nothing is copied on write */
+  LiveUpdate update;
+  memset(&update, 0, sizeof(update));
+  update.next = version;
+
+  for (int i = 0; i < nodeCount; i++) {
+    uint64_t begin = base->offsets[i];
+    LiveRow *row = LIVE_CHUNK_ENTRY(version->rowChunks, i);
+    row->targets = base->targets + begin;
+    row->edgeMasks = base->edgeMasks + begin;
+    row->degree = (uint32_t)(base->offsets[i + 1] - begin);
+    row->capacity = row->degree;
+    row->block = NULL;
+
+    /* Base strings outlive the live graph, so they are interned as is */
+    LiveMovieInfo *info = LIVE_CHUNK_ENTRY(version->infoChunks, i);
+    info->strings = strings[i];
+    info->genreId = internString(&live->genres, strings[i].genre);
+    info->directorId = internString(&live->directors, strings[i].director);
+    info->block = NULL;
+    if (info->genreId < 0 || info->directorId < 0 ||
+        !reserveLiveNode(live, info->genreId, info->directorId,
+                         base->ratings[i], nodeCount) ||
+        !storeLiveSlot(&update, base->movieIds[i], i)) {
+      freeLiveGraph(live);
+      return 0;
+    }
+    indexLiveNode(live, i, info->genreId, info->directorId, base->ratings[i]);
+  }
+  return 1;
+}
+
+const LiveVersion *liveAcquire(LiveGraph *live) {
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_lock(&live->publishLock);
+#endif
+  LiveVersion *version = live->current;
+  atomic_fetch_add(&version->readers, 1);
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_unlock(&live->publishLock);
+#endif
+  return version;
+}
+
+void liveRelease(const LiveVersion *version) {
+  atomic_fetch_sub(&((LiveVersion *)version)->readers, 1);
+}
+
+/*
+ * Free retired versions from the oldest while nobody pins them
+ * The node each one was the last to hold a movie at becomes free; room
+ * for it was reserved when it was emptied
+ */
+static void liveReclaim(LiveGraph *live) {
+  while (live->oldest != live->current &&
+         atomic_load(&live->oldest->readers) == 0) {
+    LiveVersion *version = live->oldest;
+    live->oldest = version->newer;
+    if (version->retiredNode >= 0)
+      live->freeNodes[live->freeNodeCount++] = version->retiredNode;
+    freeLiveVersion(version);
+  }
+}
+
+/* One neighbor entry while an update is computed */
+typedef struct {
+  int32_t target;
+  uint8_t mask;
+} LiveEdge;
+
+static int compareLiveEdge(const void *a, const void *b) {
+  int32_t ta = ((const LiveEdge *)a)->target;
+  int32_t tb = ((const LiveEdge *)b)->target;
+  return (ta > tb) - (ta < tb);
+}
+
+/*
+ * Neighbors, sorted by node, that a movie with these attributes has
+ * among the current version's movies other than skip: the build's
+ * rules, answered from the attribute indexes
+ * Returns the count, or -1 on allocation failure
+ */
+static int findLiveNeighbors(const LiveGraph *live, int genreId,
+                             int directorId, float rating, int skip,
+                             LiveEdge **edges) {
+  const LiveMembers *genre = genreId < live->byGenre.listCount
+                                 ? &live->byGenre.lists[genreId]
+                                 : NULL;
+  const LiveMembers *director = directorId < live->byDirector.listCount
+                                    ? &live->byDirector.lists[directorId]
+                                    : NULL;
+
+  /* Steps two either side cover every rating within 0.5 after rounding */
+  int buckets[5], bucketCount = 0;
+  int step = ratingStep(rating);
+  for (int s = step - 2; s <= step + 2; s++) {
+    int bucket = idMapFind(&live->ratingBuckets, s);
+    if (bucket >= 0)
+      buckets[bucketCount++] = bucket;
+  }
+
+  size_t limit = (genre != NULL ? genre->count : 0) +
+                 (director != NULL ? director->count : 0);
+  for (int b = 0; b < bucketCount; b++)
+    limit += live->byRating.lists[buckets[b]].count;
+
+  LiveEdge *found = (LiveEdge *)liveAlloc(limit * sizeof(LiveEdge));
+  if (found == NULL)
+    return -1;
+  size_t count = 0;
+  for (int i = 0; genre != NULL && i < genre->count; i++) {
+    found[count].target = genre->nodes[i];
+    found[count++].mask = EDGE_MASK(GENRE_SIMILAR);
+  }
+  for (int i = 0; director != NULL && i < director->count; i++) {
+    found[count].target = director->nodes[i];
+    found[count++].mask = EDGE_MASK(DIRECTOR_SIMILAR);
+  }
+  for (int b = 0; b < bucketCount; b++) {
+    const LiveMembers *list = &live->byRating.lists[buckets[b]];
+    for (int i = 0; i < list->count; i++) {
+      int target = list->nodes[i];
+      if (!(fabs(live->ratings[target] - rating) > 0.5)) {
+        found[count].target = target;
+        found[count++].mask = EDGE_MASK(RATING_SIMILAR);
+      }
+    }
+  }
+
+  /* One entry per node, with the masks of every list it was in */
+  qsort(found, count, sizeof(LiveEdge), compareLiveEdge);
+  int merged = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (found[i].target == skip)
+      continue;
+    if (merged > 0 && found[merged - 1].target == found[i].target)
+      found[merged - 1].mask |= found[i].mask;
+    else
+      found[merged++] = found[i];
+  }
+  *edges = found;
+  return merged;
+}
+
+/*
+ * Allocate a row block with room for capacity entries, count of them
+ * in use
+ */
+static void *allocLiveRow(LiveRow *row, uint32_t count, uint32_t capacity) {
+  void *block =
+      liveAlloc((size_t)capacity * (sizeof(int32_t) + sizeof(uint8_t)));
+  if (block == NULL)
+    return NULL;
+  row->targets = (const int32_t *)block;
+  row->edgeMasks = (const uint8_t *)((int32_t *)block + capacity);
+  row->degree = count;
+  row->capacity = capacity;
+  row->block = block;
+  return block;
+}
+
+/*
+ * Add (node, mask) to a row that does not hold node, in place when its
+ * block has room; versions sharing the block read only up to their own
+ * degree, so they do not see it
+ * Returns 0 when the row must be rewritten instead
+ */
+static int appendLiveRow(LiveRow *row, int node, uint8_t mask) {
+  if (row->block == NULL || row->degree == row->capacity)
+    return 0;
+  ((int32_t *)row->targets)[row->degree] = node;
+  ((uint8_t *)row->edgeMasks)[row->degree] = mask;
+  row->degree++;
+  return 1;
+}
+
+/*
+ * Copy of row without dropNode, plus (addNode, mask) when mask is
+ * non-zero. A row that grows gets a quarter more room, so the appends
+ * that follow copy it only once per degree / 4 of them
+ */
+static int rewriteLiveRow(LiveRow *row, int dropNode, int addNode,
+                          uint8_t mask) {
+  LiveRow old = *row;
+  uint32_t count = 0;
+  for (uint32_t e = 0; e < old.degree; e++) {
+    if (old.targets[e] != dropNode)
+      count++;
+  }
+  if (mask != 0)
+    count++;
+
+  uint32_t capacity = count > old.degree ? count + count / 4 + 1 : count;
+  if (allocLiveRow(row, count, capacity) == NULL) {
+    *row = old;
+    return 0;
+  }
+
+  int32_t *targets = (int32_t *)row->targets;
+  uint8_t *edgeMasks = (uint8_t *)row->edgeMasks;
+  uint32_t position = 0;
+  for (uint32_t e = 0; e < old.degree; e++) {
+    if (old.targets[e] != dropNode) {
+      targets[position] = old.targets[e];
+      edgeMasks[position++] = old.edgeMasks[e];
+    }
+  }
+  if (mask != 0) {
+    targets[position] = addNode;
+    edgeMasks[position] = mask;
+  }
+  return 1;
+}
+
+/*
+ * Leave node with an empty row and no movie in next, retiring its blocks
+ * Returns 0 on allocation failure
+ */
+static int clearLiveNode(LiveUpdate *update, int node) {
+  LiveRow *row = writableLiveRow(update, node);
+  LiveMovieInfo *info = writableLiveInfo(update, node);
+  if (row == NULL || info == NULL ||
+      (row->block != NULL && !pushLiveBlock(&update->stale, row->block)) ||
+      (info->block != NULL && !pushLiveBlock(&update->stale, info->block)))
+    return 0;
+  memset(row, 0, sizeof(*row));
+  memset(info, 0, sizeof(*info));
+  info->genreId = -1;
+  return 1;
+}
+
+/*
+ * Start next's chunk directories from current's, adding new chunks for
+ * nodes past the current ones; with rebuildSlots the ID slots are
+ * rebuilt at next's size, keeping only current's movies
+ * Returns 0 on allocation failure
+ */
+static int startLiveUpdate(LiveUpdate *update, const LiveVersion *current,
+                           LiveVersion *next, int rebuildSlots) {
+  update->current = current;
+  update->next = next;
+  update->nodeChunksShared = liveChunkCount(current->nodeCount);
+  memcpy(next->rowChunks, current->rowChunks,
+         update->nodeChunksShared * sizeof(LiveRow *));
+  memcpy(next->infoChunks, current->infoChunks,
+         update->nodeChunksShared * sizeof(LiveMovieInfo *));
+  for (int c = update->nodeChunksShared; c < liveChunkCount(next->nodeCount);
+       c++) {
+    next->rowChunks[c] = (LiveRow *)calloc(LIVE_CHUNK_NODES, sizeof(LiveRow));
+    if (next->rowChunks[c] == NULL ||
+        !pushLiveBlock(&update->fresh, next->rowChunks[c])) {
+      free(next->rowChunks[c]);
+      return 0;
+    }
+    next->infoChunks[c] =
+        (LiveMovieInfo *)calloc(LIVE_CHUNK_NODES, sizeof(LiveMovieInfo));
+    if (next->infoChunks[c] == NULL ||
+        !pushLiveBlock(&update->fresh, next->infoChunks[c])) {
+      free(next->infoChunks[c]);
+      return 0;
+    }
+  }
+
+  int slotChunks = liveChunkCount(current->idSlotMask + 1);
+  if (!rebuildSlots) {
+    memcpy(next->slotChunks, current->slotChunks,
+           slotChunks * sizeof(NodeIdSlot *));
+    update->slotChunksShared = slotChunks;
+    next->idSlotsUsed = current->idSlotsUsed;
+    return 1;
+  }
+
+  /* Every slot moves, into new chunks; removed movies' slots are left */
+  update->slotChunksShared = 0;
+  for (int c = 0; c < liveChunkCount(next->idSlotMask + 1); c++) {
+    next->slotChunks[c] = allocSlotChunk();
+    if (next->slotChunks[c] == NULL ||
+        !pushLiveBlock(&update->fresh, next->slotChunks[c])) {
+      free(next->slotChunks[c]);
+      return 0;
+    }
+  }
+  for (uint32_t i = 0; i <= current->idSlotMask; i++) {
+    const NodeIdSlot *entry = LIVE_CHUNK_ENTRY(current->slotChunks, i);
+    if (entry->nodeIndex >= 0 &&
+        liveFindNode(current, entry->movieId) == entry->nodeIndex &&
+        !storeLiveSlot(update, entry->movieId, entry->nodeIndex))
+      return 0;
+  }
+  for (int c = 0; c < slotChunks; c++) {
+    if (!pushLiveBlock(&update->stale, current->slotChunks[c]))
+      return 0;
+  }
+  return 1;
+}
+
+typedef enum { LIVE_INSERT, LIVE_UPDATE, LIVE_REMOVE } LiveOperation;
+
+/*
+ * Apply one change and publish the resulting version
+ * movie is NULL for LIVE_REMOVE
+ */
+static int liveApply(LiveGraph *live, LiveOperation operation, int movieId,
+                     const Movie *movie) {
+  /* A NAN rating marks a node with no movie; the loader skips inf too */
+  if (movie != NULL && !isfinite(movie->rating)) {
+    return 0;
+  }
+
+  LiveVersion *current = live->current;
+  int oldNode = liveFindNode(current, movieId);
+  int exists = oldNode >= 0;
+  if (exists != (operation != LIVE_INSERT)) {
+    return 0;
+  }
+
+  /*
+   * Ratings are shared by every version, so a movie whose rating
+   * changes, like a new one or a removed ID that comes back, gets
+   * another node: a free one if there is one, else one past the end.
+   * Its old node keeps the old rating for older versions and is empty
+   * from next on
+   */
+  int moved = exists && movie != NULL &&
+              memcmp(&movie->rating, &current->ratings[oldNode],
+                     sizeof(float)) != 0;
+  int emptied = exists && (moved || movie == NULL);
+  int reused = (!exists || moved) && live->freeNodeCount > 0;
+  int node = exists && !moved ? oldNode
+             : reused         ? live->freeNodes[live->freeNodeCount - 1]
+                              : current->nodeCount;
+  int nodeCount = current->nodeCount + (node == current->nodeCount);
+  int deadNodeCount = current->deadNodeCount + emptied - reused;
+
+  /* Room to free every dead node, so liveReclaim never allocates */
+  if (deadNodeCount > live->freeNodeCapacity) {
+    int newCapacity = live->freeNodeCapacity > 0 ? live->freeNodeCapacity * 2 : 64;
+    int32_t *freeNodes =
+        (int32_t *)realloc(live->freeNodes, newCapacity * sizeof(int32_t));
+    if (freeNodes == NULL) {
+      fprintf(stderr, "Error: Memory allocation failed for live graph\n");
+      return -1;
+    }
+    live->freeNodes = freeNodes;
+    live->freeNodeCapacity = newCapacity;
+  }
+
+  /*
+   * Keep the ID slots at most half full; a rebuild sizes them for half
+   * again the current movies, so it is needed again only after that
+   * many new IDs
+   */
+  uint32_t slotCount = current->idSlotMask + 1;
+  int rebuildSlots = current->idSlotsUsed + 1 > slotCount / 2;
+  if (rebuildSlots) {
+    int movies = nodeCount - deadNodeCount;
+    slotCount = idSlotCount(movies + movies / 2 + 1);
+  }
+
+  int genreId = -1, directorId = -1;
+  if (movie != NULL) {
+    genreId = liveIntern(live, &live->genres, movie->genre);
+    directorId = liveIntern(live, &live->directors, movie->director);
+    if (genreId < 0 || directorId < 0 ||
+        !reserveLiveNode(live, genreId, directorId, movie->rating,
+                         nodeCount))
+      return -1;
+  }
+
+  LiveVersion *next = allocLiveVersion(nodeCount, slotCount);
+  LiveUpdate update;
+  LiveEdge *oldEdges = NULL, *newEdges = NULL;
+  int32_t *movieIds = live->movieIds;
+  float *ratings = live->ratings;
+  int storageCapacity = live->storageCapacity;
+  memset(&update, 0, sizeof(update));
+  if (next == NULL)
+    return -1;
+  if (!startLiveUpdate(&update, current, next, rebuildSlots))
+    goto fail;
+
+  /* Grow the shared storage; older versions keep reading the old one */
+  if (nodeCount > storageCapacity) {
+    storageCapacity *= 2;
+    movieIds = (int32_t *)liveAlloc(storageCapacity * sizeof(int32_t));
+    if (movieIds == NULL || !pushLiveBlock(&update.fresh, movieIds)) {
+      free(movieIds);
+      goto fail;
+    }
+    ratings = (float *)liveAlloc(storageCapacity * sizeof(float));
+    if (ratings == NULL || !pushLiveBlock(&update.fresh, ratings)) {
+      free(ratings);
+      goto fail;
+    }
+    memcpy(movieIds, live->movieIds, current->nodeCount * sizeof(int32_t));
+    memcpy(ratings, live->ratings, current->nodeCount * sizeof(float));
+    if (!pushLiveBlock(&update.stale, live->movieIds) ||
+        !pushLiveBlock(&update.stale, live->ratings))
+      goto fail;
+  }
+  /*
+   * Past every published version's nodes, or free: either way no
+   * version a reader can pin holds a movie there
+   */
+  if (node != oldNode) {
+    movieIds[node] = movieId;
+    ratings[node] = movie != NULL ? movie->rating : NAN;
+  }
+  next->movieIds = movieIds;
+  next->ratings = ratings;
+  next->epoch = current->epoch + 1;
+  next->deadNodeCount = deadNodeCount;
+
+  /* Old neighbors, by node */
+  LiveRow oldRow = {NULL, NULL, 0, 0, NULL};
+  if (exists)
+    oldRow = *LIVE_CHUNK_ENTRY(current->rowChunks, oldNode);
+  oldEdges = (LiveEdge *)liveAlloc(oldRow.degree * sizeof(LiveEdge));
+  if (oldEdges == NULL)
+    goto fail;
+  for (uint32_t e = 0; e < oldRow.degree; e++) {
+    oldEdges[e].target = oldRow.targets[e];
+    oldEdges[e].mask = oldRow.edgeMasks[e];
+  }
+  qsort(oldEdges, oldRow.degree, sizeof(LiveEdge), compareLiveEdge);
+
+  /* New neighbors, from the attribute indexes */
+  int newCount = 0;
+  if (movie != NULL) {
+    newCount = findLiveNeighbors(live, genreId, directorId, movie->rating,
+                                 oldNode, &newEdges);
+    if (newCount < 0)
+      goto fail;
+  }
+
+  /*
+   * Patch each neighbor that gains, loses or changes its edge to node.
+   * Edges are symmetric, so a neighbor's row holds the old node exactly
+   * when the neighbor is in oldEdges, with the same mask. One that only
+   * gains the edge appends it; dropping or changing an entry copies the
+   * row, since earlier versions still read it
+   */
+  int dropNode = exists ? oldNode : node;
+  int o = 0, n = 0;
+  while (o < (int)oldRow.degree || n < newCount) {
+    int target;
+    uint8_t mask = 0, oldMask = 0;
+    if (n >= newCount ||
+        (o < (int)oldRow.degree && oldEdges[o].target < newEdges[n].target)) {
+      target = oldEdges[o].target;
+      oldMask = oldEdges[o++].mask;
+    } else {
+      target = newEdges[n].target;
+      mask = newEdges[n++].mask;
+      if (o < (int)oldRow.degree && oldEdges[o].target == target)
+        oldMask = oldEdges[o++].mask;
+    }
+
+    if (target == node || (!moved && oldMask == mask))
+      continue;
+    LiveRow *row = writableLiveRow(&update, target);
+    if (row == NULL)
+      goto fail;
+    if (oldMask == 0 && appendLiveRow(row, node, mask))
+      continue;
+    void *dropped = row->block;
+    if (!rewriteLiveRow(row, dropNode, node, mask))
+      goto fail;
+    if (!pushLiveBlock(&update.fresh, row->block)) {
+      free(row->block);
+      goto fail;
+    }
+    if (dropped != NULL && !pushLiveBlock(&update.stale, dropped))
+      goto fail;
+  }
+
+  /* The changed movie's own row and attributes */
+  if (exists && !clearLiveNode(&update, oldNode))
+    goto fail;
+  if (movie != NULL) {
+    LiveRow *row = writableLiveRow(&update, node);
+    if (row == NULL || allocLiveRow(row, newCount, newCount) == NULL)
+      goto fail;
+    if (!pushLiveBlock(&update.fresh, row->block)) {
+      free(row->block);
+      goto fail;
+    }
+    for (int i = 0; i < newCount; i++) {
+      ((int32_t *)row->targets)[i] = newEdges[i].target;
+      ((uint8_t *)row->edgeMasks)[i] = newEdges[i].mask;
+    }
+
+    size_t bytes = (size_t)movie->title.length + movie->genre.length +
+                   movie->director.length;
+    LiveMovieInfo *info = writableLiveInfo(&update, node);
+    char *text = (char *)liveAlloc(bytes);
+    if (info == NULL || text == NULL || !pushLiveBlock(&update.fresh, text)) {
+      free(text);
+      goto fail;
+    }
+    memcpy(text, movie->title.data, movie->title.length);
+    memcpy(text + movie->title.length, movie->genre.data, movie->genre.length);
+    memcpy(text + movie->title.length + movie->genre.length,
+           movie->director.data, movie->director.length);
+    info->strings.title = (StringView){text, movie->title.length};
+    info->strings.genre =
+        (StringView){text + movie->title.length, movie->genre.length};
+    info->strings.director =
+        (StringView){text + movie->title.length + movie->genre.length,
+                     movie->director.length};
+    info->genreId = genreId;
+    info->directorId = directorId;
+    info->block = text;
+  }
+  if (node != oldNode && !storeLiveSlot(&update, movieId, node))
+    goto fail;
+
+  free(oldEdges);
+  free(newEdges);
+  free(update.fresh.items);
+
+  /* The writer's indexes follow next; their room was reserved above */
+  if (exists) {
+    const LiveMovieInfo *old = LIVE_CHUNK_ENTRY(current->infoChunks, oldNode);
+    unindexLiveNode(live, oldNode, old->genreId, old->directorId,
+                    current->ratings[oldNode]);
+  }
+  if (movie != NULL)
+    indexLiveNode(live, node, genreId, directorId, movie->rating);
+  if (reused)
+    live->freeNodeCount--;
+  live->movieIds = movieIds;
+  live->ratings = ratings;
+  live->storageCapacity = storageCapacity;
+
+  /* Publish, then free whatever no reader can still see */
+  current->retired = update.stale.items;
+  current->retiredCount = update.stale.count;
+  current->retiredNode = emptied ? oldNode : -1;
+  current->newer = next;
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_lock(&live->publishLock);
+#endif
+  live->current = next;
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_unlock(&live->publishLock);
+#endif
+  liveReclaim(live);
+  return 1;
+
+fail:
+  for (int i = 0; i < update.fresh.count; i++) {
+    free(update.fresh.items[i]);
+  }
+  free(oldEdges);
+  free(newEdges);
+  free(update.fresh.items);
+  free(update.stale.items);
+  freeLiveVersion(next);
+  return -1;
+}
+
+/*
+ * Serialize writers around liveApply
+ * Returns 1 on success, 0 for a precondition miss, -1 on allocation
+ * failure (the current version is unchanged)
+ */
+static int liveWrite(LiveGraph *live, LiveOperation operation, int movieId,
+                     const Movie *movie) {
+  STATS_TIMER_START(timer);
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_lock(&live->writerLock);
+#endif
+  int status = liveApply(live, operation, movieId, movie);
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_unlock(&live->writerLock);
+#endif
+  STATS_TIMER_STOP(timer, STATS_UPDATE);
+  return status;
+}
+
+int liveInsertMovie(LiveGraph *live, const Movie *movie) {
+  return liveWrite(live, LIVE_INSERT, movie->id, movie) == 1;
+}
+
+int liveUpdateMovie(LiveGraph *live, const Movie *movie) {
+  return liveWrite(live, LIVE_UPDATE, movie->id, movie) == 1;
+}
+
+int liveRemoveMovie(LiveGraph *live, int movieId) {
+  return liveWrite(live, LIVE_REMOVE, movieId, NULL) == 1;
+}
+
+int liveGetMovie(const LiveVersion *version, int movieId, Movie *out) {
+  int node = liveFindNode(version, movieId);
+  if (node < 0) {
+    return 0;
+  }
+
+  const LiveMovieInfo *info = LIVE_CHUNK_ENTRY(version->infoChunks, node);
+  out->id = movieId;
+  out->genreId = info->genreId;
+  out->directorId = info->directorId;
+  out->rating = version->ratings[node];
+  out->title = info->strings.title;
+  out->genre = info->strings.genre;
+  out->director = info->strings.director;
+  return 1;
+}
+
+int recommendFromLive(const LiveVersion *version, int baseMovieId,
+                      int genreWeight, int ratingWeight, int directorWeight,
+                      Candidate *results, int maxResults) {
+  int node = liveFindNode(version, baseMovieId);
+  if (node < 0) {
+    return 0; /* Base movie not in graph */
+  }
+
+  const LiveRow *row = LIVE_CHUNK_ENTRY(version->rowChunks, node);
+  return scoreNeighbors(row->targets, row->edgeMasks, row->degree, node,
+                        version->movieIds, version->ratings, genreWeight,
+                        ratingWeight, directorWeight, results, maxResults);
+}
+
+int recommendMultiHopFromLive(const LiveVersion *version, BfsScratch *scratch,
+                              int baseMovieId, int genreWeight,
+                              int ratingWeight, int directorWeight,
+                              const MultiHopOptions *options,
+                              Candidate *results, int maxResults) {
+  int node = liveFindNode(version, baseMovieId);
+  if (node < 0) {
+    return 0; /* Base movie not in graph */
+  }
+
+  BfsGraph graph = {NULL, NULL, NULL, version->rowChunks, version->movieIds,
+                    version->ratings, version->nodeCount};
+  return recommendFromBfs(&graph, scratch, node, genreWeight, ratingWeight,
+                          directorWeight, options, results, maxResults);
+}
+
+void freeLiveGraph(LiveGraph *live) {
+  if (live->current == NULL) {
+    return;
+  }
+
+  /* Blocks and chunks the current version uses were never retired */
+  LiveVersion *current = live->current;
+  int nodeChunks = liveChunkCount(current->nodeCount);
+  for (int c = 0; c < nodeChunks; c++) {
+    for (int i = 0; i < LIVE_CHUNK_NODES; i++) {
+      if (current->rowChunks[c] != NULL)
+        free(current->rowChunks[c][i].block);
+      if (current->infoChunks[c] != NULL)
+        free(current->infoChunks[c][i].block);
+    }
+    free(current->rowChunks[c]);
+    free(current->infoChunks[c]);
+  }
+  for (int c = 0; c < liveChunkCount(current->idSlotMask + 1); c++) {
+    free(current->slotChunks[c]);
+  }
+  free(live->movieIds);
+  free(live->ratings);
+
+  LiveVersion *version = live->oldest;
+  while (version != NULL) {
+    LiveVersion *newer = version->newer;
+    freeLiveVersion(version);
+    version = newer;
+  }
+
+#ifdef RECOMMENDER_THREADS
+  pthread_mutex_destroy(&live->publishLock);
+  pthread_mutex_destroy(&live->writerLock);
+#endif
+  freeStringDictionary(&live->genres);
+  freeStringDictionary(&live->directors);
+  arenaFree(&live->spellings);
+  freeLiveAttributeIndex(&live->byGenre);
+  freeLiveAttributeIndex(&live->byDirector);
+  freeLiveAttributeIndex(&live->byRating);
+  freeIdMap(&live->ratingBuckets);
+  free(live->freeNodes);
+  memset(live, 0, sizeof(*live));
+}
+
+/* =====================================================
+ * STATISTICS REPORT
+ * ===================================================== */
+
+#ifdef RECOMMENDER_STATS
+#define STATS_DEGREE_BUCKETS 33 /* 0, then [2^k, 2^(k+1)) up to 2^32 */
+
+static const char *const statsPhaseNames[STATS_PHASE_COUNT] = {
+    "load",          "build", "freeze", "snapshot_load",
+    "snapshot_write", "query", "batch",  "update"};
+
+/* Edge and degree totals of one graph */
+typedef struct {
+  uint64_t nodes;
+  uint64_t neighborEntries;
+  uint64_t edgesByType[3];
+  uint64_t degreeBuckets[STATS_DEGREE_BUCKETS];
+} GraphSummary;
+
+static void summarizeRow(GraphSummary *summary, const uint8_t *edgeMasks,
+                         uint64_t degree) {
+  int bucket = 0;
+  while (bucket + 1 < STATS_DEGREE_BUCKETS && (degree >> bucket) != 0)
+    bucket++;
+  summary->degreeBuckets[bucket]++;
+  summary->nodes++;
+  summary->neighborEntries += degree;
+
+  for (uint64_t e = 0; e < degree; e++) {
+    summary->edgesByType[GENRE_SIMILAR] +=
+        (edgeMasks[e] >> GENRE_SIMILAR) & 1;
+    summary->edgesByType[RATING_SIMILAR] +=
+        (edgeMasks[e] >> RATING_SIMILAR) & 1;
+    summary->edgesByType[DIRECTOR_SIMILAR] +=
+        (edgeMasks[e] >> DIRECTOR_SIMILAR) & 1;
+  }
+}
+
+void printRecommenderStats(FILE *out, const CsrGraph *csr,
+                           const LiveVersion *live) {
+  for (int phase = 0; phase < STATS_PHASE_COUNT; phase++) {
+    fprintf(out, "%s_calls,%llu\n", statsPhaseNames[phase],
+            (unsigned long long)atomic_load(&recommenderStats.phaseCalls[phase]));
+    fprintf(out, "%s_ns,%llu\n", statsPhaseNames[phase],
+            (unsigned long long)atomic_load(&recommenderStats.phaseNanos[phase]));
+  }
+  fprintf(out, "batch_queries,%llu\n",
+          (unsigned long long)atomic_load(&recommenderStats.batchQueries));
+  fprintf(out, "candidates_scanned,%llu\n",
+          (unsigned long long)atomic_load(&recommenderStats.candidatesScanned));
+  fprintf(out, "arena_bytes,%lld\n",
+          (long long)atomic_load(&recommenderStats.arenaBytes));
+  fprintf(out, "scoring_kernel,%s\n", scoringKernelName());
+
+  GraphSummary summary;
+  memset(&summary, 0, sizeof(summary));
+  if (csr != NULL) {
+    for (int i = 0; i < csr->nodeCount; i++) {
+      summarizeRow(&summary, csr->edgeMasks + csr->offsets[i],
+                   csr->offsets[i + 1] - csr->offsets[i]);
+    }
+  } else if (live != NULL) {
+    for (int i = 0; i < live->nodeCount; i++) {
+      /* An empty node may be in reuse, so its rating is not read */
+      const LiveRow *row = LIVE_CHUNK_ENTRY(live->rowChunks, i);
+      if (LIVE_CHUNK_ENTRY(live->infoChunks, i)->genreId >= 0 &&
+          !isnan(live->ratings[i]))
+        summarizeRow(&summary, row->edgeMasks, row->degree);
+    }
+  } else {
+    return;
+  }
+
+  fprintf(out, "nodes,%llu\n", (unsigned long long)summary.nodes);
+  if (csr == NULL)
+    fprintf(out, "dead_nodes,%d\n", live->deadNodeCount);
+  fprintf(out, "neighbor_entries,%llu\n",
+          (unsigned long long)summary.neighborEntries);
+  fprintf(out, "edges_genre,%llu\n",
+          (unsigned long long)summary.edgesByType[GENRE_SIMILAR]);
+  fprintf(out, "edges_rating,%llu\n",
+          (unsigned long long)summary.edgesByType[RATING_SIMILAR]);
+  fprintf(out, "edges_director,%llu\n",
+          (unsigned long long)summary.edgesByType[DIRECTOR_SIMILAR]);
+
+  /* Only buckets that hold nodes: degree_<lo>_<hi> counts lo..hi */
+  for (int bucket = 0; bucket < STATS_DEGREE_BUCKETS; bucket++) {
+    if (summary.degreeBuckets[bucket] == 0)
+      continue;
+    uint64_t lo = bucket == 0 ? 0 : 1ull << (bucket - 1);
+    uint64_t hi = bucket == 0 ? 0 : (1ull << bucket) - 1;
+    fprintf(out, "degree_%llu_%llu,%llu\n", (unsigned long long)lo,
+            (unsigned long long)hi,
+            (unsigned long long)summary.degreeBuckets[bucket]);
+  }
+}
+#endif
+
+/*
+ * Everything below is the command line program
+ * Define RECOMMENDER_NO_MAIN to link the engine into another program
+ */
+#ifndef RECOMMENDER_NO_MAIN
+
+/* =====================================================
+ * SERVER MODE (Persistent Daemon)
+ * ===================================================== */
+
+/*
+ * What the command line program queries: a catalog with its graph, or
+ * a mapped snapshot. The first update in server mode moves queries to a
+ * live graph over either one.
+ */
+typedef struct {
+  HashTable ht;
+  KnowledgeGraph kg;
+  Snapshot snapshot;
+  int useSnapshot;
+  LiveGraph live;
+  int useLive;
+  MovieStrings *liveStrings;    /* Base strings by node for a snapshot */
+  const LiveVersion *pinned;    /* Version the current request reads */
+  MultiHopOptions multiHop;     /* maxHops 1 keeps direct neighbors */
+  BfsScratch bfs;
+  ResultCache cache;            /* Disabled unless serving */
+  TitleIndex titles;            /* Loaded catalog's titles, for SEARCH */
+  int32_t *titleEdits;          /* IDs inserted or updated since, in order */
+  int titleEditCount;
+  int titleEditCapacity;
+  IdMap titleEdited;            /* Movie ID -> 1 if in titleEdits */
+  OutputWriter out;             /* Replies, buffered onto stdout */
+} Engine;
+
+/*
+ * Look up a movie in whichever source the engine uses
+ * Returns 0 if absent; *out stays valid until the engine is freed, or
+ * for a live graph while the version stays pinned
+ */
+static int engineGetMovie(Engine *engine, int movieId, Movie *out) {
+  if (engine->pinned != NULL) {
+    return liveGetMovie(engine->pinned, movieId, out);
+  }
+  if (engine->useSnapshot) {
+    return snapshotGetMovie(&engine->snapshot, movieId, out);
+  }
+
+  return findMovie(&engine->ht, movieId, out);
+}
+
+static int engineScore(Engine *engine, int baseMovieId, int genreWeight,
+                       int ratingWeight, int directorWeight,
+                       Candidate *results, int maxResults) {
+  if (engine->multiHop.maxHops > 1) {
+    const MultiHopOptions *options = &engine->multiHop;
+    if (engine->pinned != NULL)
+      return recommendMultiHopFromLive(engine->pinned, &engine->bfs,
+                                       baseMovieId, genreWeight, ratingWeight,
+                                       directorWeight, options, results,
+                                       maxResults);
+    if (engine->useSnapshot)
+      return recommendMultiHopFromSnapshot(
+          &engine->snapshot, &engine->bfs, baseMovieId, genreWeight,
+          ratingWeight, directorWeight, options, results, maxResults);
+    return recommendMultiHop(&engine->kg, &engine->ht, &engine->bfs,
+                             baseMovieId, genreWeight, ratingWeight,
+                             directorWeight, options, results, maxResults);
+  }
+  if (engine->pinned != NULL) {
+    return recommendFromLive(engine->pinned, baseMovieId, genreWeight,
+                             ratingWeight, directorWeight, results,
+                             maxResults);
+  }
+  if (engine->useSnapshot) {
+    return recommendFromSnapshot(&engine->snapshot, baseMovieId, genreWeight,
+                                 ratingWeight, directorWeight, results,
+                                 maxResults);
+  }
+  return recommendMoviesWeighted(&engine->kg, &engine->ht, baseMovieId,
+                                 genreWeight, ratingWeight, directorWeight,
+                                 results, maxResults);
+}
+
+/* engineScore, timed as one query */
+static int engineRecommend(Engine *engine, int baseMovieId, int genreWeight,
+                           int ratingWeight, int directorWeight,
+                           Candidate *results, int maxResults) {
+  STATS_TIMER_START(timer);
+  int count = engineScore(engine, baseMovieId, genreWeight, ratingWeight,
+                          directorWeight, results, maxResults);
+  STATS_TIMER_STOP(timer, STATS_QUERY);
+  return count;
+}
+
+/*
+ * count capped at the movies the engine holds: no query returns more,
+ * so a huge count cannot force a huge results buffer
+ */
+static int engineClampCount(const Engine *engine, int count) {
+  int nodeCount = engine->pinned != NULL ? engine->pinned->nodeCount
+                  : engine->useSnapshot  ? engine->snapshot.csr.nodeCount
+                                         : engine->ht.count;
+  if (nodeCount < 1)
+    nodeCount = 1;
+  return count < nodeCount ? count : nodeCount;
+}
+
+/* Catalog version that cached results must belong to */
+static uint64_t engineEpoch(const Engine *engine) {
+  return engine->pinned != NULL ? engine->pinned->epoch : 0;
+}
+
+static void freeEngine(Engine *engine) {
+  freeBfsScratch(&engine->bfs);
+  freeResultCache(&engine->cache);
+  freeTitleIndex(&engine->titles);
+  free(engine->titleEdits);
+  freeIdMap(&engine->titleEdited);
+  if (engine->useLive) {
+    freeLiveGraph(&engine->live);
+    free(engine->liveStrings);
+  }
+  if (engine->useSnapshot) {
+    freeSnapshot(&engine->snapshot);
+  } else {
+    freeKnowledgeGraph(&engine->kg);
+    freeHashTable(&engine->ht);
+  }
+}
+
+/*
+ * Check that all three weights are within 0-10
  */
-static void addDirectedEdge(KnowledgeGraph *kg, int sourceId, int targetId,
-                            EdgeType type) {
-  GraphNode *sourceNode = getGraphNode(kg, sourceId);
-  if (sourceNode == NULL)
-    return;
+static int weightsValid(int genreWeight, int ratingWeight, int directorWeight) {
+  return genreWeight >= 0 && genreWeight <= 10 && ratingWeight >= 0 &&
+         ratingWeight <= 10 && directorWeight >= 0 && directorWeight <= 10;
+}
 
-  /* Check if edge already exists */
-  GraphEdge *current = sourceNode->edges;
-  while (current != NULL) {
-    if (current->targetMovieId == targetId && current->edgeType == type) {
-      return; /* Edge already exists */
+/* Write each result's catalog row in the engine's output format */
+static void printCandidates(Engine *engine, const Candidate *results,
+                            int count) {
+  for (int i = 0; i < count; i++) {
+    Movie movie;
+    if (engineGetMovie(engine, results[i].movieId, &movie)) {
+      writeMovie(&engine->out, &movie);
     }
-    current = current->next;
   }
+}
 
-  /* Create new edge */
-  GraphEdge *newEdge = (GraphEdge *)malloc(sizeof(GraphEdge));
-  if (newEdge == NULL) {
-    fprintf(stderr, "Error: Memory allocation failed for graph edge\n");
+static void printResults(Engine *engine, const Candidate *results, int count,
+                         int withScores) {
+  if (!withScores) {
+    printCandidates(engine, results, count);
     return;
   }
-
-  newEdge->targetMovieId = targetId;
-  newEdge->edgeType = type;
-  newEdge->next = sourceNode->edges;
-  sourceNode->edges = newEdge;
+  for (int i = 0; i < count; i++) {
+    writeScore(&engine->out, &results[i]);
+  }
 }
 
 /*
- * Add bidirectional edge between two movies
+ * Answer one recommendation query and write the top maxResults, as
+ * catalog rows or (withScores, for a coordinator) as scored candidates
+ * Served from, and added to, the result cache when it is enabled
+ * Returns 0 after an "Out of memory" error reply
  */
-void addEdge(KnowledgeGraph *kg, int movieId1, int movieId2, EdgeType type) {
-  addDirectedEdge(kg, movieId1, movieId2, type);
-  addDirectedEdge(kg, movieId2, movieId1, type);
+static int printRecommendations(Engine *engine, int baseMovieId,
+                                 int genreWeight, int ratingWeight,
+                                 int directorWeight, int maxResults,
+                                 int withScores) {
+  BatchQuery key = {baseMovieId, genreWeight, ratingWeight, directorWeight,
+                    maxResults};
+  int useCache = engine->cache.capacityBytes > 0;
+  if (useCache) {
+    const ResultCacheEntry *cached =
+        resultCacheLookup(&engine->cache, engineEpoch(engine), &key);
+    if (cached != NULL) {
+      printResults(engine, cached->results, cached->count, withScores);
+      return 1;
+    }
+  }
+
+  Candidate stackResults[MAX_RECOMMENDATIONS];
+  Candidate *recommendations = stackResults;
+  if (maxResults > MAX_RECOMMENDATIONS) {
+    recommendations = (Candidate *)malloc(maxResults * sizeof(Candidate));
+    if (recommendations == NULL) {
+      writeError(&engine->out, "Out of memory");
+      return 0;
+    }
+  }
+
+  int recCount = engineRecommend(engine, baseMovieId, genreWeight,
+                                 ratingWeight, directorWeight,
+                                 recommendations, maxResults);
+  printResults(engine, recommendations, recCount, withScores);
+  if (useCache) {
+    resultCacheStore(&engine->cache, engineEpoch(engine), &key,
+                     recommendations, recCount);
+  }
+
+  if (recommendations != stackResults) {
+    free(recommendations);
+  }
+  return 1;
 }
 
 /*
- * Case-insensitive string comparison helper
+ * Parse and validate one protocol line into query
+ * Returns 0 and fills error (without the "ERROR " prefix) if invalid
  */
-static int strcasecmp_custom(const char *s1, const char *s2) {
-  while (*s1 && *s2) {
-    char c1 = (*s1 >= 'A' && *s1 <= 'Z') ? *s1 + 32 : *s1;
-    char c2 = (*s2 >= 'A' && *s2 <= 'Z') ? *s2 + 32 : *s2;
-    if (c1 != c2)
-      return c1 - c2;
-    s1++;
-    s2++;
+static int parseQueryLine(Engine *engine, const char *line, BatchQuery *query,
+                          char *error, size_t errorSize) {
+  Movie baseMovie;
+  query->maxResults = MAX_RECOMMENDATIONS;
+
+  int fields = sscanf(line, "%d %d %d %d %d", &query->baseMovieId,
+                      &query->genreWeight, &query->ratingWeight,
+                      &query->directorWeight, &query->maxResults);
+  if (fields < 4) {
+    snprintf(error, errorSize,
+             "Expected <movie_id> <genre_weight> <rating_weight> "
+             "<director_weight> [count]");
+  } else if (!weightsValid(query->genreWeight, query->ratingWeight,
+                           query->directorWeight)) {
+    snprintf(error, errorSize, "Weights must be between 0 and 10");
+  } else if (query->maxResults < 1) {
+    snprintf(error, errorSize, "Count must be at least 1");
+  } else if (!engineGetMovie(engine, query->baseMovieId, &baseMovie)) {
+    snprintf(error, errorSize, "Movie with ID %d not found",
+             query->baseMovieId);
+  } else {
+    query->maxResults = engineClampCount(engine, query->maxResults);
+    return 1;
   }
-  return *s1 - *s2;
+  return 0;
 }
 
 /*
- * Build knowledge graph by comparing all movie pairs
- * Creates edges based on genre, rating, and director similarity
+ * Index the titles of the loaded catalog or snapshot for SEARCH
+ * Snapshot nodes without a catalog entry are left out
  */
-void buildKnowledgeGraph(KnowledgeGraph *kg, HashTable *ht) {
-  /* Collect all movies into an array for pairwise comparison */
-  Movie *movies[MAX_MOVIES];
-  int movieCount = 0;
+static int buildEngineTitles(Engine *engine) {
+  if (!engine->useSnapshot)
+    return buildTitleIndex(&engine->titles, engine->ht.ids, engine->ht.strings,
+                           engine->ht.count);
 
-  for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-    HashNode *current = ht->buckets[i];
-    while (current != NULL && movieCount < MAX_MOVIES) {
-      movies[movieCount++] = &(current->movie);
-      current = current->next;
+  const CsrGraph *csr = &engine->snapshot.csr;
+  int32_t *ids = (int32_t *)malloc(
+      (csr->nodeCount > 0 ? csr->nodeCount : 1) * sizeof(int32_t));
+  MovieStrings *strings = (MovieStrings *)malloc(
+      (csr->nodeCount > 0 ? csr->nodeCount : 1) * sizeof(MovieStrings));
+  int ok = ids != NULL && strings != NULL;
+  if (ok) {
+    int count = 0;
+    for (int i = 0; i < csr->nodeCount; i++) {
+      Movie movie;
+      if (snapshotGetMovie(&engine->snapshot, csr->movieIds[i], &movie)) {
+        ids[count] = movie.id;
+        strings[count].title = movie.title;
+        strings[count].genre = movie.genre;
+        strings[count].director = movie.director;
+        count++;
+      }
     }
+    ok = buildTitleIndex(&engine->titles, ids, strings, count);
+  } else {
+    fprintf(stderr, "Error: Memory allocation failed for title index\n");
   }
+  free(ids);
+  free(strings);
+  return ok;
+}
 
-  /* Compare all pairs of movies */
-  for (int i = 0; i < movieCount; i++) {
-    for (int j = i + 1; j < movieCount; j++) {
-      Movie *m1 = movies[i];
-      Movie *m2 = movies[j];
-
-      /* Check genre similarity */
-      if (strcasecmp_custom(m1->genre, m2->genre) == 0) {
-        addEdge(kg, m1->id, m2->id, GENRE_SIMILAR);
-      }
-
-      /* Check rating similarity (difference <= 0.5) */
-      if (fabs(m1->rating - m2->rating) <= 0.5) {
-        addEdge(kg, m1->id, m2->id, RATING_SIMILAR);
-      }
-
-      /* Check director similarity */
-      if (strcasecmp_custom(m1->director, m2->director) == 0) {
-        addEdge(kg, m1->id, m2->id, DIRECTOR_SIMILAR);
-      }
-    }
+/*
+ * Remember that movieId was inserted or updated, so SEARCH checks its
+ * current title; the index keeps the title it was built with
+ * Returns 0 on allocation failure
+ */
+static int noteTitleEdit(Engine *engine, int movieId) {
+  if (idMapFind(&engine->titleEdited, movieId) >= 0)
+    return 1;
+  if (engine->titleEditCount == engine->titleEditCapacity) {
+    int newCapacity =
+        engine->titleEditCapacity > 0 ? engine->titleEditCapacity * 2 : 64;
+    int32_t *newEdits = (int32_t *)realloc(engine->titleEdits,
+                                           newCapacity * sizeof(int32_t));
+    if (newEdits == NULL)
+      return 0;
+    engine->titleEdits = newEdits;
+    engine->titleEditCapacity = newCapacity;
   }
+  if (!idMapInsert(&engine->titleEdited, movieId, 1))
+    return 0;
+  engine->titleEdits[engine->titleEditCount++] = movieId;
+  return 1;
 }
 
 /*
- * Free all memory used by knowledge graph
+ * Write the movies whose title contains text: the catalog's matches in
+ * catalog order, then movies inserted or retitled since, in edit order
+ * On a live graph each index hit is read from the pinned version, so
+ * removed movies and retitled ones that no longer match drop out
  */
-void freeKnowledgeGraph(KnowledgeGraph *kg) {
-  for (int i = 0; i < HASH_TABLE_SIZE; i++) {
-    GraphNode *node = kg->nodes[i];
-    while (node != NULL) {
-      /* Free all edges for this node */
-      GraphEdge *edge = node->edges;
-      while (edge != NULL) {
-        GraphEdge *tempEdge = edge;
-        edge = edge->next;
-        free(tempEdge);
-      }
+static void printTitleMatches(Engine *engine, const char *text) {
+  StringView query;
+  query.data = text;
+  query.length = (int)strcspn(text, "\r\n");
 
-      GraphNode *tempNode = node;
-      node = node->next;
-      free(tempNode);
+  /* Stale hits are skipped, so ask for more until enough still match */
+  Movie found[TITLE_SEARCH_MAX_RESULTS];
+  int foundCount = 0;
+  int32_t stackIds[TITLE_SEARCH_MAX_RESULTS];
+  int32_t *ids = stackIds;
+  int capacity = TITLE_SEARCH_MAX_RESULTS;
+  for (;;) {
+    int count = searchTitles(&engine->titles, query, ids, capacity);
+    foundCount = 0;
+    for (int i = 0; i < count && foundCount < TITLE_SEARCH_MAX_RESULTS; i++) {
+      Movie movie;
+      if (engineGetMovie(engine, ids[i], &movie) &&
+          (engine->pinned == NULL || containsIgnoringCase(movie.title, query)))
+        found[foundCount++] = movie;
     }
-    kg->nodes[i] = NULL;
+    if (foundCount == TITLE_SEARCH_MAX_RESULTS || count < capacity)
+      break;
+
+    int32_t *newIds = (int32_t *)malloc(capacity * 2 * sizeof(int32_t));
+    if (newIds == NULL)
+      break;
+    if (ids != stackIds)
+      free(ids);
+    ids = newIds;
+    capacity *= 2;
   }
-  kg->nodeCount = 0;
-}
+  if (ids != stackIds)
+    free(ids);
 
-/* =====================================================
- * QUEUE IMPLEMENTATION (For BFS)
- * ===================================================== */
+  for (int e = 0; e < engine->titleEditCount &&
+                  foundCount < TITLE_SEARCH_MAX_RESULTS;
+       e++) {
+    Movie movie;
+    int listed = 0;
+    for (int i = 0; i < foundCount && !listed; i++)
+      listed = found[i].id == engine->titleEdits[e];
+    if (!listed && engineGetMovie(engine, engine->titleEdits[e], &movie) &&
+        containsIgnoringCase(movie.title, query))
+      found[foundCount++] = movie;
+  }
 
-/*
- * Initialize empty queue
- */
-void initQueue(Queue *q) {
-  q->front = NULL;
-  q->rear = NULL;
-  q->size = 0;
+  for (int i = 0; i < foundCount; i++)
+    writeMovie(&engine->out, &found[i]);
 }
 
 /*
- * Check if queue is empty
+ * Move the engine onto a live graph over its loaded source
+ * Returns 0 and fills error if the source cannot take updates
  */
-int isQueueEmpty(Queue *q) { return q->front == NULL; }
+static int startLiveGraph(Engine *engine, char *error, size_t errorSize) {
+  const CsrGraph *base = NULL;
+  const MovieStrings *strings = NULL;
 
-/*
- * Add movie ID to rear of queue
- */
-void enqueue(Queue *q, int movieId) {
-  QueueNode *newNode = (QueueNode *)malloc(sizeof(QueueNode));
-  if (newNode == NULL) {
-    fprintf(stderr, "Error: Memory allocation failed for queue node\n");
-    return;
+  if (engine->useSnapshot) {
+    base = &engine->snapshot.csr;
+    engine->liveStrings = (MovieStrings *)calloc(
+        base->nodeCount > 0 ? base->nodeCount : 1, sizeof(MovieStrings));
+    if (engine->liveStrings == NULL) {
+      snprintf(error, errorSize, "Out of memory");
+      return 0;
+    }
+    for (int i = 0; i < base->nodeCount; i++) {
+      Movie movie;
+      if (snapshotGetMovie(&engine->snapshot, base->movieIds[i], &movie)) {
+        engine->liveStrings[i].title = movie.title;
+        engine->liveStrings[i].genre = movie.genre;
+        engine->liveStrings[i].director = movie.director;
+      }
+    }
+    strings = engine->liveStrings;
+  } else if (!engine->kg.implicitEdges && engine->kg.csr != NULL) {
+    /* buildKnowledgeGraph gives catalog row i node i */
+    base = engine->kg.csr;
+    strings = engine->ht.strings;
+  } else {
+    snprintf(error, errorSize, "Updates need stored edges (not --implicit)");
+    return 0;
   }
 
-  newNode->movieId = movieId;
-  newNode->next = NULL;
-
-  if (q->rear == NULL) {
-    q->front = q->rear = newNode;
-  } else {
-    q->rear->next = newNode;
-    q->rear = newNode;
+  if (!initLiveGraph(&engine->live, base, strings)) {
+    free(engine->liveStrings);
+    engine->liveStrings = NULL;
+    snprintf(error, errorSize, "Out of memory");
+    return 0;
   }
-  q->size++;
+  engine->useLive = 1;
+  return 1;
 }
 
 /*
- * Remove and return movie ID from front of queue
- * Returns -1 if queue is empty
+ * Apply one INSERT, UPDATE or REMOVE request (text follows the keyword)
+ * Returns 0 and fills error if it was rejected
  */
-int dequeue(Queue *q) {
-  if (isQueueEmpty(q)) {
-    return -1;
+static int applyUpdateLine(Engine *engine, const char *command,
+                           const char *text, char *error, size_t errorSize) {
+  /* A shard's edges are one slice; a local rebuild would drop the rest */
+  if (engine->useSnapshot && engine->snapshot.header->shardCount > 0) {
+    snprintf(error, errorSize, "Updates are not supported on a shard");
+    return 0;
+  }
+  if (!engine->useLive && !startLiveGraph(engine, error, errorSize)) {
+    return 0;
   }
 
-  QueueNode *temp = q->front;
-  int movieId = temp->movieId;
-
-  q->front = q->front->next;
-  if (q->front == NULL) {
-    q->rear = NULL;
+  if (strcmp(command, "REMOVE") == 0) {
+    int movieId;
+    if (sscanf(text, "%d", &movieId) != 1) {
+      snprintf(error, errorSize, "Expected REMOVE <movie_id>");
+      return 0;
+    }
+    if (!liveRemoveMovie(&engine->live, movieId)) {
+      snprintf(error, errorSize, "Movie with ID %d not found", movieId);
+      return 0;
+    }
+    return 1;
   }
 
-  free(temp);
-  q->size--;
+  /* The live graph copies the strings, so the record arena is temporary */
+  Arena arena;
+  Movie movie;
+  int fieldCount = 0;
+  arenaInit(&arena, ARENA_BLOCK_SIZE);
+  scanMovieRecord(text, text + strlen(text), &arena, &movie, &fieldCount);
 
-  return movieId;
+  int ok = 0;
+  if (fieldCount < 5) {
+    snprintf(error, errorSize,
+             "Expected %s <id>,<title>,<genre>,<rating>,<director>", command);
+  } else if (!isfinite(movie.rating)) {
+    snprintf(error, errorSize, "Rating must be a finite number");
+  } else if (!noteTitleEdit(engine, movie.id)) {
+    snprintf(error, errorSize, "Out of memory");
+  } else if (strcmp(command, "INSERT") == 0) {
+    ok = liveInsertMovie(&engine->live, &movie);
+    if (!ok)
+      snprintf(error, errorSize, "Movie with ID %d already exists", movie.id);
+  } else {
+    ok = liveUpdateMovie(&engine->live, &movie);
+    if (!ok)
+      snprintf(error, errorSize, "Movie with ID %d not found", movie.id);
+  }
+  arenaFree(&arena);
+  return ok;
 }
 
 /*
- * Free all memory used by queue
+ * Print the process counters and a summary of the graph being queried
+ * Returns 0 if statistics were compiled out
  */
-void freeQueue(Queue *q) {
-  while (!isQueueEmpty(q)) {
-    dequeue(q);
-  }
+static int printEngineStats(Engine *engine, FILE *out) {
+#ifdef RECOMMENDER_STATS
+  const LiveVersion *version =
+      engine->useLive ? liveAcquire(&engine->live) : NULL;
+  const CsrGraph *csr = NULL;
+  if (version == NULL)
+    csr = engine->useSnapshot ? &engine->snapshot.csr : engine->kg.csr;
+  printRecommenderStats(out, csr, version);
+  if (version != NULL)
+    liveRelease(version);
+  return 1;
+#else
+  (void)engine;
+  (void)out;
+  return 0;
+#endif
 }
 
-/* =====================================================
- * WEIGHTED RECOMMENDATION ALGORITHM
- * ===================================================== */
+/* Reply to CACHE with one "<counter>,<value>" row per statistic */
+static void printCacheStats(const ResultCache *cache) {
+  printf("hits,%llu\n", (unsigned long long)cache->hits);
+  printf("misses,%llu\n", (unsigned long long)cache->misses);
+  printf("evictions,%llu\n", (unsigned long long)cache->evictions);
+  printf("entries,%d\n", cache->count);
+  printf("bytes,%zu\n", cache->bytes);
+  printf("capacity_bytes,%zu\n", cache->capacityBytes);
+}
+
+typedef struct {
+  Engine *engine;
+  const BatchQuery *queries;
+} CacheWarmer;
+
+static void storeWarmResult(int queryIndex, const Candidate *results,
+                            int resultCount, void *context) {
+  CacheWarmer *warmer = (CacheWarmer *)context;
+  resultCacheStore(&warmer->engine->cache, engineEpoch(warmer->engine),
+                   &warmer->queries[queryIndex], results, resultCount);
+}
 
 /*
- * Comparison function for sorting candidates
- * Sort by: 1. Total score (descending), 2. Rating (descending)
+ * Cache the default-weight results (app.py's request) of every movie
+ * Runs as one batch on threadCount workers; multi-hop queries run one
+ * at a time since batches only take direct neighbors
  */
-int compareCandidates(const void *a, const void *b) {
-  const Candidate *ca = (const Candidate *)a;
-  const Candidate *cb = (const Candidate *)b;
+static int warmResultCache(Engine *engine, int threadCount) {
+  const int32_t *ids = engine->useSnapshot ? engine->snapshot.csr.movieIds
+                                           : engine->ht.ids;
+  int idCount = engine->useSnapshot ? engine->snapshot.csr.nodeCount
+                                    : engine->ht.count;
 
-  /* First compare by score (descending) */
-  if (cb->score != ca->score) {
-    return cb->score - ca->score;
+  BatchQuery *queries =
+      (BatchQuery *)malloc((idCount > 0 ? idCount : 1) * sizeof(BatchQuery));
+  if (queries == NULL) {
+    fprintf(stderr, "Error: Memory allocation failed for cache warming\n");
+    return 0;
   }
 
-  /* Tie-breaker: compare by rating (descending) */
-  if (cb->rating > ca->rating)
-    return 1;
-  if (cb->rating < ca->rating)
-    return -1;
-  return 0;
+  int queryCount = 0;
+  for (int i = 0; i < idCount; i++) {
+    Movie movie;
+    if (!engineGetMovie(engine, ids[i], &movie))
+      continue; /* Snapshot node without a catalog entry */
+    /* Keyed with the count parseQueryLine looks it up by */
+    BatchQuery query = {ids[i], RESULT_CACHE_WARM_WEIGHT,
+                        RESULT_CACHE_WARM_WEIGHT, RESULT_CACHE_WARM_WEIGHT,
+                        engineClampCount(engine, MAX_RECOMMENDATIONS)};
+    queries[queryCount++] = query;
+  }
+
+  CacheWarmer warmer = {engine, queries};
+  int ok = 1;
+  if (engine->multiHop.maxHops > 1) {
+    Candidate results[MAX_RECOMMENDATIONS];
+    for (int i = 0; i < queryCount; i++) {
+      int count = engineRecommend(engine, queries[i].baseMovieId,
+                                  queries[i].genreWeight,
+                                  queries[i].ratingWeight,
+                                  queries[i].directorWeight, results,
+                                  queries[i].maxResults);
+      storeWarmResult(i, results, count, &warmer);
+    }
+  } else if (engine->useSnapshot) {
+    ok = recommendBatchFromSnapshot(&engine->snapshot, queries, queryCount,
+                                    threadCount, storeWarmResult, &warmer);
+  } else {
+    ok = recommendBatch(&engine->kg, &engine->ht, queries, queryCount,
+                        threadCount, storeWarmResult, &warmer);
+  }
+
+  free(queries);
+  return ok;
 }
 
 /*
- * Generate weighted recommendations based on knowledge graph
- *
- * Algorithm:
- * 1. Get all neighbors of base movie from knowledge graph
- * 2. For each neighbor, calculate weighted score based on edge types
- * 3. Accumulate scores for movies with multiple edge types
- * 4. Sort by score (descending), then rating (descending)
- * 5. Return top N unique recommendations
+ * Read one request line of at most REQUEST_LINE_MAX - 1 bytes
+ * The rest of a longer line is read and dropped, so it still ends one
+ * request; *tooLong is set instead of returning a truncated line
+ * Returns 0 at EOF
  */
-int recommendMoviesWeighted(KnowledgeGraph *kg, HashTable *ht, int baseMovieId,
-                            int genreWeight, int ratingWeight,
-                            int directorWeight, Candidate *results,
-                            int maxResults) {
-  /* Array to track scores for all movies */
-  int scores[MAX_MOVIES];
-  int movieIds[MAX_MOVIES];
-  int candidateCount = 0;
+static int readRequestLine(FILE *stream, char *line, int size, int *tooLong) {
+  if (fgets(line, size, stream) == NULL)
+    return 0;
 
-  /* Initialize scores to -1 (not visited) */
-  for (int i = 0; i < MAX_MOVIES; i++) {
-    scores[i] = -1;
-    movieIds[i] = -1;
+  size_t length = strlen(line);
+  *tooLong = 0;
+  if (length > 0 && line[length - 1] != '\n' && length == (size_t)size - 1) {
+    int c;
+    while ((c = getc(stream)) != EOF && c != '\n')
+      *tooLong = 1;
   }
+  return 1;
+}
 
-  /* Get the graph node for base movie */
-  GraphNode *baseNode = getGraphNode(kg, baseMovieId);
-  if (baseNode == NULL) {
-    return 0; /* Base movie not in graph */
-  }
+/*
+ * Serve queries from stdin until EOF, reusing one loaded engine
+ *
+ * Protocol (one request per line):
+ *   <movie_id> <genre_weight> <rating_weight> <director_weight> [count]
+ *   INSERT <id>,<title>,<genre>,<rating>,<director>
+ *   UPDATE <id>,<title>,<genre>,<rating>,<director>
+ *   REMOVE <id>
+ *   SEARCH <text>
+ *   PARTIAL <movie_id> <genre_weight> <rating_weight> <director_weight> [count]
+ *   CACHE
+ *   STATS
+ * count defaults to MAX_RECOMMENDATIONS and is capped at the movie
+ * count; SEARCH replies with the first
+ * TITLE_SEARCH_MAX_RESULTS movies whose title contains text, ignoring
+ * case, in catalog order; PARTIAL replies with scored candidates
+ * (writeScore) that a coordinator merges across shards
+ * Lines longer than REQUEST_LINE_MAX - 1 bytes get a single error.
+ * Response: zero or more rows, or a single error, in the output format,
+ * always terminated by an empty line (an END record in binary) so
+ * clients can frame replies. A successful update replies with just the
+ * terminator; CACHE and STATS reply with "<name>,<value>" rows, and
+ * only in CSV. Every reply is flushed before the next line is read.
+ */
+static int serveQueries(Engine *engine) {
+  char line[REQUEST_LINE_MAX];
+  int tooLong;
 
-  /* Traverse all edges from base movie */
-  GraphEdge *edge = baseNode->edges;
-  while (edge != NULL) {
-    int targetId = edge->targetMovieId;
+  while (readRequestLine(stdin, line, sizeof(line), &tooLong)) {
+    BatchQuery query;
+    char error[128];
+    char command[8];
+    int textStart = 0;
 
-    /* Skip the base movie itself */
-    if (targetId == baseMovieId) {
-      edge = edge->next;
+    if (tooLong) {
+      writeError(&engine->out, "Request line too long");
+      writeReplyEnd(&engine->out);
+      flushOutput(&engine->out);
       continue;
     }
 
-    /* Find or create candidate entry */
-    int candidateIdx = -1;
-    for (int i = 0; i < candidateCount; i++) {
-      if (movieIds[i] == targetId) {
-        candidateIdx = i;
-        break;
+    if (sscanf(line, "%7[A-Z]%n", command, &textStart) != 1)
+      command[0] = '\0';
+
+    int bare = strspn(line + textStart, " \r\n") == strlen(line + textStart);
+    if ((strcmp(command, "CACHE") == 0 || strcmp(command, "STATS") == 0) &&
+        bare) {
+      if (engine->out.format != OUTPUT_CSV) {
+        writeError(&engine->out, "CACHE and STATS need --format csv");
+      } else {
+        /* The rows go through stdio, so both buffers are flushed in turn */
+        flushOutput(&engine->out);
+        if (strcmp(command, "CACHE") == 0)
+          printCacheStats(&engine->cache);
+        else if (!printEngineStats(engine, stdout))
+          printf("ERROR Statistics were compiled out\n");
+        fflush(stdout);
       }
+      writeReplyEnd(&engine->out);
+      flushOutput(&engine->out);
+      continue;
     }
-
-    if (candidateIdx == -1) {
-      /* New candidate */
-      candidateIdx = candidateCount++;
-      movieIds[candidateIdx] = targetId;
-      scores[candidateIdx] = 0;
+    if ((strcmp(command, "INSERT") == 0 || strcmp(command, "UPDATE") == 0 ||
+         strcmp(command, "REMOVE") == 0) &&
+        line[textStart] == ' ') {
+      if (!applyUpdateLine(engine, command, line + textStart + 1, error,
+                           sizeof(error)))
+        writeError(&engine->out, error);
+      writeReplyEnd(&engine->out);
+      flushOutput(&engine->out);
+      continue;
     }
 
-    /* Add weight based on edge type */
-    switch (edge->edgeType) {
-    case GENRE_SIMILAR:
-      scores[candidateIdx] += genreWeight;
-      break;
-    case RATING_SIMILAR:
-      scores[candidateIdx] += ratingWeight;
-      break;
-    case DIRECTOR_SIMILAR:
-      scores[candidateIdx] += directorWeight;
-      break;
+    /* Pin one version for the whole request */
+    if (engine->useLive)
+      engine->pinned = liveAcquire(&engine->live);
+
+    /* PARTIAL is a plain query answered with scores */
+    int partial = strcmp(command, "PARTIAL") == 0 && line[textStart] == ' ';
+    const char *queryText = partial ? line + textStart + 1 : line;
+    if (strcmp(command, "SEARCH") == 0 && line[textStart] == ' ') {
+      printTitleMatches(engine, line + textStart + 1);
+    } else if (parseQueryLine(engine, queryText, &query, error,
+                              sizeof(error))) {
+      printRecommendations(engine, query.baseMovieId, query.genreWeight,
+                           query.ratingWeight, query.directorWeight,
+                           query.maxResults, partial);
+    } else {
+      writeError(&engine->out, error);
     }
 
-    edge = edge->next;
+    if (engine->pinned != NULL) {
+      liveRelease(engine->pinned);
+      engine->pinned = NULL;
+    }
+    writeReplyEnd(&engine->out);
+    flushOutput(&engine->out);
   }
 
-  /* Build candidate array with movie info */
-  Candidate candidates[MAX_MOVIES];
-  int validCount = 0;
+  return 0;
+}
 
-  for (int i = 0; i < candidateCount; i++) {
-    Movie *movie = findMovie(ht, movieIds[i]);
-    if (movie != NULL && scores[i] > 0) {
-      candidates[validCount].movieId = movieIds[i];
-      candidates[validCount].score = scores[i];
-      candidates[validCount].rating = movie->rating;
-      validCount++;
-    }
-  }
+/* =====================================================
+ * BATCH MODE (Offline Precomputation)
+ * ===================================================== */
 
-  /* Sort candidates by score (desc), then rating (desc) */
-  qsort(candidates, validCount, sizeof(Candidate), compareCandidates);
+/* Error reply of one rejected batch line */
+typedef char BatchError[128];
 
-  /* Copy top results */
-  int resultCount = (validCount < maxResults) ? validCount : maxResults;
-  for (int i = 0; i < resultCount; i++) {
-    results[i] = candidates[i];
-  }
+typedef struct {
+  Engine *engine;
+  const int *lineErrors;        /* Window line -> error index, -1 if valid */
+  const BatchError *errors;
+  const int *lineOfQuery;       /* Valid query index -> window line */
+  int nextLine;                 /* First line not yet printed */
+} BatchPrinter;
 
-  return resultCount;
+/*
+ * Write the error replies of invalid lines before line end
+ */
+static void printBatchErrors(BatchPrinter *printer, int end) {
+  OutputWriter *out = &printer->engine->out;
+  for (; printer->nextLine < end; printer->nextLine++) {
+    writeError(out, printer->errors[printer->lineErrors[printer->nextLine]]);
+    writeReplyEnd(out);
+  }
 }
 
-/* =====================================================
- * FILE I/O
- * ===================================================== */
+static void printBatchResult(int queryIndex, const Candidate *results,
+                             int resultCount, void *context) {
+  BatchPrinter *printer = (BatchPrinter *)context;
+  int line = printer->lineOfQuery[queryIndex];
+  printBatchErrors(printer, line);
+
+  printCandidates(printer->engine, results, resultCount);
+  writeReplyEnd(&printer->engine->out);
+  printer->nextLine = line + 1;
+}
 
 /*
- * Load movies from CSV file
- * Format: id,title,genre,rating,director
+ * Answer every line of a batch file, in order, with server mode replies
+ * Lines are read and answered a window at a time, BATCH_WINDOW_PER_THREAD
+ * per worker, so memory stays the same however long the file is; only
+ * rejected lines keep an error text
  */
-int loadMovies(const char *filename, HashTable *ht) {
+static int runBatchFile(Engine *engine, const char *filename,
+                        int threadCount) {
   FILE *file = fopen(filename, "r");
   if (file == NULL) {
     fprintf(stderr, "Error: Cannot open file %s\n", filename);
-    return 0;
+    return 1;
   }
 
-  char line[1024];
-  int count = 0;
-
-  /* Skip header line */
-  if (fgets(line, sizeof(line), file) == NULL) {
-    fclose(file);
-    return 0;
-  }
+  int windowLines = resolveThreadCount(threadCount) * BATCH_WINDOW_PER_THREAD;
+  BatchQuery *queries = (BatchQuery *)malloc(windowLines * sizeof(BatchQuery));
+  int *lineOfQuery = (int *)malloc(windowLines * sizeof(int));
+  int *lineErrors = (int *)malloc(windowLines * sizeof(int));
+  BatchError *errors = NULL;
+  int errorCapacity = 0;
+  int ok = queries != NULL && lineOfQuery != NULL && lineErrors != NULL;
+  if (!ok)
+    fprintf(stderr, "Error: Memory allocation failed for batch\n");
 
-  /* Read each movie */
-  while (fgets(line, sizeof(line), file) != NULL) {
-    Movie movie;
-    char *token;
-    char *saveptr;
+  char text[REQUEST_LINE_MAX];
+  int tooLong;
+  int more = 1;
+  while (ok && more) {
+    int lineCount = 0, queryCount = 0, errorCount = 0;
+    while (lineCount < windowLines &&
+           (more = readRequestLine(file, text, sizeof(text), &tooLong))) {
+      /* The next error slot doubles as the parser's scratch */
+      if (errorCount == errorCapacity) {
+        int newCapacity = errorCapacity > 0 ? errorCapacity * 2 : 16;
+        BatchError *newErrors =
+            (BatchError *)realloc(errors, newCapacity * sizeof(BatchError));
+        if (newErrors == NULL) {
+          fprintf(stderr, "Error: Memory allocation failed for batch\n");
+          ok = 0;
+          break;
+        }
+        errors = newErrors;
+        errorCapacity = newCapacity;
+      }
 
-    /* Remove trailing newline */
-    size_t len = strlen(line);
-    if (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-      line[len - 1] = '\0';
-      len--;
-    }
-    if (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
-      line[len - 1] = '\0';
+      char *error = errors[errorCount];
+      if (tooLong) {
+        snprintf(error, sizeof(BatchError), "Request line too long");
+      } else if (parseQueryLine(engine, text, &queries[queryCount], error,
+                                sizeof(BatchError))) {
+        lineErrors[lineCount] = -1;
+        lineOfQuery[queryCount++] = lineCount++;
+        continue;
+      }
+      lineErrors[lineCount++] = errorCount++;
     }
+    if (!ok || lineCount == 0)
+      break;
 
-    /* Parse ID */
-    token = strtok(line, ",");
-    if (token == NULL)
-      continue;
-    movie.id = atoi(token);
-
-    /* Parse Title */
-    token = strtok(NULL, ",");
-    if (token == NULL)
-      continue;
-    strncpy(movie.title, token, MAX_TITLE_LEN - 1);
-    movie.title[MAX_TITLE_LEN - 1] = '\0';
-
-    /* Parse Genre */
-    token = strtok(NULL, ",");
-    if (token == NULL)
-      continue;
-    strncpy(movie.genre, token, MAX_GENRE_LEN - 1);
-    movie.genre[MAX_GENRE_LEN - 1] = '\0';
-
-    /* Parse Rating */
-    token = strtok(NULL, ",");
-    if (token == NULL)
-      continue;
-    movie.rating = (float)atof(token);
-
-    /* Parse Director */
-    token = strtok(NULL, ",\r\n");
-    if (token == NULL)
-      continue;
-    strncpy(movie.director, token, MAX_DIRECTOR_LEN - 1);
-    movie.director[MAX_DIRECTOR_LEN - 1] = '\0';
-
-    insertMovie(ht, movie);
-    count++;
+    BatchPrinter printer = {engine, lineErrors, errors, lineOfQuery, 0};
+    ok = engine->useSnapshot
+             ? recommendBatchFromSnapshot(&engine->snapshot, queries,
+                                          queryCount, threadCount,
+                                          printBatchResult, &printer)
+             : recommendBatch(&engine->kg, &engine->ht, queries, queryCount,
+                              threadCount, printBatchResult, &printer);
+    if (ok)
+      printBatchErrors(&printer, lineCount);
   }
-
   fclose(file);
-  return count;
-}
 
-/*
- * Print movie recommendation in CSV format
- */
-void printRecommendation(Movie *movie) {
-  printf("%d,%s,%s,%.1f,%s\n", movie->id, movie->title, movie->genre,
-         movie->rating, movie->director);
+  free(queries);
+  free(lineOfQuery);
+  free(lineErrors);
+  free(errors);
+  return ok ? 0 : 1;
 }
 
 /* =====================================================
  * MAIN FUNCTION
  * ===================================================== */
 
+static void printUsage(const char *program) {
+  fprintf(stderr,
+          "Usage: %s [--implicit] <movie_id> <genre_weight> <rating_weight> "
+          "<director_weight> [count]\n",
+          program);
+  fprintf(stderr, "       %s [--implicit] --serve [movies_file]\n", program);
+  fprintf(stderr, "       %s [--implicit] --batch <queries_file> [movies_file]\n",
+          program);
+  fprintf(stderr, "       %s --build-snapshot <movies_file> <snapshot_file>\n",
+          program);
+  fprintf(stderr, "  movie_id: ID of base movie (integer)\n");
+  fprintf(stderr, "  genre_weight: Weight for genre similarity (0-10)\n");
+  fprintf(stderr, "  rating_weight: Weight for rating similarity (0-10)\n");
+  fprintf(stderr, "  director_weight: Weight for director similarity (0-10)\n");
+  fprintf(stderr, "  count: Number of recommendations (default %d, at most "
+                  "the movie count)\n",
+          MAX_RECOMMENDATIONS);
+  fprintf(stderr, "  --serve: Build the graph once and answer queries read "
+                  "from stdin\n");
+  fprintf(stderr, "           (also SEARCH <text> for titles containing "
+                  "text)\n");
+  fprintf(stderr, "  --batch: Answer every query line of queries_file, in "
+                  "order, like --serve\n");
+  fprintf(stderr, "  --threads <n>: Worker threads for the graph build and "
+                  "batches (default: one per CPU)\n");
+  fprintf(stderr, "  --hops <n>: Also recommend movies up to n edges away "
+                  "(default 1, at most %d)\n",
+          MULTI_HOP_MAX_HOPS);
+  fprintf(stderr, "  --hop-decay <pct>: Percent of the score kept per extra "
+                  "hop (default %d)\n",
+          MULTI_HOP_DEFAULT_DECAY);
+  fprintf(stderr, "  --hop-budget <n>: Stop after reaching n movies "
+                  "(default: no limit)\n");
+  fprintf(stderr, "  --cache-mb <n>: Result cache size for --serve (default "
+                  "%d, 0 disables)\n",
+          RESULT_CACHE_DEFAULT_MB);
+  fprintf(stderr, "  --warm-cache: Cache every movie's default-weight "
+                  "results before serving\n");
+  fprintf(stderr, "  --candidates <m>: Precompute the best m neighbors per "
+                  "edge type mix of hot movies\n");
+  fprintf(stderr, "  --approximate: Answer counts above m from those lists "
+                  "too (may miss movies)\n");
+  fprintf(stderr, "  --stats: Print phase timings and graph counters to "
+                  "stderr on exit\n");
+  fprintf(stderr, "  --format <csv|ndjson|binary>: Encoding of result rows "
+                  "(default csv)\n");
+  fprintf(stderr, "  --implicit: Compute similarity at query time instead of "
+                  "storing edges\n");
+  fprintf(stderr, "  --build-snapshot: Write the built graph and catalog to a "
+                  "binary snapshot\n");
+  fprintf(stderr, "  --snapshot <file>: Query a snapshot instead of loading "
+                  "movies_file\n");
+  fprintf(stderr, "  --shards <n>: With --build-snapshot, keep only the "
+                  "edges to one of n shards' movies\n");
+  fprintf(stderr, "  --shard <i>: Shard to build, 0 to n-1 (default 0)\n");
+  fprintf(stderr, "  --shard-by <id|genre>: How movies are split into shards "
+                  "(default id)\n");
+  fprintf(stderr, "  --no-verify: Skip the snapshot checksum and bounds "
+                  "checks\n");
+}
+
 int main(int argc, char *argv[]) {
+  int serveMode = 0;
+  int implicitEdges = 0;
+  int buildSnapshot = 0;
+  int verifySnapshot = 1;
+  const char *snapshotFile = NULL;
+  const char *batchFile = NULL;
+  int threadCount = 0;
+  MultiHopOptions multiHop = {1, MULTI_HOP_DEFAULT_DECAY, 0};
+  int cacheMegabytes = RESULT_CACHE_DEFAULT_MB;
+  int warmCache = 0;
+  int candidateListSize = 0;
+  int approximateCandidates = 0;
+  int printStats = 0;
+  ShardSpec shard = {0, 0, SHARD_BY_MOVIE_ID};
+  OutputFormat outputFormat = OUTPUT_CSV;
+  char *positional[5];
+  int positionalCount = 0;
+
+  /* Separate option flags from positional arguments */
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--serve") == 0) {
+      serveMode = 1;
+    } else if (strcmp(argv[i], "--implicit") == 0) {
+      implicitEdges = 1;
+    } else if (strcmp(argv[i], "--build-snapshot") == 0) {
+      buildSnapshot = 1;
+    } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+      snapshotFile = argv[++i];
+    } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+      batchFile = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threadCount = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hops") == 0 && i + 1 < argc) {
+      multiHop.maxHops = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hop-decay") == 0 && i + 1 < argc) {
+      multiHop.decayPercent = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--hop-budget") == 0 && i + 1 < argc) {
+      multiHop.candidateBudget = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+      cacheMegabytes = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--candidates") == 0 && i + 1 < argc) {
+      candidateListSize = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--approximate") == 0) {
+      approximateCandidates = 1;
+    } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+      shard.count = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+      shard.index = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--shard-by") == 0 && i + 1 < argc) {
+      if (!parseShardScheme(argv[++i], &shard.scheme)) {
+        fprintf(stderr, "Error: --shard-by must be id or genre\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--stats") == 0) {
+      printStats = 1;
+    } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+      if (!parseOutputFormat(argv[++i], &outputFormat)) {
+        fprintf(stderr, "Error: --format must be csv, ndjson or binary\n");
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--warm-cache") == 0) {
+      warmCache = 1;
+    } else if (strcmp(argv[i], "--no-verify") == 0) {
+      verifySnapshot = 0;
+    } else if (positionalCount < 5) {
+      positional[positionalCount++] = argv[i];
+    } else {
+      positionalCount++;
+    }
+  }
+
   /* Validate command line arguments */
-  if (argc != 5) {
-    fprintf(stderr,
-            "Usage: %s <movie_id> <genre_weight> <rating_weight> "
-            "<director_weight>\n",
-            argv[0]);
-    fprintf(stderr, "  movie_id: ID of base movie (integer)\n");
-    fprintf(stderr, "  genre_weight: Weight for genre similarity (0-10)\n");
-    fprintf(stderr, "  rating_weight: Weight for rating similarity (0-10)\n");
-    fprintf(stderr,
-            "  director_weight: Weight for director similarity (0-10)\n");
+  /* Server and batch mode read queries instead of taking one */
+  int streamMode = serveMode || batchFile != NULL;
+  if (buildSnapshot) {
+    if (positionalCount != 2 || streamMode || implicitEdges ||
+        snapshotFile != NULL) {
+      printUsage(argv[0]);
+      return 1;
+    }
+  } else if ((serveMode && batchFile != NULL) ||
+             (streamMode && positionalCount > (snapshotFile != NULL ? 0 : 1)) ||
+             (!streamMode && positionalCount != 4 && positionalCount != 5) ||
+             (snapshotFile != NULL && implicitEdges)) {
+    printUsage(argv[0]);
     return 1;
   }
 
-  int baseMovieId = atoi(argv[1]);
-  int genreWeight = atoi(argv[2]);
-  int ratingWeight = atoi(argv[3]);
-  int directorWeight = atoi(argv[4]);
-
-  /* Validate weights are in range 0-10 */
-  if (genreWeight < 0 || genreWeight > 10 || ratingWeight < 0 ||
-      ratingWeight > 10 || directorWeight < 0 || directorWeight > 10) {
-    fprintf(stderr, "Error: Weights must be between 0 and 10\n");
+  /* Multi-hop walks stored edges one query at a time */
+  if (multiHop.maxHops != 1 &&
+      (buildSnapshot || implicitEdges || batchFile != NULL)) {
+    fprintf(stderr, "Error: --hops needs stored edges and does not apply to "
+                    "--batch or --build-snapshot\n");
+    return 1;
+  }
+  /* Lists are built with a catalog's stored edges, and not saved */
+  if (candidateListSize != 0 &&
+      (buildSnapshot || implicitEdges || snapshotFile != NULL)) {
+    fprintf(stderr, "Error: --candidates needs stored edges and does not "
+                    "apply to --snapshot or --build-snapshot\n");
+    return 1;
+  }
+  if (candidateListSize < 0 ||
+      (approximateCandidates && candidateListSize == 0)) {
+    fprintf(stderr, "Error: --approximate needs --candidates of at least 1\n");
     return 1;
   }
+  /* Shards are cut when the snapshot is built */
+  if ((shard.count != 0 || shard.index != 0) && !buildSnapshot) {
+    fprintf(stderr, "Error: --shards and --shard apply to --build-snapshot\n");
+    return 1;
+  }
+  if (shard.count < 0 || shard.index < 0 ||
+      (shard.count > 0 && shard.index >= shard.count)) {
+    fprintf(stderr, "Error: --shard must be 0 to --shards minus 1\n");
+    return 1;
+  }
+#ifndef RECOMMENDER_STATS
+  if (printStats) {
+    fprintf(stderr, "Error: --stats needs a build without "
+                    "RECOMMENDER_NO_STATS\n");
+    return 1;
+  }
+#endif
+  if (cacheMegabytes < 0 || (warmCache && (!serveMode || cacheMegabytes == 0))) {
+    fprintf(stderr, "Error: --warm-cache needs --serve and a result cache\n");
+    return 1;
+  }
+  if (multiHop.maxHops < 1 || multiHop.maxHops > MULTI_HOP_MAX_HOPS ||
+      multiHop.decayPercent < 0 || multiHop.decayPercent > 100 ||
+      multiHop.candidateBudget < 0) {
+    fprintf(stderr, "Error: --hops must be 1-%d, --hop-decay 0-100 and "
+                    "--hop-budget at least 0\n",
+            MULTI_HOP_MAX_HOPS);
+    return 1;
+  }
+
+  Engine engine;
+  memset(&engine, 0, sizeof(engine));
+  initIdMap(&engine.titleEdited);
+  engine.multiHop = multiHop;
+
+  /* Build once and write the snapshot; nothing to query */
+  if (buildSnapshot) {
+    initHashTable(&engine.ht);
+    initKnowledgeGraph(&engine.kg);
+    engine.kg.buildThreads = threadCount;
+    engine.kg.shard = shard;
+    if (loadMovies(positional[0], &engine.ht) == 0) {
+      fprintf(stderr, "Error: No movies loaded from file\n");
+      freeHashTable(&engine.ht);
+      return 1;
+    }
+    buildKnowledgeGraph(&engine.kg, &engine.ht);
+    int written = writeSnapshot(positional[1], &engine.kg, &engine.ht);
+    if (printStats)
+      printEngineStats(&engine, stderr);
+    freeEngine(&engine);
+    return written ? 0 : 1;
+  }
 
-  /* Initialize data structures */
-  HashTable hashTable;
-  KnowledgeGraph knowledgeGraph;
+  const char *moviesFile =
+      (streamMode && positionalCount == 1) ? positional[0] : "movies.txt";
+  int baseMovieId = 0, genreWeight = 0, ratingWeight = 0, directorWeight = 0;
+  int maxResults = MAX_RECOMMENDATIONS;
 
-  initHashTable(&hashTable);
-  initKnowledgeGraph(&knowledgeGraph);
+  if (!streamMode) {
+    baseMovieId = atoi(positional[0]);
+    genreWeight = atoi(positional[1]);
+    ratingWeight = atoi(positional[2]);
+    directorWeight = atoi(positional[3]);
+    if (positionalCount == 5) {
+      maxResults = atoi(positional[4]);
+    }
 
-  /* Load movies from file */
-  int movieCount = loadMovies("movies.txt", &hashTable);
-  if (movieCount == 0) {
-    fprintf(stderr, "Error: No movies loaded from file\n");
-    freeHashTable(&hashTable);
-    return 1;
+    /* Validate weights are in range 0-10 */
+    if (!weightsValid(genreWeight, ratingWeight, directorWeight)) {
+      fprintf(stderr, "Error: Weights must be between 0 and 10\n");
+      return 1;
+    }
+    if (maxResults < 1) {
+      fprintf(stderr, "Error: Count must be at least 1\n");
+      return 1;
+    }
+  }
+
+  if (snapshotFile != NULL) {
+    /* The snapshot already holds the built graph */
+    if (!loadSnapshot(snapshotFile, &engine.snapshot, verifySnapshot)) {
+      return 1;
+    }
+    engine.useSnapshot = 1;
+    /* A walk would need the other shards' edges */
+    if (multiHop.maxHops != 1 && engine.snapshot.header->shardCount > 0) {
+      fprintf(stderr, "Error: --hops does not apply to a shard snapshot\n");
+      freeSnapshot(&engine.snapshot);
+      return 1;
+    }
+  } else {
+    /* Initialize data structures */
+    initHashTable(&engine.ht);
+    initKnowledgeGraph(&engine.kg);
+    engine.kg.implicitEdges = implicitEdges;
+    engine.kg.buildThreads = threadCount;
+    engine.kg.candidateListSize = candidateListSize;
+    engine.kg.approximateCandidates = approximateCandidates;
+
+    /* Load movies from file */
+    int movieCount = loadMovies(moviesFile, &engine.ht);
+    if (movieCount == 0) {
+      fprintf(stderr, "Error: No movies loaded from file\n");
+      freeHashTable(&engine.ht);
+      return 1;
+    }
   }
 
   /* Verify base movie exists */
-  Movie *baseMovie = findMovie(&hashTable, baseMovieId);
-  if (baseMovie == NULL) {
+  Movie baseMovie;
+  if (!streamMode && !engineGetMovie(&engine, baseMovieId, &baseMovie)) {
     fprintf(stderr, "Error: Movie with ID %d not found\n", baseMovieId);
-    freeHashTable(&hashTable);
+    if (engine.useSnapshot)
+      freeSnapshot(&engine.snapshot);
+    else
+      freeHashTable(&engine.ht);
     return 1;
   }
 
   /* Build knowledge graph */
-  buildKnowledgeGraph(&knowledgeGraph, &hashTable);
+  if (!engine.useSnapshot)
+    buildKnowledgeGraph(&engine.kg, &engine.ht);
 
-  /* Generate recommendations */
-  Candidate recommendations[MAX_RECOMMENDATIONS];
-  int recCount = recommendMoviesWeighted(
-      &knowledgeGraph, &hashTable, baseMovieId, genreWeight, ratingWeight,
-      directorWeight, recommendations, MAX_RECOMMENDATIONS);
+  if (!initOutputWriter(&engine.out, 1, outputFormat)) {
+    freeEngine(&engine);
+    return 1;
+  }
 
-  /* Print recommendations in CSV format */
-  for (int i = 0; i < recCount; i++) {
-    Movie *movie = findMovie(&hashTable, recommendations[i].movieId);
-    if (movie != NULL) {
-      printRecommendation(movie);
-    }
+  int status = 0;
+  if (serveMode) {
+    initResultCache(&engine.cache, (size_t)cacheMegabytes * 1024 * 1024);
+    if ((warmCache && !warmResultCache(&engine, threadCount)) ||
+        !buildEngineTitles(&engine))
+      status = 1;
+    else
+      status = serveQueries(&engine);
+  } else if (batchFile != NULL) {
+    status = runBatchFile(&engine, batchFile, threadCount);
+  } else {
+    maxResults = engineClampCount(&engine, maxResults);
+    if (!printRecommendations(&engine, baseMovieId, genreWeight, ratingWeight,
+                              directorWeight, maxResults, 0))
+      status = 1;
   }
 
+  if (!freeOutputWriter(&engine.out))
+    status = 1;
+  if (printStats)
+    printEngineStats(&engine, stderr);
+
   /* Cleanup */
-  freeKnowledgeGraph(&knowledgeGraph);
-  freeHashTable(&hashTable);
+  freeEngine(&engine);
 
-  return 0;
+  return status;
 }
+
+#endif /* RECOMMENDER_NO_MAIN */
@@ -0,0 +1,394 @@
+/*
+ * recommender_ext.c - CPython binding for the recommender engine
+ *
+ * Exposes recommender_ext.Engine, which loads a catalog and builds its
+ * knowledge graph once, then answers queries in-process:
+ *
+ *   engine = recommender_ext.Engine("movies.txt")
+ *   engine.recommend(1, 5, 3, 7)        # [(id, title, genre, rating,
+ *                                       #   director), ...] best first
+ *   engine.recommend_ids(1, 5, 3, 7)    # array('i') of IDs, best first
+ *   engine.search("dark knight")        # rows whose title contains it
+ *
+ * The graph is frozen before the first query, so scoring runs with the
+ * GIL released and Python threads query one engine in parallel. Rows
+ * are built straight from the catalog columns; no text is formatted or
+ * parsed on the way.
+ *
+ * Build: python setup.py build_ext --inplace
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "movie.h"
+
+/* =====================================================
+ * ENGINE OBJECT
+ * ===================================================== */
+
+typedef struct {
+  PyObject_HEAD
+  HashTable ht;
+  KnowledgeGraph kg;
+  TitleIndex titles;
+  int loaded; /* ht, kg and titles hold a built catalog and must be freed */
+  int loading; /* An __init__ is building a catalog with the GIL released */
+} EngineObject;
+
+static int engineInit(EngineObject *self, PyObject *args, PyObject *kwargs) {
+  static char *keywords[] = {"movies_file", "implicit",    "threads",
+                             "candidates",  "approximate", NULL};
+  PyObject *path = NULL;
+  int implicitEdges = 0;
+  int threadCount = 0;
+  int candidateListSize = 0;
+  int approximateCandidates = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O&|piip", keywords,
+                                   PyUnicode_FSConverter, &path,
+                                   &implicitEdges, &threadCount,
+                                   &candidateListSize,
+                                   &approximateCandidates)) {
+    return -1;
+  }
+  if (candidateListSize < 0 || (candidateListSize > 0 && implicitEdges) ||
+      (approximateCandidates && candidateListSize == 0)) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_ValueError,
+                    "candidates needs stored edges (not implicit), and "
+                    "approximate needs candidates");
+    return -1;
+  }
+
+  /* Other threads may already be querying a loaded engine, or building
+   * one: loading is claimed under the GIL before it is released */
+  if (self->loaded || self->loading) {
+    Py_DECREF(path);
+    PyErr_SetString(PyExc_RuntimeError, self->loaded
+                                            ? "Engine is already loaded"
+                                            : "Engine is already loading");
+    return -1;
+  }
+  self->loading = 1;
+
+  /* Loading and building touch no Python objects; the engine only sees
+   * the catalog once its graph is built */
+  HashTable ht;
+  KnowledgeGraph kg;
+  TitleIndex titles;
+  initHashTable(&ht);
+  initKnowledgeGraph(&kg);
+  kg.implicitEdges = implicitEdges;
+  kg.buildThreads = threadCount;
+  kg.candidateListSize = candidateListSize;
+  kg.approximateCandidates = approximateCandidates;
+
+  const char *filename = PyBytes_AS_STRING(path);
+  int movieCount;
+  int titlesBuilt = 0;
+  initTitleIndex(&titles);
+  Py_BEGIN_ALLOW_THREADS
+  movieCount = loadMovies(filename, &ht);
+  if (movieCount > 0) {
+    buildKnowledgeGraph(&kg, &ht);
+    titlesBuilt = buildTitleIndex(&titles, ht.ids, ht.strings, ht.count);
+  }
+  Py_END_ALLOW_THREADS
+  self->loading = 0;
+
+  if (movieCount == 0) {
+    PyErr_Format(PyExc_ValueError, "No movies loaded from %s", filename);
+  } else if ((kg.csr == NULL && kg.implicit == NULL) || !titlesBuilt ||
+             (candidateListSize > 0 && kg.candidates == NULL)) {
+    PyErr_NoMemory();
+  }
+  Py_DECREF(path);
+  if (PyErr_Occurred()) {
+    freeTitleIndex(&titles);
+    freeKnowledgeGraph(&kg);
+    freeHashTable(&ht);
+    return -1;
+  }
+
+  self->ht = ht;
+  self->kg = kg;
+  self->titles = titles;
+  self->loaded = 1;
+  return 0;
+}
+
+static void engineDealloc(EngineObject *self) {
+  if (self->loaded) {
+    freeTitleIndex(&self->titles);
+    freeKnowledgeGraph(&self->kg);
+    freeHashTable(&self->ht);
+  }
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static int engineReady(const EngineObject *self) {
+  if (!self->loaded) {
+    PyErr_SetString(PyExc_RuntimeError, "Engine has no catalog loaded");
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * Parse the query arguments and score them into a new Candidate array
+ * Returns the result count, or -1 with an exception set; *results is
+ * for the caller to free
+ */
+static int runQuery(EngineObject *self, PyObject *args, PyObject *kwargs,
+                    Candidate **results) {
+  static char *keywords[] = {"movie_id",        "genre_weight",
+                             "rating_weight",   "director_weight",
+                             "count",           NULL};
+  int baseMovieId, genreWeight, ratingWeight, directorWeight;
+  int maxResults = MAX_RECOMMENDATIONS;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "iiii|i", keywords,
+                                   &baseMovieId, &genreWeight, &ratingWeight,
+                                   &directorWeight, &maxResults)) {
+    return -1;
+  }
+  if (!engineReady(self))
+    return -1;
+  if (genreWeight < 0 || genreWeight > 10 || ratingWeight < 0 ||
+      ratingWeight > 10 || directorWeight < 0 || directorWeight > 10) {
+    PyErr_SetString(PyExc_ValueError, "Weights must be between 0 and 10");
+    return -1;
+  }
+  if (maxResults < 1) {
+    PyErr_SetString(PyExc_ValueError, "count must be at least 1");
+    return -1;
+  }
+  if (findMovieIndex(&self->ht, baseMovieId) < 0) {
+    PyErr_Format(PyExc_KeyError, "Movie with ID %d not found", baseMovieId);
+    return -1;
+  }
+  /* No query returns more than the catalog holds */
+  if (maxResults > self->ht.count)
+    maxResults = self->ht.count;
+
+  *results = (Candidate *)PyMem_RawMalloc((size_t)maxResults *
+                                          sizeof(Candidate));
+  if (*results == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  /* The frozen graph is read-only, so threads may score concurrently */
+  int count;
+  Py_BEGIN_ALLOW_THREADS
+  count = recommendMoviesWeighted(&self->kg, &self->ht, baseMovieId,
+                                  genreWeight, ratingWeight, directorWeight,
+                                  *results, maxResults);
+  Py_END_ALLOW_THREADS
+  return count;
+}
+
+/*
+ * One catalog row as (id, title, genre, rating, director)
+ * The rating is rounded to one decimal like the CSV output, so 8.1
+ * comes back as 8.1 rather than the float's 8.100000381...
+ */
+static PyObject *movieTuple(const HashTable *ht, int movieId) {
+  Movie movie;
+  if (!findMovie(ht, movieId, &movie)) {
+    PyErr_Format(PyExc_KeyError, "Movie with ID %d not found", movieId);
+    return NULL;
+  }
+  return Py_BuildValue("(is#s#ds#)", movie.id, movie.title.data,
+                       (Py_ssize_t)movie.title.length, movie.genre.data,
+                       (Py_ssize_t)movie.genre.length,
+                       rint((double)movie.rating * 10.0) / 10.0,
+                       movie.director.data,
+                       (Py_ssize_t)movie.director.length);
+}
+
+static PyObject *engineRecommend(EngineObject *self, PyObject *args,
+                                 PyObject *kwargs) {
+  Candidate *results = NULL;
+  int count = runQuery(self, args, kwargs, &results);
+  if (count < 0)
+    return NULL;
+
+  PyObject *rows = PyList_New(count);
+  for (int i = 0; rows != NULL && i < count; i++) {
+    PyObject *row = movieTuple(&self->ht, results[i].movieId);
+    if (row == NULL) {
+      Py_CLEAR(rows);
+      break;
+    }
+    PyList_SET_ITEM(rows, i, row);
+  }
+  PyMem_RawFree(results);
+  return rows;
+}
+
+/*
+ * Only the ranked IDs, packed into an array('i') through the buffer
+ * protocol, for callers that join them against their own data
+ */
+static PyObject *engineRecommendIds(EngineObject *self, PyObject *args,
+                                    PyObject *kwargs) {
+  Candidate *results = NULL;
+  int count = runQuery(self, args, kwargs, &results);
+  if (count < 0)
+    return NULL;
+
+  PyObject *ids = PyBytes_FromStringAndSize(NULL, (Py_ssize_t)count *
+                                                      (Py_ssize_t)sizeof(int));
+  if (ids != NULL) {
+    int *packed = (int *)PyBytes_AS_STRING(ids);
+    for (int i = 0; i < count; i++)
+      packed[i] = results[i].movieId;
+  }
+  PyMem_RawFree(results);
+  if (ids == NULL)
+    return NULL;
+
+  PyObject *arrayModule = PyImport_ImportModule("array");
+  PyObject *packedIds = NULL;
+  if (arrayModule != NULL) {
+    packedIds = PyObject_CallMethod(arrayModule, "array", "sO", "i", ids);
+    Py_DECREF(arrayModule);
+  }
+  Py_DECREF(ids);
+  return packedIds;
+}
+
+static PyObject *engineMovie(EngineObject *self, PyObject *args) {
+  int movieId;
+  if (!PyArg_ParseTuple(args, "i", &movieId) || !engineReady(self))
+    return NULL;
+  return movieTuple(&self->ht, movieId);
+}
+
+/*
+ * Rows of the first limit movies whose title contains text, ignoring
+ * ASCII case, in catalog order
+ */
+static PyObject *engineSearch(EngineObject *self, PyObject *args,
+                              PyObject *kwargs) {
+  static char *keywords[] = {"text", "limit", NULL};
+  const char *text;
+  Py_ssize_t textLength;
+  int limit = TITLE_SEARCH_MAX_RESULTS;
+  if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s#|i", keywords, &text,
+                                   &textLength, &limit) ||
+      !engineReady(self))
+    return NULL;
+  if (limit < 1) {
+    PyErr_SetString(PyExc_ValueError, "limit must be at least 1");
+    return NULL;
+  }
+  if (textLength > INT_MAX)
+    return PyList_New(0);
+  /* No search matches more than the catalog holds */
+  if (limit > self->ht.count)
+    limit = self->ht.count;
+
+  int32_t *ids = (int32_t *)PyMem_RawMalloc((size_t)limit * sizeof(int32_t));
+  if (ids == NULL)
+    return PyErr_NoMemory();
+
+  /* text belongs to a str the caller holds, so it outlives the search */
+  StringView query = {text, (int)textLength};
+  int count;
+  Py_BEGIN_ALLOW_THREADS
+  count = searchTitles(&self->titles, query, ids, limit);
+  Py_END_ALLOW_THREADS
+
+  PyObject *rows = PyList_New(count);
+  for (int i = 0; rows != NULL && i < count; i++) {
+    PyObject *row = movieTuple(&self->ht, ids[i]);
+    if (row == NULL) {
+      Py_CLEAR(rows);
+      break;
+    }
+    PyList_SET_ITEM(rows, i, row);
+  }
+  PyMem_RawFree(ids);
+  return rows;
+}
+
+static Py_ssize_t engineLength(EngineObject *self) {
+  return self->loaded ? self->ht.count : 0;
+}
+
+static PyMethodDef engineMethods[] = {
+    {"recommend", (PyCFunction)(void (*)(void))engineRecommend,
+     METH_VARARGS | METH_KEYWORDS,
+     "recommend(movie_id, genre_weight, rating_weight, director_weight, "
+     "count=20)\n--\n\n"
+     "Best count recommendations as (id, title, genre, rating, director) "
+     "tuples, best first. Raises KeyError for an unknown movie_id."},
+    {"recommend_ids", (PyCFunction)(void (*)(void))engineRecommendIds,
+     METH_VARARGS | METH_KEYWORDS,
+     "recommend_ids(movie_id, genre_weight, rating_weight, director_weight, "
+     "count=20)\n--\n\n"
+     "Like recommend, but only the movie IDs as an array('i')."},
+    {"movie", (PyCFunction)engineMovie, METH_VARARGS,
+     "movie(movie_id)\n--\n\n"
+     "The catalog row (id, title, genre, rating, director) of movie_id."},
+    {"search", (PyCFunction)(void (*)(void))engineSearch,
+     METH_VARARGS | METH_KEYWORDS,
+     "search(text, limit=10)\n--\n\n"
+     "Rows of the first limit movies whose title contains text, ignoring "
+     "case, in catalog order."},
+    {NULL, NULL, 0, NULL}};
+
+static PySequenceMethods engineSequence = {
+    .sq_length = (lenfunc)engineLength,
+};
+
+static PyTypeObject EngineType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "recommender_ext.Engine",
+    .tp_doc = "Engine(movies_file, implicit=False, threads=0, candidates=0, "
+              "approximate=False)\n--\n\n"
+              "A loaded catalog with its knowledge graph. Safe to query "
+              "from many threads at once. candidates=m precomputes the "
+              "best m neighbors per edge type mix of hot movies; "
+              "approximate answers counts above m from them as well.",
+    .tp_basicsize = sizeof(EngineObject),
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)engineInit,
+    .tp_dealloc = (destructor)engineDealloc,
+    .tp_methods = engineMethods,
+    .tp_as_sequence = &engineSequence,
+};
+
+/* =====================================================
+ * MODULE
+ * ===================================================== */
+
+static struct PyModuleDef recommenderModule = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "recommender_ext",
+    .m_doc = "In-process bindings for the C movie recommender engine.",
+    .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_recommender_ext(void) {
+  if (PyType_Ready(&EngineType) < 0)
+    return NULL;
+
+  PyObject *module = PyModule_Create(&recommenderModule);
+  if (module == NULL)
+    return NULL;
+
+  Py_INCREF(&EngineType);
+  if (PyModule_AddObject(module, "Engine", (PyObject *)&EngineType) < 0) {
+    Py_DECREF(&EngineType);
+    Py_DECREF(module);
+    return NULL;
+  }
+  if (PyModule_AddIntConstant(module, "MAX_RECOMMENDATIONS",
+                              MAX_RECOMMENDATIONS) < 0) {
+    Py_DECREF(module);
+    return NULL;
+  }
+  return module;
+}
@@ -0,0 +1,33 @@
+"""
+setup.py - Builds the recommender_ext CPython module
+
+The module links the C engine in directly (its command line main is
+compiled out), so app.py can query it without a subprocess.
+
+Usage: python setup.py build_ext --inplace
+"""
+
+import os
+
+from setuptools import Extension, setup
+
+libraries = [] if os.name == 'nt' else ['m']
+extra_compile_args = ['/O2'] if os.name == 'nt' else ['-O2', '-pthread']
+extra_link_args = [] if os.name == 'nt' else ['-pthread']
+
+setup(
+    name='recommender_ext',
+    version='1.0',
+    description='In-process bindings for the C movie recommender engine',
+    ext_modules=[
+        Extension(
+            'recommender_ext',
+            sources=['recommender_ext.c', 'recommender.c'],
+            depends=['movie.h'],
+            define_macros=[('RECOMMENDER_NO_MAIN', None)],
+            libraries=libraries,
+            extra_compile_args=extra_compile_args,
+            extra_link_args=extra_link_args,
+        )
+    ],
+)